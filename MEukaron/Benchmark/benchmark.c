@@ -29,6 +29,9 @@ typedef s32 ret_t;
 /* The parameter passing - not to be confused with kernel macros. These macros just place the parameters */
 #define RME_PARAM_D1(X)                     (((X)&RME_PARAM_D_MASK)<<(sizeof(ptr_t)*4))
 #define RME_PARAM_D0(X)                     ((X)&RME_PARAM_D_MASK)
+/* Infinite time transfer. Budgets are counted in processor cycles, so any fixed
+ * amount may run out in the middle of a benchmark */
+#define RME_THD_INF_TIME                    ((((ptr_t)(-1))>>1)-1)
 
 #define RME_PARAM_Q3(X)                     (((X)&RME_PARAM_Q_MASK)<<(sizeof(ptr_t)*6))
 #define RME_PARAM_Q2(X)                     (((X)&RME_PARAM_Q_MASK)<<(sizeof(ptr_t)*4))
@@ -49,33 +52,65 @@ typedef s32 ret_t;
 #define RME_BOOT_CAPTBL          0
 /* The top-level page table of the init process - always 4GB full range split into 8 pages */
 #define RME_BOOT_PGTBL           1
-/* The top-level page table of the init process's SRAM */
-#define RME_BOOT_PGTBL_SRAM      2
 /* The init process */
-#define RME_BOOT_INIT_PROC       3
+#define RME_BOOT_INIT_PROC       2
 /* The init thread */
-#define RME_BOOT_INIT_THD        4
+#define RME_BOOT_INIT_THD        3
 /* The initial kernel function capability */
-#define RME_BOOT_INIT_KERN       5
+#define RME_BOOT_INIT_KERN       4
 /* The initial kernel memory capability */
-#define RME_BOOT_INIT_KMEM       6
+#define RME_BOOT_INIT_KMEM       5
 /* The initial timer endpoint */
-#define RME_BOOT_INIT_TIMER      7
+#define RME_BOOT_INIT_TIMER      6
+/* The initial fault endpoint */
+#define RME_BOOT_INIT_FAULT      7
+/* The initial interrupt endpoint */
+#define RME_BOOT_INIT_INT        8
 
 /* The test objects */
-#define RME_BOOT_BENCH_THD       8
-#define RME_BOOT_BENCH_PGTBL_TOP 9
-#define RME_BOOT_BENCH_PGTBL_SRAM 10
+#define RME_BOOT_BENCH_THD       9
+#define RME_BOOT_BENCH_PGTBL_TOP 10
+#define RME_BOOT_BENCH_PGTBL_SRAM 11
+
+/* The stack safe size */
+#define RME_STACK_SAFE_SIZE 16
 
 /* Need to export the memory frontier! */
 /* Need to export the flags as well ! */
 /* Export the errno too */
+#ifdef RME_BENCH_MPS2
+/* The MPS2 images on QEMU, built with GCC. The CMSDK timer 1 counts down at the
+ * system clock, and the results are printed to the CMSDK UART 0 */
+#ifdef RME_BENCH_MPS2_AN505
+/* The AN505 kernel runs in the secure state, so the secure aliases are used */
+#define RME_BOOT_BENCH_KMEM_FRONTIER 0x38005000
+#define RME_MPS2_TIMER1_BASE         0x50001000
+#define RME_MPS2_UART0_BASE          0x50200000
+#else
+#define RME_BOOT_BENCH_KMEM_FRONTIER 0x20005000
+#define RME_MPS2_TIMER1_BASE         0x40001000
+#define RME_MPS2_UART0_BASE          0x40004000
+#endif
+#define RME_MPS2_TIMER1_CTRL         (*((volatile ptr_t*)(RME_MPS2_TIMER1_BASE+0x00)))
+#define RME_MPS2_TIMER1_VALUE        (*((volatile ptr_t*)(RME_MPS2_TIMER1_BASE+0x04)))
+#define RME_MPS2_TIMER1_RELOAD       (*((volatile ptr_t*)(RME_MPS2_TIMER1_BASE+0x08)))
+#define RME_MPS2_UART0_DATA          (*((volatile ptr_t*)(RME_MPS2_UART0_BASE+0x00)))
+#define RME_MPS2_UART0_STATE         (*((volatile ptr_t*)(RME_MPS2_UART0_BASE+0x04)))
+#define RME_TSC()                    (~RME_MPS2_TIMER1_VALUE)
+#define RME_TSC_OVERHEAD             0
+#define RME_BENCH_PUTCHAR(CHAR) \
+do \
+{ \
+    while((RME_MPS2_UART0_STATE&0x01)!=0); \
+    RME_MPS2_UART0_DATA=(ptr_t)(CHAR); \
+} \
+while(0)
+#else
 #define RME_BOOT_BENCH_KMEM_FRONTIER 0x10005000
-
-/* The stack safe size */
-#define RME_STACK_SAFE_SIZE 16
-
-#define RME_TSC() TIM2->CNT
+#define RME_TSC()                    TIM2->CNT
+/* The TSC is always 8 cycles between reads */
+#define RME_TSC_OVERHEAD             8
+#endif
 
 /* Need to export the system priority limit! */
 struct RME_CMX_Ret_Stack
@@ -112,7 +147,9 @@ struct RME_CMX_Ret_Stack
 
 /* Includes ******************************************************************/
 #include "RME.h"
+#ifndef RME_BENCH_MPS2
 #include "stm32f7xx.h"
+#endif
 /* Need to export error codes, and size of each object, in words! */
 /* End Includes **************************************************************/
 
@@ -132,6 +169,11 @@ ptr_t _RME_Stack_Init(ptr_t Stack, ptr_t Stub, ptr_t Param1, ptr_t Param2, ptr_t
 void RME_Benchmark(void);
 void RME_Same_Proc_Thd_Switch_Test_Thd(ptr_t Param1, ptr_t Param2, ptr_t Param3, ptr_t Param4);
 void RME_Same_Proc_Thd_Switch_Test(void);
+#ifdef RME_BENCH_PUTCHAR
+void RME_Bench_Print_Uint(ptr_t Uint);
+void RME_Bench_Print_String(s8* String);
+void RME_Bench_Report(s8* Name, cnt_t Num);
+#endif
 /* End Function Prototypes ***************************************************/
 
 /* Begin Function:_RME_Tsc_Init ***********************************************
@@ -142,6 +184,13 @@ Return      : None.
 ******************************************************************************/
 void _RME_Tsc_Init(void)
 {
+#ifdef RME_BENCH_MPS2
+    /* Free-running from the maximum value, without interrupts */
+    RME_MPS2_TIMER1_CTRL=0;
+    RME_MPS2_TIMER1_RELOAD=(ptr_t)(-1);
+    RME_MPS2_TIMER1_VALUE=(ptr_t)(-1);
+    RME_MPS2_TIMER1_CTRL=0x01;
+#endif
 //    TIM_HandleTypeDef TIM2_Handle;
 //    
 //    /* Initialize timer 2 to run at the same speed as the CPU */
@@ -156,6 +205,90 @@ void _RME_Tsc_Init(void)
 }
 /* End Function:_RME_Tsc_Init ************************************************/
 
+#ifdef RME_BENCH_PUTCHAR
+/* Begin Function:RME_Bench_Print_Uint ****************************************
+Description : Print an unsigned integer in decimal.
+Input       : ptr_t Uint - The integer.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void RME_Bench_Print_Uint(ptr_t Uint)
+{
+    s8 Digit[10];
+    cnt_t Count;
+    
+    Count=0;
+    do
+    {
+        Digit[Count]=(s8)('0'+Uint%10);
+        Uint/=10;
+        Count++;
+    }
+    while(Uint!=0);
+    
+    while(Count>0)
+    {
+        Count--;
+        RME_BENCH_PUTCHAR(Digit[Count]);
+    }
+}
+/* End Function:RME_Bench_Print_Uint *****************************************/
+
+/* Begin Function:RME_Bench_Print_String **************************************
+Description : Print a string.
+Input       : s8* String - The string.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void RME_Bench_Print_String(s8* String)
+{
+    while(*String!='\0')
+    {
+        RME_BENCH_PUTCHAR(*String);
+        String++;
+    }
+}
+/* End Function:RME_Bench_Print_String ***************************************/
+
+/* Begin Function:RME_Bench_Report ********************************************
+Description : Print the average, minimum and maximum of the recorded times, in
+              a fixed one-line format so that runs can be compared by scripts.
+Input       : s8* Name - The name of the test.
+              cnt_t Num - The number of recorded times.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void RME_Bench_Report(s8* Name, cnt_t Num)
+{
+    cnt_t Count;
+    ptr_t Total;
+    ptr_t Min;
+    ptr_t Max;
+    
+    Total=0;
+    Min=(ptr_t)(-1);
+    Max=0;
+    for(Count=0;Count<Num;Count++)
+    {
+        Total+=Time[Count];
+        if(Time[Count]<Min)
+            Min=Time[Count];
+        if(Time[Count]>Max)
+            Max=Time[Count];
+    }
+    
+    RME_Bench_Print_String(Name);
+    RME_Bench_Print_String((s8*)": avg ");
+    RME_Bench_Print_Uint(Total/Num);
+    RME_Bench_Print_String((s8*)" min ");
+    RME_Bench_Print_Uint(Min);
+    RME_Bench_Print_String((s8*)" max ");
+    RME_Bench_Print_Uint(Max);
+    RME_Bench_Print_String((s8*)"\r\n");
+}
+/* End Function:RME_Bench_Report *********************************************/
+#endif
+
 /* Begin Function:_RME_Stack_Init *********************************************
 Description : The thread's stack initializer, initializes the thread's stack.
 Input       : None.
@@ -237,11 +370,11 @@ void RME_Same_Proc_Thd_Switch_Test(void)
                       (ptr_t)RME_Same_Proc_Thd_Switch_Test_Thd,
                       Stack_Addr);
                       
-    /* Delegate some timeslice to it */
+    /* Delegate infinite time to it */
     Retval=RME_CAP_OP(RME_SVC_THD_TIME_XFER,0,
                       RME_BOOT_BENCH_THD,
                       RME_BOOT_INIT_THD,
-                      10000000);
+                      RME_THD_INF_TIME);
     
     /* Try to switch to that thread - should fail */
     Retval=RME_CAP_OP(RME_SVC_THD_SWT,0,
@@ -272,9 +405,12 @@ void RME_Same_Proc_Thd_Switch_Test(void)
                           0,
                           0);
         Temp=RME_TSC()-Temp;
-        Time[Count]=Temp-8;
+        Time[Count]=Temp-RME_TSC_OVERHEAD;
     }
     
+#ifdef RME_BENCH_PUTCHAR
+    RME_Bench_Report((s8*)"Same-process thread switch", 10000);
+#endif
     while(1);
 }
 /* End Function:RME_Same_Proc_Thd_Switch_Test ********************************/
@@ -361,11 +497,11 @@ void RME_Diff_Proc_Thd_Switch_Test(void)
                       (ptr_t)RME_Same_Proc_Thd_Switch_Test_Thd,
                       Stack_Addr);
                       
-    /* Delegate some timeslice to it */
+    /* Delegate infinite time to it */
     Retval=RME_CAP_OP(RME_SVC_THD_TIME_XFER,0,
                       RME_BOOT_BENCH_THD,
                       RME_BOOT_INIT_THD,
-                      10000000);
+                      RME_THD_INF_TIME);
     
     /* Try to switch to that thread - should fail */
     Retval=RME_CAP_OP(RME_SVC_THD_SWT,0,
@@ -396,7 +532,7 @@ void RME_Diff_Proc_Thd_Switch_Test(void)
                           0,
                           0);
         Temp=RME_TSC()-Temp;
-        Time[Count]=Temp-8;
+        Time[Count]=Temp-RME_TSC_OVERHEAD;
     }
     
     while(1);
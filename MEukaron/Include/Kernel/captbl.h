@@ -85,6 +85,8 @@ Description : The header of type table.
 #define RME_CAP_H(X)               ((X)>>(sizeof(ptr_t)*2))
 /* Low-level capability table capability position */
 #define RME_CAP_L(X)               ((X)&RME_MASK_END(sizeof(ptr_t)*2-2))
+/* Make a 2-layer capid from the high-level and low-level positions */
+#define RME_CAPID(X,Y)             (((X)<<(sizeof(ptr_t)*2))|RME_CAPID_2L|(Y))
 
 /* When we are clearing capabilities */
 #define RME_CAP_CLEAR(X) \
@@ -114,6 +114,8 @@ Description : The header of kernel system call path.
 
 /* Debugging */
 #define RME_KERNEL_DEBUG_MAX_STR      128
+/* The size of the per-CPU kernel console buffer */
+#define RME_CONSOLE_SIZE              (((ptr_t)1)<<RME_CONSOLE_ORDER)
 /* Printk macros */
 #define RME_PRINTK_I(INT)             RME_Print_Int((INT))
 #define RME_PRINTK_U(UINT)            RME_Print_Uint((UINT))
@@ -134,7 +136,8 @@ do \
         RME_PRINTK_S(" , "); \
         RME_PRINTK_S(__TIME__); \
         RME_PRINTK_S("\r\n"); \
-        while(1); \
+        while(1) \
+            _RME_Console_Flush(); \
     } \
 } \
 while(0)
@@ -172,6 +175,19 @@ struct RME_Cap_Kmem
     ptr_t End;
     ptr_t Info[1];
 };
+
+/* The per-CPU kernel console buffer. Only its own CPU puts characters in, and only
+ * the CPU holding the console lock takes them out, so it needs no lock itself. All
+ * of it is volatile, so the compiler keeps the character stores before the Tail
+ * store that publishes them, and the loads before the Head store that frees them */
+struct RME_Console
+{
+    /* Where the next character is taken out - only changed by the drainer */
+    volatile ptr_t Head;
+    /* Where the next character is put in - only changed by its own CPU */
+    volatile ptr_t Tail;
+    volatile s8 Buf[RME_CONSOLE_SIZE];
+};
 /*****************************************************************************/
 /* __KERNEL_H_STRUCTS__ */
 #endif
@@ -196,7 +212,11 @@ struct RME_Cap_Kmem
 /* If the header is not used in the public mode */
 #ifndef __HDR_PUBLIC_MEMBERS__
 /*****************************************************************************/
-
+/* The kernel console buffers of the booted CPUs, one for each, given by the platform */
+static struct RME_Console* RME_Console;
+static ptr_t RME_Console_Num;
+/* Whether some CPU is draining the kernel console buffers */
+static volatile ptr_t RME_Console_Lock;
 /*****************************************************************************/
 /* End Private Global Variables **********************************************/
 
@@ -218,11 +238,15 @@ static ret_t __RME_Low_Level_Check(void);
 /*****************************************************************************/
 /* TODO:This can cause some cache-line contention, and NUMA problems. Fix these later */
 /* Current timestamp counter */
-__EXTERN__ ptr_t RME_Timestamp;
+__EXTERN__ RME_HOT_DATA ptr_t RME_Timestamp;
 /* Current thread per CPU */
-__EXTERN__ struct RME_Thd_Struct* RME_Cur_Thd[RME_CPU_NUM];
+__EXTERN__ RME_HOT_DATA struct RME_Thd_Struct* RME_Cur_Thd[RME_CPU_NUM];
+#if(RME_CYC_BUDGET==RME_TRUE)
+/* Cycle counter value when the current thread was last charged per CPU */
+__EXTERN__ RME_HOT_DATA ptr_t RME_Cycle_Stamp[RME_CPU_NUM];
+#endif
 /* Kernel tick timer endpoint per CPU */
-__EXTERN__ struct RME_Sig_Struct* RME_Tick_Sig[RME_CPU_NUM];
+__EXTERN__ RME_HOT_DATA struct RME_Sig_Struct* RME_Tick_Sig[RME_CPU_NUM];
 /* Kernel fault vector endpoint per CPU */
 __EXTERN__ struct RME_Sig_Struct* RME_Fault_Sig[RME_CPU_NUM];
 /* Default interrupt vector endpoint per CPU */
@@ -236,7 +260,7 @@ __EXTERN__ struct RME_Sig_Struct* RME_Int_Sig[RME_CPU_NUM];
 /* Kernel entry */
 __EXTERN__ ret_t RME_Kmain(void);
 /* Increase counter */
-__EXTERN__ ptr_t _RME_Timestamp_Inc(cnt_t Value);
+__EXTERN__ RME_HOT_TEXT ptr_t _RME_Timestamp_Inc(cnt_t Value);
 /* Clear memory */
 __EXTERN__ void _RME_Clear(void* Addr, ptr_t Size);
 /* Kernel capability */
@@ -244,12 +268,23 @@ __EXTERN__ ret_t _RME_Kern_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Cap
 __EXTERN__ ret_t _RME_Kern_Act(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
                                cid_t Cap_Kern, ptr_t Func_ID, ptr_t Param1, ptr_t Param2);
 /* Kernel memory capability */
-__EXTERN__ ret_t _RME_Kmem_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Kmem);
+__EXTERN__ ret_t _RME_Kmem_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Kmem,
+                                    ptr_t Start, ptr_t Size);
 /* System call handler */
-__EXTERN__ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg);
+__EXTERN__ RME_HOT_TEXT void _RME_Svc_Handler(struct RME_Reg_Struct* Reg);
 /* Timer interrupt handler */
-__EXTERN__ void _RME_Tick_Handler(struct RME_Reg_Struct* Reg);
+__EXTERN__ RME_HOT_TEXT void _RME_Tick_Handler(struct RME_Reg_Struct* Reg);
+#if(RME_CYC_BUDGET==RME_TRUE)
+/* Budget timer handler */
+__EXTERN__ RME_HOT_TEXT void _RME_Budget_Handler(struct RME_Reg_Struct* Reg);
+#endif
+/* Deferred rescheduling handler */
+__EXTERN__ RME_HOT_TEXT void _RME_Resched_Handler(struct RME_Reg_Struct* Reg);
 /* Debugging helpers */
+struct RME_Console;
+__EXTERN__ void _RME_Console_Init(struct RME_Console* Console, ptr_t Num);
+__EXTERN__ ptr_t _RME_Putchar(s8 Char);
+__EXTERN__ void _RME_Console_Flush(void);
 __EXTERN__ cnt_t RME_Print_Uint(ptr_t Uint);
 __EXTERN__ cnt_t RME_Print_Int(cnt_t Int);
 __EXTERN__ cnt_t RME_Print_String(s8* String);
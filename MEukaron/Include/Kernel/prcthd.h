@@ -43,6 +43,8 @@ Description : The header of page table.
 /* Get the size of kernel objects */
 #define RME_PROC_SIZE              sizeof(struct RME_Proc_Struct)
 #define RME_THD_SIZE               sizeof(struct RME_Thd_Struct)
+/* The process spawn extra parameter packed in the svc number - thread maximum priority */
+#define RME_PARAM_MP(SVC)          ((SVC)>>((sizeof(ptr_t)<<1)))
     
 /* Time checking macro */
 #define RME_TIME_CHECK(DST,AMOUNT) \
@@ -101,6 +103,10 @@ struct RME_Proc_Struct
     struct RME_Cap_Captbl* Captbl;
     /* The page table struct */
     struct RME_Cap_Pgtbl* Pgtbl;
+    /* The fault handler invocation port, if there is one */
+    struct RME_Cap_Inv* Fault_Inv;
+    /* The fault messages for the fault handler - one for each activation record */
+    ptr_t Fault_Buf;
 };
 
 /* The thread capability structure */
@@ -125,8 +131,14 @@ struct RME_Thd_Sched
     ptr_t TID;
     /* What core is it on, and did it bond itself to a core? */
     ptr_t CPUID_Bind;
-    /* How much time slices is left for this thread? */
+    /* How much time slices is left for this thread? These are processor cycles
+     * if the RME_CYC_BUDGET is RME_TRUE */
     ptr_t Slices;
+#if(RME_CYC_BUDGET==RME_TRUE)
+    /* How many cycles did it overrun its budget by? This is paid off first from
+     * whatever time is transferred to it later */
+    ptr_t Debt;
+#endif
     /* What is the current state of the thread? */
     ptr_t State;
     /* How many children refered to it as the scheduler thread? */
@@ -145,6 +157,21 @@ struct RME_Thd_Sched
     struct RME_List Event;
 };
 
+/* The fault message delivered to a process fault handler, on hypervisor accessible
+ * memory. If the handler returns a non-negative value, the faulting thread resumes
+ * with the register set in this message, so the handler can change it. Only the
+ * kernel-saved part of the context is here; on Cortex-M, that is SP, R4-R11 and LR,
+ * while R0-R3, R12, PC and xPSR stay in the hardware-stacked frame on the user stack */
+struct RME_Fault_Frame
+{
+    /* The reason of the fault - architectural specific */
+    ptr_t Reason;
+    /* The faulting address, if the architecture have one */
+    ptr_t Addr;
+    /* The kernel-saved registers of the faulting thread */
+    struct RME_Reg_Struct Reg;
+};
+
 /* The thread register set structure on hypervisor accessible memory */
 struct RME_Thd_Regs 
 {
@@ -197,7 +224,7 @@ struct RME_Thd_Struct
 /* The TID incremental counter */
 static ptr_t RME_TID_Inc;
 /* The per-core priority and running list */
-static struct RME_Run_Struct RME_Run[RME_CPU_NUM];
+static RME_HOT_DATA struct RME_Run_Struct RME_Run[RME_CPU_NUM];
 /*****************************************************************************/
 /* End Private Global Variables **********************************************/
 
@@ -225,25 +252,34 @@ static struct RME_Run_Struct RME_Run[RME_CPU_NUM];
 /*****************************************************************************/
 /* Linked list operations */
 __EXTERN__ void __RME_List_Crt(volatile struct RME_List* Head);
-__EXTERN__ void __RME_List_Del(volatile struct RME_List* Prev,
-                              volatile struct RME_List* Next);
-__EXTERN__ void __RME_List_Ins(volatile struct RME_List* New,
-                              volatile struct RME_List* Prev,
-                              volatile struct RME_List* Next);
+__EXTERN__ RME_HOT_TEXT void __RME_List_Del(volatile struct RME_List* Prev,
+                                           volatile struct RME_List* Next);
+__EXTERN__ RME_HOT_TEXT void __RME_List_Ins(volatile struct RME_List* New,
+                                           volatile struct RME_List* Prev,
+                                           volatile struct RME_List* Next);
 /* Helper functions */
 __EXTERN__ ret_t __RME_Thd_Inv_Top(struct RME_Thd_Struct* Thd, struct RME_Reg_Struct** Reg,
                                    struct RME_Cop_Struct** Cop_Reg, struct RME_Proc_Struct** Proc);
 __EXTERN__ ret_t __RME_Thd_Inv_Top_Reg(struct RME_Thd_Struct* Thd, struct RME_Reg_Struct** Reg);
 __EXTERN__ ret_t __RME_Thd_Inv_Top_Proc(struct RME_Thd_Struct* Thd, struct RME_Proc_Struct** Proc);
 __EXTERN__ ret_t __RME_Thd_Fatal(struct RME_Reg_Struct* Regs);
+__EXTERN__ ret_t __RME_Thd_Fault(struct RME_Reg_Struct* Reg, ptr_t Reason, ptr_t Addr);
 /* In-kernel ready-queue primitives */
-__EXTERN__ ret_t _RME_Run_Ins(struct RME_Thd_Struct* Thd);
-__EXTERN__ ret_t _RME_Run_Del(struct RME_Thd_Struct* Thd);
-__EXTERN__ struct RME_Thd_Struct* _RME_Run_High(ptr_t CPUID);
-__EXTERN__ ret_t _RME_Run_Notif(struct RME_Thd_Struct* Thd);
-__EXTERN__ ret_t _RME_Run_Swt(struct RME_Reg_Struct* Reg,
-                              struct RME_Thd_Struct* Curr_Thd, 
-                              struct RME_Thd_Struct* Next_Thd);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Run_Ins(struct RME_Thd_Struct* Thd);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Run_Del(struct RME_Thd_Struct* Thd);
+__EXTERN__ RME_HOT_TEXT struct RME_Thd_Struct* _RME_Run_High(ptr_t CPUID);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Run_Notif(struct RME_Thd_Struct* Thd);
+#if(RME_CYC_BUDGET==RME_TRUE)
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Run_Charge(struct RME_Thd_Struct* Thd, ptr_t CPUID);
+__EXTERN__ ret_t _RME_Run_Repay(struct RME_Thd_Struct* Thd);
+#endif
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Run_Timeout(struct RME_Reg_Struct* Reg, ptr_t CPUID);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Run_Swt(struct RME_Reg_Struct* Reg,
+                                           struct RME_Thd_Struct* Curr_Thd, 
+                                           struct RME_Thd_Struct* Next_Thd);
+__EXTERN__ ret_t _RME_Run_Handoff(struct RME_Reg_Struct* Reg,
+                                  struct RME_Thd_Struct* Curr_Thd, 
+                                  struct RME_Thd_Struct* Next_Thd, ret_t Retval);
 /* Initialization function */
 __EXTERN__ ret_t _RME_Prcthd_Init(void);
 /* Process system calls */
@@ -255,12 +291,14 @@ __EXTERN__ ret_t _RME_Proc_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl_C
 __EXTERN__ ret_t _RME_Proc_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Proc);
 __EXTERN__ ret_t _RME_Proc_Cpt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Proc, cid_t Cap_Captbl);
 __EXTERN__ ret_t _RME_Proc_Pgt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Proc, cid_t Cap_Pgtbl);
+__EXTERN__ ret_t _RME_Proc_Flt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Proc, cid_t Cap_Inv, ptr_t Kaddr);
 /* Thread system calls */
 __EXTERN__ ret_t _RME_Thd_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
                                    cid_t Cap_Thd, cid_t Cap_Proc, ptr_t Vaddr, ptr_t Prio);
 __EXTERN__ ret_t _RME_Thd_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Kmem,
                               cid_t Cap_Thd, cid_t Cap_Proc, ptr_t Max_Prio, ptr_t Vaddr);
 __EXTERN__ ret_t _RME_Thd_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Thd);
+__EXTERN__ ret_t _RME_Thd_Reset(struct RME_Cap_Captbl* Captbl, cid_t Cap_Thd);
 __EXTERN__ ret_t _RME_Thd_Exec_Set(struct RME_Cap_Captbl* Captbl, cid_t Cap_Thd, ptr_t Entry, ptr_t Stack);
 __EXTERN__ ret_t _RME_Thd_Hyp_Set(struct RME_Cap_Captbl* Captbl, cid_t Cap_Thd, ptr_t Kaddr);
 __EXTERN__ ret_t _RME_Thd_Sched_Bind(struct RME_Cap_Captbl* Captbl, cid_t Cap_Thd,
@@ -273,9 +311,14 @@ __EXTERN__ ret_t _RME_Thd_Sched_Free(struct RME_Cap_Captbl* Captbl,
 __EXTERN__ ret_t _RME_Thd_Sched_Rcv(struct RME_Cap_Captbl* Captbl, cid_t Cap_Thd);
 __EXTERN__ ret_t _RME_Thd_Time_Xfer(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
                                     cid_t Cap_Thd_Dst, cid_t Cap_Thd_Src, ptr_t Time);
-__EXTERN__ ret_t _RME_Thd_Swt(struct RME_Cap_Captbl* Captbl,
-                              struct RME_Reg_Struct* Reg,
-                              cid_t Cap_Thd, ptr_t Yield);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Thd_Swt(struct RME_Cap_Captbl* Captbl,
+                                           struct RME_Reg_Struct* Reg,
+                                           cid_t Cap_Thd, ptr_t Yield);
+/* Compound system calls */
+__EXTERN__ ret_t _RME_Proc_Spawn(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                                 cid_t Cap_Captbl, cid_t Cap_Kmem, cid_t Cap_Base,
+                                 cid_t Cap_Pgtbl, ptr_t Entry_Num, ptr_t Max_Prio, ptr_t Vaddr,
+                                 cid_t Cap_Thd_Sched, ptr_t Prio, ptr_t Time, ptr_t Entry, ptr_t Stack);
 /*****************************************************************************/
 /* Undefine "__EXTERN__" to avoid redefinition */
 #undef __EXTERN__
@@ -15,8 +15,13 @@ Description : The header of signal and invocation management facilities.
 #define RME_MAX_SIG_NUM           (((ptr_t)(-1))>>1)
 
 /* The kernel object sizes */
-#define RME_INV_SIZE          sizeof(struct RME_Inv_Struct)
+#define RME_INV_SIZE(NUM)     (sizeof(struct RME_Inv_Struct)+sizeof(struct RME_Inv_Act_Struct)*(NUM))
 #define RME_SIG_SIZE          sizeof(struct RME_Sig_Struct)
+
+/* The invocation creation extra parameter packed in the svc number - activation record number */
+#define RME_PARAM_IA(SVC)     ((SVC)>>((sizeof(ptr_t)<<1)))
+/* Get the activation record array, which is placed right after the invocation port */
+#define RME_INV_ACT(INV)      ((struct RME_Inv_Act_Struct*)(((ptr_t)(INV))+sizeof(struct RME_Inv_Struct)))
 /*****************************************************************************/
 /* __SIGINV_H_DEFS__ */
 #endif
@@ -36,12 +41,22 @@ Description : The header of signal and invocation management facilities.
 /* The signal structure */
 struct RME_Sig_Struct
 {
-    /* Is this a kernel signal endpoint? */
+    /* If a batch is being held back, the endpoint is in the per-CPU moderation list */
+    struct RME_List Mod_Head;
+    /* Is this a kernel signal endpoint? This counts the kernel sources (e.g. interrupts)
+     * that are bound to it, and the endpoint cannot be deleted until it drops to 0 */
     ptr_t Kernel_Flag;
     /* The number of signals sent to here */
     ptr_t Signal_Num;
     /* What thread blocked on this one */
     struct RME_Thd_Struct* Thd;
+    /* Interrupt moderation - when the count is 2 or more, the kernel will only wake the
+     * receiver after this many signals, or this many ticks after the first one of the
+     * batch arrived, whichever comes first. The time is never 0 when this is armed */
+    ptr_t Mod_Num;
+    ptr_t Mod_Time;
+    /* When did the first signal of the current batch arrive? */
+    ptr_t Mod_Stamp;
 };
 
 /* The signal capability */
@@ -51,15 +66,28 @@ struct RME_Cap_Sig
     ptr_t Info[3];
 };
 
+/* The invocation port. It is followed by an array of activation records in the
+ * same kernel memory block, and each caller takes one record when it enters. */
 struct RME_Inv_Struct
 {
-    /* This will be inserted into a thread structure */
-    struct RME_List Head;
     /* The process pointer */
     struct RME_Proc_Struct* Proc;
-    /* Is the invocation currently active? If yes, we cannot delete */
+    /* The number of activation records following this header */
+    ptr_t Act_Num;
+};
+
+/* The activation record of an invocation port */
+struct RME_Inv_Act_Struct
+{
+    /* This will be inserted into a thread structure */
+    struct RME_List Head;
+    /* The invocation port that this record belongs to */
+    struct RME_Inv_Struct* Inv;
+    /* Is the record currently active? If yes, we cannot delete the port */
     ptr_t Active;
-    /* The register set settings for invocation */
+    /* If this record is delivering a fault, this is the fault message */
+    struct RME_Fault_Frame* Fault;
+    /* The register set settings for invocation - each record have its own stack */
     struct RME_Reg_Struct Reg;
     /* The co-processor/peripheral settings for invocation */
     struct RME_Cop_Struct Cop_Reg;
@@ -100,13 +128,16 @@ struct RME_Cap_Inv
 /* If the header is not used in the public mode */
 #ifndef __HDR_PUBLIC_MEMBERS__
 /*****************************************************************************/
-
+/* Moderated endpoints that are holding back a batch of signals per CPU */
+static struct RME_List RME_Mod_Sig[RME_CPU_NUM];
 /*****************************************************************************/
 /* End Private Global Variables **********************************************/
 
 /* Private C Function Prototypes *********************************************/ 
 /*****************************************************************************/
-
+static ptr_t _RME_Sig_Take(struct RME_Sig_Struct* Sig_Struct);
+static void _RME_Kern_Wake(struct RME_Reg_Struct* Reg, struct RME_Sig_Struct* Sig_Struct);
+static struct RME_Inv_Act_Struct* _RME_Inv_Act_Get(struct RME_Inv_Struct* Inv_Struct);
 /*****************************************************************************/
 #define __EXTERN__
 /* End Private C Function Prototypes *****************************************/
@@ -126,23 +157,31 @@ struct RME_Cap_Inv
 
 /* Public C Function Prototypes **********************************************/
 /*****************************************************************************/
+__EXTERN__ ret_t _RME_Siginv_Init(void);
 __EXTERN__ ret_t _RME_Sig_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
                                    cid_t Cap_Sig, ptr_t Vaddr);
 __EXTERN__ ret_t _RME_Sig_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
                               cid_t Cap_Kmem, cid_t Cap_Sig, ptr_t Vaddr);
 __EXTERN__ ret_t _RME_Sig_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Sig);
-__EXTERN__ ret_t _RME_Kern_Snd(struct RME_Reg_Struct* Reg, struct RME_Sig_Struct* Sig);
-__EXTERN__ ret_t _RME_Sig_Snd(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg, cid_t Cap_Sig);
-__EXTERN__ ret_t _RME_Sig_Rcv(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg, cid_t Cap_Sig);
-
-__EXTERN__ ret_t _RME_Inv_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
-                              cid_t Cap_Kmem, cid_t Cap_Inv, cid_t Cap_Proc, ptr_t Vaddr);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Kern_Snd(struct RME_Reg_Struct* Reg, struct RME_Sig_Struct* Sig);
+__EXTERN__ ret_t _RME_Sig_Mod_Set(struct RME_Sig_Struct* Sig_Struct, ptr_t Mod_Num, ptr_t Mod_Time);
+__EXTERN__ void _RME_Sig_Mod_Clr(struct RME_Sig_Struct* Sig_Struct);
+__EXTERN__ RME_HOT_TEXT void _RME_Sig_Mod_Tick(struct RME_Reg_Struct* Reg);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Sig_Snd(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg, cid_t Cap_Sig);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Sig_Rcv(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg, cid_t Cap_Sig);
+__EXTERN__ ret_t _RME_Sig_Snd_Rcv(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                                  cid_t Cap_Sig_Snd, cid_t Cap_Sig_Rcv);
+
+__EXTERN__ ret_t _RME_Inv_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Kmem,
+                              cid_t Cap_Inv, cid_t Cap_Proc, ptr_t Vaddr, ptr_t Act_Num);
 __EXTERN__ ret_t _RME_Inv_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Inv);
-__EXTERN__ ret_t _RME_Inv_Set(struct RME_Cap_Captbl* Captbl, cid_t Cap_Inv, ptr_t Entry, ptr_t Stack);
-__EXTERN__ ret_t _RME_Inv_Act(struct RME_Cap_Captbl* Captbl, 
-                              struct RME_Reg_Struct* Reg,
-                              cid_t Cap_Inv, ptr_t Param);
-__EXTERN__ ret_t _RME_Inv_Ret(struct RME_Reg_Struct* Reg);
+__EXTERN__ ret_t _RME_Inv_Set(struct RME_Cap_Captbl* Captbl, cid_t Cap_Inv,
+                              ptr_t Entry, ptr_t Stack, ptr_t Stack_Size);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Inv_Act(struct RME_Cap_Captbl* Captbl, 
+                                           struct RME_Reg_Struct* Reg,
+                                           cid_t Cap_Inv, ptr_t Param);
+__EXTERN__ RME_HOT_TEXT ret_t _RME_Inv_Ret(struct RME_Reg_Struct* Reg, ptr_t Fault);
+__EXTERN__ ret_t _RME_Inv_Fault(struct RME_Reg_Struct* Reg, ptr_t Reason, ptr_t Addr);
 /*****************************************************************************/
 /* Undefine "__EXTERN__" to avoid redefinition */
 #undef __EXTERN__
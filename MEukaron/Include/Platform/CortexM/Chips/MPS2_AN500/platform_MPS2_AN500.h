@@ -0,0 +1,109 @@
+/******************************************************************************
+Filename   : platform_MPS2_AN500.h
+Author     : pry
+Date       : 24/06/2017
+Licence    : LGPL v3+; see COPYING for details.
+Description: The configuration file for the MPS2 AN500 Cortex-M7 FPGA image,
+             which is also emulated by QEMU as "mps2-an500". This is built with
+             GCC, and is intended for benchmarking without a hardware bench.
+******************************************************************************/
+
+/* Defines *******************************************************************/
+/* The CMSIS device header */
+#include "ARMCM7_DP.h"
+/* The virtual memory start address for the kernel objects */
+#define RME_KMEM_VA_START            0x20003000
+/* The size of the kernel object virtual memory */
+#define RME_KMEM_SIZE                0xD000
+/* The virtual memory start address for the virtual machines - If no virtual machines is used, set to 0 */
+#define RME_HYP_VA_START             0x20020000
+/* The size of the hypervisor reserved virtual memory */
+#define RME_HYP_SIZE                 0x60000
+/* The granularity of kernel memory allocation, in bytes */
+#define RME_KMEM_SLOT_ORDER          4
+/* Kernel stack size and address */
+#define RME_KMEM_STACK_ADDR          0x20000FF0
+/* The maximum number of preemption priority levels in the system.
+ * This parameter must be divisible by the word length - 32 is usually sufficient */
+#define RME_MAX_PREEMPT_PRIO         32
+
+/* Shared interrupt flag region address - always use 256*4 = 1kB memory */
+#define RME_CMX_INT_FLAG_ADDR        0x20010000
+/* Initial kenel object frontier limit */
+#define RME_CMX_KMEM_BOOT_FRONTIER   0x20003400
+/* Number of MPU regions available */
+#define RME_CMX_MPU_REGIONS          8
+/* What is the MPU type? */
+#define RME_CMX_MPU_TYPE             RME_CMX_MPU_V7M
+/* Init process's first thread's entry point address */
+#define RME_CMX_INIT_ENTRY           0x00010001
+/* Init process's first thread's stack address */
+#define RME_CMX_INIT_STACK           0x2001FFF0
+/* What is the FPU type? */
+#define RME_CMX_FPU_TYPE             RME_CMX_FPU_FPV5_DP
+/* What is the NVIC priority grouping? */
+#define RME_CMX_NVIC_GROUPING        RME_CMX_NVIC_GROUPING_P2S6
+/* What is the kernel interrupt mask priority? Interrupts above it (numerically lower)
+ * are zero-latency ones: the kernel never masks them, and they must have their own
+ * handlers that never touch the kernel. These are set up in RME_CMX_LOW_LEVEL_INIT */
+#define RME_CMX_INT_MASK_PRIO        0xC0
+/* What is the Systick value? - 10ms per tick at 25MHz */
+#define RME_CMX_SYSTICK_VAL          250000
+
+/* Kernel functions standard to Cortex-M, interrupt management and power */
+#define RME_CMX_KERN_INT(X)          (X)
+#define RME_CMX_INT_OP               0
+#define RME_CMX_INT_ENABLE           1
+#define RME_CMX_INT_DISABLE          0
+#define RME_CMX_INT_PRIO             1
+#define RME_CMX_INT_BIND             2
+#define RME_CMX_INT_UNBIND           3
+#define RME_CMX_INT_MOD              4
+#define RME_CMX_KERN_PWR             240
+#define RME_CMX_KERN_MPU             241
+
+/* Interrupt handler definitions - to facilitate transparent interrupts */
+#define  UART0RX_IRQHandler                      IRQ0_Handler        /* UART 0 RX */
+#define  UART0TX_IRQHandler                      IRQ1_Handler        /* UART 0 TX */
+#define  UART1RX_IRQHandler                      IRQ2_Handler        /* UART 1 RX */
+#define  UART1TX_IRQHandler                      IRQ3_Handler        /* UART 1 TX */
+#define  UART2RX_IRQHandler                      IRQ4_Handler        /* UART 2 RX */
+#define  UART2TX_IRQHandler                      IRQ5_Handler        /* UART 2 TX */
+#define  TIMER0_IRQHandler                       IRQ8_Handler        /* Timer 0 */
+#define  TIMER1_IRQHandler                       IRQ9_Handler        /* Timer 1 */
+#define  DUALTIMER_IRQHandler                    IRQ10_Handler       /* Dual timer */
+#define  UARTOVF_IRQHandler                      IRQ12_Handler       /* UART 0,1,2 overflow */
+
+/* The CMSDK UART0 */
+#define RME_MPS2_UART0_DATA          (*((volatile ptr_t*)0x40004000))
+#define RME_MPS2_UART0_STATE         (*((volatile ptr_t*)0x40004004))
+#define RME_MPS2_UART0_CTRL          (*((volatile ptr_t*)0x40004008))
+#define RME_MPS2_UART0_BAUDDIV       (*((volatile ptr_t*)0x40004010))
+#define RME_MPS2_UART_STATE_TXFULL   (1<<0)
+#define RME_MPS2_UART_CTRL_TXEN      (1<<0)
+
+/* Other low-level initialization stuff - The serial port */
+#define RME_CMX_LOW_LEVEL_INIT() \
+do \
+{ \
+    /* 115200 baud at 25MHz */ \
+    RME_MPS2_UART0_BAUDDIV=217; \
+    RME_MPS2_UART0_CTRL=RME_MPS2_UART_CTRL_TXEN; \
+} \
+while(0)
+
+/* This is for debugging output */
+#define RME_CMX_PUTCHAR(CHAR) \
+do \
+{ \
+    RME_MPS2_UART0_DATA=(ptr_t)(CHAR); \
+} \
+while(0)
+/* Is the debugging output still busy with the last character? */
+#define RME_CMX_PUTCHAR_BUSY() \
+    ((RME_MPS2_UART0_STATE&RME_MPS2_UART_STATE_TXFULL)!=0)
+/* End Defines ***************************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) Evo-Devo Instrum. All rights reserved ***********************/
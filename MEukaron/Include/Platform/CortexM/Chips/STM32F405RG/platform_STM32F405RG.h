@@ -27,6 +27,8 @@ Description: The configuration file for STM32F767IG.
 #define RME_CMX_KMEM_BOOT_FRONTIER   0x10003000
 /* Number of MPU regions available */
 #define RME_CMX_MPU_REGIONS          8
+/* What is the MPU type? */
+#define RME_CMX_MPU_TYPE             RME_CMX_MPU_V7M
 /* Init process's first thread's entry point address */
 #define RME_CMX_INIT_ENTRY           (0x08004000|0x01)
 /* Init process's first thread's stack address */
@@ -35,9 +37,25 @@ Description: The configuration file for STM32F767IG.
 #define RME_CMX_FPU_TYPE             RME_CMX_FPU_VFPV4
 /* What is the NVIC priority grouping? */
 #define RME_CMX_NVIC_GROUPING        RME_CMX_NVIC_GROUPING_P2S6
+/* What is the kernel interrupt mask priority? Interrupts above it (numerically lower)
+ * are zero-latency ones: the kernel never masks them, and they must have their own
+ * handlers that never touch the kernel. These are set up in RME_CMX_LOW_LEVEL_INIT */
+#define RME_CMX_INT_MASK_PRIO        0xC0
 /* What is the Systick value? */
 #define RME_CMX_SYSTICK_VAL          16800
 
+/* Kernel functions standard to Cortex-M, interrupt management and power */
+#define RME_CMX_KERN_INT(X)          (X)
+#define RME_CMX_INT_OP               0
+#define RME_CMX_INT_ENABLE           1
+#define RME_CMX_INT_DISABLE          0
+#define RME_CMX_INT_PRIO             1
+#define RME_CMX_INT_BIND             2
+#define RME_CMX_INT_UNBIND           3
+#define RME_CMX_INT_MOD              4
+#define RME_CMX_KERN_PWR             240
+#define RME_CMX_KERN_MPU             241
+
 /* Other low-level initialization stuff - The serial port */
 #define RME_CMX_LOW_LEVEL_INIT() \
 do \
@@ -53,6 +71,9 @@ do \
     ITM_SendChar((s8)(CHAR)); \
 } \
 while(0)
+/* Is the debugging output still busy with the last character? */
+#define RME_CMX_PUTCHAR_BUSY() \
+    ((((ITM->TCR)&ITM_TCR_ITMENA_Msk)!=0)&&(((ITM->TER)&1)!=0)&&((ITM->PORT[0].u32)==0))
 /* End Defines ***************************************************************/
 
 /* End Of File ***************************************************************/
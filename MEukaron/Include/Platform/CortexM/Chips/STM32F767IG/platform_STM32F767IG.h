@@ -33,6 +33,8 @@ Description: The configuration file for STM32F767IG.
 #define RME_CMX_KMEM_BOOT_FRONTIER   0x20003400
 /* Number of MPU regions available */
 #define RME_CMX_MPU_REGIONS          8
+/* What is the MPU type? */
+#define RME_CMX_MPU_TYPE             RME_CMX_MPU_V7M
 /* Init process's first thread's entry point address */
 #define RME_CMX_INIT_ENTRY           0x08010001
 /* Init process's first thread's stack address */
@@ -41,6 +43,10 @@ Description: The configuration file for STM32F767IG.
 #define RME_CMX_FPU_TYPE             RME_CMX_FPV5_DP
 /* What is the NVIC priority grouping? */
 #define RME_CMX_NVIC_GROUPING        RME_CMX_NVIC_GROUPING_P2S6
+/* What is the kernel interrupt mask priority? Interrupts above it (numerically lower)
+ * are zero-latency ones: the kernel never masks them, and they must have their own
+ * handlers that never touch the kernel. These are set up in RME_CMX_LOW_LEVEL_INIT */
+#define RME_CMX_INT_MASK_PRIO        0xC0
 /* What is the Systick value? - 10ms per tick*/
 #define RME_CMX_SYSTICK_VAL          2160000
 
@@ -50,7 +56,11 @@ Description: The configuration file for STM32F767IG.
 #define RME_CMX_INT_ENABLE           1
 #define RME_CMX_INT_DISABLE          0
 #define RME_CMX_INT_PRIO             1
+#define RME_CMX_INT_BIND             2
+#define RME_CMX_INT_UNBIND           3
+#define RME_CMX_INT_MOD              4
 #define RME_CMX_KERN_PWR             240
+#define RME_CMX_KERN_MPU             241
 
 /* Interrupt handler definitions - to facilitate transparent interrupts */
 #define  WWDG_IRQHandler                         IRQ0_Handler        /* Window WatchDog */                                       
@@ -262,6 +272,9 @@ do \
     ITM_SendChar((s8)(CHAR)); \
 } \
 while(0)
+/* Is the debugging output still busy with the last character? */
+#define RME_CMX_PUTCHAR_BUSY() \
+    ((((ITM->TCR)&ITM_TCR_ITMENA_Msk)!=0)&&(((ITM->TER)&1)!=0)&&((ITM->PORT[0].u32)==0))
 /* End Defines ***************************************************************/
 
 /* End Of File ***************************************************************/
@@ -84,6 +84,11 @@ typedef s32 ret_t;
 #define EXTERN                  extern
 /* Compiler "inline" keyword setting */
 #define INLINE                  __forceinline
+/* The sections of the hot kernel paths and data. The scatter files place them
+ * in zero wait state memory, which is ITCM and DTCM on Cortex-M7, or CCM on
+ * STM32F4 for the data only because the CCM is not executable there */
+#define RME_HOT_TEXT            __attribute__((section("RME_HOT_TEXT")))
+#define RME_HOT_DATA            __attribute__((section("RME_HOT_DATA")))
 /* Number of CPUs in the system */
 #define RME_CPU_NUM             1
 /* The order of bits in one CPU machine word */
@@ -92,6 +97,10 @@ typedef s32 ret_t;
 #define RME_VA_EQU_PA           (RME_TRUE)
 /* Quiescence timeslice value */
 #define RME_QUIE_TIME           0
+/* Thread budgets are counted in processor cycles with the DWT cycle counter */
+#define RME_CYC_BUDGET          (RME_TRUE)
+/* The kernel console buffer is 2^8=256 bytes */
+#define RME_CONSOLE_ORDER       8
 /* Normal page directory size calculation macro */
 #define RME_PGTBL_SIZE_NOM(NUM_ORDER)   ((1<<(NUM_ORDER))*sizeof(ptr_t)+sizeof(struct __RME_CMX_Pgtbl_Meta))
 /* Top-level page directory size calculation macro */
@@ -99,6 +108,14 @@ typedef s32 ret_t;
 
 /* The CPU and application specific macros are here */
 #include "platform_cmx_conf.h"
+/* By default, interrupts leave the switching to the PendSV, which comes after all
+ * of them, so a burst of interrupts causes only one context switch. The price is
+ * that the woken thread runs only after the PendSV exception entry. The chip header
+ * can set this to RME_FALSE to hand the processor over to the woken receiver right
+ * in the interrupt instead, which has the lowest latency for a single interrupt */
+#ifndef RME_RESCHED_DEFER
+#define RME_RESCHED_DEFER       (RME_TRUE)
+#endif
 /* End System macros *********************************************************/
 
 /* Cortex-M specific macros **************************************************/
@@ -176,6 +193,11 @@ typedef s32 ret_t;
 /* MPU operation flag */
 #define RME_CMX_MPU_CLR                 (0)
 #define RME_CMX_MPU_UPD                 (1)
+/* The number of dynamic regions that the MemManage handler can refill by itself */
+#define RME_CMX_MPU_REFILL              8
+/* Get the MPU metadata from a top-level page table capability */
+#define RME_CMX_PGTBL_MPU(X)            ((struct __RME_CMX_MPU_Data*)(RME_CAP_GETOBJ(X,ptr_t)+ \
+                                                                      sizeof(struct __RME_CMX_Pgtbl_Meta)))
 /* MPU definitions */
 /* Extract address for/from MPU */
 #define RME_CMX_MPU_ADDR(X)             ((X)&0xFFFFFFE0)
@@ -184,6 +206,7 @@ typedef s32 ret_t;
 /* Write info to MPU */
 #define RME_CMX_MPU_VALID               (1<<4)
 #define RME_CMX_MPU_SRDCLR              (0x0000FF00)
+#define RME_CMX_MPU_ATTR(X)             ((X)&0xFFFF0000)
 #define RME_CMX_MPU_XN                  (1<<28)
 #define RME_CMX_MPU_RO                  (2<<24)
 #define RME_CMX_MPU_RW                  (3<<24)
@@ -191,6 +214,19 @@ typedef s32 ret_t;
 #define RME_CMX_MPU_BUFFERABLE          (1<<16)
 #define RME_CMX_MPU_REGIONSIZE(X)       ((X+2)<<1)
 #define RME_CMX_MPU_SZENABLE            (1)
+/* MPU type definitions */
+#define RME_CMX_MPU_V7M                 (0)
+#define RME_CMX_MPU_V8M                 (1)
+/* ARMv8-M MPU base/limit register bits */
+#define RME_CMX_MPU_V8_XN               (1<<0)
+#define RME_CMX_MPU_V8_RW               (1<<1)
+#define RME_CMX_MPU_V8_RO               (3<<1)
+#define RME_CMX_MPU_V8_ATTRIDX(X)       ((X)<<1)
+#define RME_CMX_MPU_V8_EN               (1<<0)
+/* The memory attributes selected by the cacheable and bufferable bits in this
+ * order: none (strongly-ordered), bufferable (device), cacheable
+ * (write-through), both (write-back) */
+#define RME_CMX_MPU_V8_MAIR0            (0xFFAA0400)
 /* Cortex-M (ARMv8) EXC_RETURN values */
 #define RME_CMX_EXC_RET_BASE            (0xFFFFFF80)
 /* Whether we are returning to secure stack. 1 means yes, 0 means no */
@@ -205,6 +241,13 @@ typedef s32 ret_t;
 #define RME_CMX_EXC_RET_RET_PSP         (1<<2)
 /* Is this interrupt taken to a secured domain? 1 means yes, 0 means no */
 #define RME_CMX_EXC_INT_SECURE_DOMAIN   (1<<0)
+/* The handlers save the registers straight into the register area of the current
+ * thread, which RME_CMX_Cur_Reg points to, and a switch only moves that pointer.
+ * Because the live register set can move during a handler, the handlers are given
+ * this handle to it rather than its address, and every function that takes a
+ * register set resolves the handle with RME_CMX_REG */
+#define RME_CMX_REG_LIVE                ((struct RME_Reg_Struct*)(&RME_CMX_Cur_Reg))
+#define RME_CMX_REG(X)                  (((X)==RME_CMX_REG_LIVE)?RME_CMX_Cur_Reg:(X))
 /* FPU type definitions */
 #define RME_CMX_FPU_NONE                (0)
 #define RME_CMX_FPU_VFPV4               (1)
@@ -226,9 +269,31 @@ typedef s32 ret_t;
 #define RME_CMX_NVIC_GROUPING_P2S6      5
 #define RME_CMX_NVIC_GROUPING_P1S7      6
 #define RME_CMX_NVIC_GROUPING_P0S8      7
+/* The raw priority of the lowest preemption group, where all kernel interrupts are */
+#define RME_CMX_INT_KERN_PRIO           ((0xFF<<(RME_CMX_NVIC_GROUPING+1))&0xFF)
+/* The kernel critical sections must at least mask the kernel's own interrupts */
+#if((RME_CMX_INT_MASK_PRIO==0)||(RME_CMX_INT_MASK_PRIO>RME_CMX_INT_KERN_PRIO))
+#error The kernel interrupt mask priority must cover all kernel interrupts.
+#endif
+/* The lowest subpriority in that group is the PendSV's alone, so that it comes after
+ * all the other kernel interrupts. At least one subpriority bit must be implemented */
+#if((8-__NVIC_PRIO_BITS)>RME_CMX_NVIC_GROUPING)
+#error The NVIC priority grouping leaves no subpriority for the PendSV.
+#endif
+/* Convert a raw priority to what NVIC_SetPriority takes */
+#define RME_CMX_NVIC_PRIO(X)            (((X)&0xFF)>>(8-__NVIC_PRIO_BITS))
+/* The maximum number of external interrupt sources */
+#define RME_CMX_INT_NUM                 240
 /* Fault definitions */
 /* The NMI is active */
 #define RME_CMX_ICSR_NMIPENDSET         (((ptr_t)1)<<31)
+/* Set the PendSV pending */
+#define RME_CMX_ICSR_PENDSVSET          (((ptr_t)1)<<28)
+/* The SysTick is pending */
+#define RME_CMX_ICSR_PENDSTSET          (((ptr_t)1)<<26)
+/* The shortest period that the SysTick is set to, in cycles. A budget that runs
+ * out sooner than this is stopped this late, and the overrun becomes its debt */
+#define RME_CMX_SYSTICK_MIN             64
 /* Debug event has occurred. The Debug Fault Status Register has been updated */
 #define RME_CMX_HFSR_DEBUGEVT           (((ptr_t)1)<<31)
 /* Processor has escalated a configurable-priority exception to HardFault */
@@ -286,6 +351,11 @@ typedef s32 ret_t;
                                          RME_CMX_BFSR_LSPERR|RME_CMX_BFSR_STKERR| \
                                          RME_CMX_BFSR_UNSTKERR|RME_CMX_BFSR_IMPRECISERR| \
                                          RME_CMX_BFSR_PRECISERR|RME_CMX_BFSR_IBUSERR)
+/* These faults happened while stacking or unstacking, so the stacked frame is not usable */
+#define RME_CMX_FAULT_STACK             (RME_CMX_MFSR_MSTKERR|RME_CMX_MFSR_MUNSTKERR| \
+                                         RME_CMX_BFSR_STKERR|RME_CMX_BFSR_UNSTKERR)
+/* The position of PC in the hardware-stacked frame, in words */
+#define RME_CMX_STACK_PC                6
 /*****************************************************************************/
 /* __PLATFORM_CMX_H_DEFS__ */
 #endif
@@ -362,11 +432,28 @@ struct __RME_CMX_Pgtbl_Meta
     ptr_t Page_Flags;
 };
 
+/* The assembly MemManage handler depends on the layout of this struct up to Data */
 struct __RME_CMX_MPU_Data
 {
     /* [31:16] Static [15:0] Present */
     ptr_t State;
-    struct __RME_CMX_MPU_Entry Data[8];
+    /* The CLOCK hand that the dynamic region replacement starts from */
+    ptr_t Hand;
+    /* [15:0] Referenced since the hand last passed */
+    ptr_t Ref;
+    /* The number of MPU refill faults taken in this address space */
+    ptr_t Fault_Cnt;
+    /* The next refill entry to replace when all of them are taken */
+    ptr_t Refill_Hand;
+    /* The dynamic regions that the MemManage handler can load into region 0
+     * without walking the page table. The RBAR only contains the address */
+    struct __RME_CMX_MPU_Entry Refill[RME_CMX_MPU_REFILL];
+    /* The regions, always in ARMv7-M RBAR/RASR format */
+    struct __RME_CMX_MPU_Entry Data[RME_CMX_MPU_REGIONS];
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    /* The same regions converted to ARMv8-M RBAR/RLAR format */
+    struct __RME_CMX_MPU_Entry HW[RME_CMX_MPU_REGIONS];
+#endif
 };
 
 /* Interrupt flags - this type of flags will only appear on MPU-based systems */
@@ -406,19 +493,35 @@ struct __RME_CMX_Flags
 /* If the header is not used in the public mode */
 #ifndef __HDR_PUBLIC_MEMBERS__
 /*****************************************************************************/
-
+/* The signal endpoints that each interrupt source is bound to, if any */
+static struct RME_Sig_Struct* RME_CMX_Int_Sig[RME_CMX_INT_NUM];
+/* The kernel console buffer */
+static struct RME_Console RME_CMX_Console;
+/* The cycles left to the next tick, as of when the SysTick was last set */
+static ptr_t RME_CMX_Tick_Left;
+/* The period that the SysTick was last set to, in cycles */
+static ptr_t RME_CMX_Tick_Load;
 /*****************************************************************************/
 /* End Private Global Variables **********************************************/
 
 /* Private C Function Prototypes *********************************************/ 
 /*****************************************************************************/
 static ptr_t ___RME_Pgtbl_MPU_Gen_RASR(ptr_t* Table, ptr_t Flags, ptr_t Entry_Size_Order);
+static ptr_t ___RME_Pgtbl_MPU_Gen_Merge(ptr_t Low_RASR, ptr_t High_RASR, ptr_t Size_Order);
+static struct __RME_CMX_Pgtbl_Meta* ___RME_Pgtbl_MPU_Buddy(struct __RME_CMX_Pgtbl_Meta* Meta);
+static void ___RME_Pgtbl_MPU_Refill(struct __RME_CMX_MPU_Data* Top_MPU, 
+                                    ptr_t Start_Addr, ptr_t Size_Order, ptr_t MPU_RASR);
 static ptr_t ___RME_Pgtbl_MPU_Clear(struct __RME_CMX_MPU_Data* Top_MPU, 
                                     ptr_t Start_Addr, ptr_t Size_Order);
+static ptr_t ___RME_Pgtbl_MPU_Victim(struct __RME_CMX_MPU_Data* Top_MPU, ptr_t Static_Flag);
 static ptr_t ___RME_Pgtbl_MPU_Add(struct __RME_CMX_MPU_Data* Top_MPU, 
                                   ptr_t Start_Addr, ptr_t Size_Order,
                                   ptr_t MPU_RASR, ptr_t Static_Flag);
 static ptr_t ___RME_Pgtbl_MPU_Update(struct __RME_CMX_Pgtbl_Meta* Meta, ptr_t Op_Flag);
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+static ptr_t ___RME_Pgtbl_MPU_V8_Check(ptr_t MPU_RASR);
+static void ___RME_Pgtbl_MPU_V8_Sync(struct __RME_CMX_MPU_Data* Top_MPU, ptr_t Slot);
+#endif
 /*****************************************************************************/
 #define __EXTERN__
 /* End Private C Function Prototypes *****************************************/
@@ -431,7 +534,10 @@ static ptr_t ___RME_Pgtbl_MPU_Update(struct __RME_CMX_Pgtbl_Meta* Meta, ptr_t Op
 #endif
 
 /*****************************************************************************/
-
+/* The MPU metadata of the current address space, used by the MemManage handler */
+__EXTERN__ RME_HOT_DATA struct __RME_CMX_MPU_Data* RME_CMX_Cur_MPU;
+/* Where the handlers save the registers to and restore them from, see RME_CMX_REG_LIVE */
+__EXTERN__ RME_HOT_DATA struct RME_Reg_Struct* RME_CMX_Cur_Reg;
 /*****************************************************************************/
 
 /* End Public Global Variables ***********************************************/
@@ -439,11 +545,12 @@ static ptr_t ___RME_Pgtbl_MPU_Update(struct __RME_CMX_Pgtbl_Meta* Meta, ptr_t Op
 /* Public C Function Prototypes **********************************************/
 /*****************************************************************************/
 /* Interrupts */
-EXTERN void __RME_Disable_Int(void);
-EXTERN void __RME_Enable_Int(void);
+__EXTERN__ RME_HOT_TEXT void __RME_Disable_Int(void);
+__EXTERN__ RME_HOT_TEXT void __RME_Enable_Int(void);
+__EXTERN__ RME_HOT_TEXT void __RME_Resched_Pend(void);
 EXTERN void __RME_CMX_WFI(void);
 /* Atomics */
-__EXTERN__ ptr_t __RME_Comp_Swap(ptr_t* Ptr, ptr_t* Old, ptr_t New);
+__EXTERN__ ptr_t __RME_Comp_Swap(volatile ptr_t* Ptr, ptr_t* Old, ptr_t New);
 __EXTERN__ ptr_t __RME_Fetch_Add(ptr_t* Ptr, cnt_t Addend);
 __EXTERN__ ptr_t __RME_Fetch_And(ptr_t* Ptr, ptr_t Operand);
 /* MSB counting */
@@ -462,30 +569,36 @@ __EXTERN__ void __RME_Reboot(void);
 __EXTERN__ void __RME_Shutdown(void);
 /* Syscall & invocation */
 __EXTERN__ ptr_t __RME_CPUID_Get(void);
-__EXTERN__ ptr_t __RME_Get_Syscall_Param(struct RME_Reg_Struct* Reg, ptr_t* Svc,
-                                         ptr_t* Capid, ptr_t* Param);
-__EXTERN__ ptr_t __RME_Set_Syscall_Retval(struct RME_Reg_Struct* Reg, ret_t Retval);
+__EXTERN__ RME_HOT_TEXT ptr_t __RME_Cycle_Get(void);
+__EXTERN__ RME_HOT_TEXT void __RME_Budget_Set(ptr_t Budget);
+__EXTERN__ RME_HOT_TEXT ptr_t __RME_Get_Syscall_Param(struct RME_Reg_Struct* Reg, ptr_t* Svc,
+                                                      ptr_t* Capid, ptr_t* Param);
+__EXTERN__ ptr_t __RME_Get_Syscall_Ext_Param(struct RME_Reg_Struct* Reg, ptr_t* Ext_Param);
+__EXTERN__ RME_HOT_TEXT ptr_t __RME_Set_Syscall_Retval(struct RME_Reg_Struct* Reg, ret_t Retval);
 __EXTERN__ ptr_t __RME_Get_Inv_Retval(struct RME_Reg_Struct* Reg);
 __EXTERN__ ptr_t __RME_Set_Inv_Retval(struct RME_Reg_Struct* Reg, ret_t Retval);
 /* Thread register sets */
 __EXTERN__ ptr_t __RME_Thd_Reg_Init(ptr_t Entry, ptr_t Stack, struct RME_Reg_Struct* Reg);
-__EXTERN__ ptr_t __RME_Thd_Reg_Copy(struct RME_Reg_Struct* Dst, struct RME_Reg_Struct* Src);
+__EXTERN__ RME_HOT_TEXT ptr_t __RME_Thd_Reg_Copy(struct RME_Reg_Struct* Dst, struct RME_Reg_Struct* Src);
+__EXTERN__ RME_HOT_TEXT ptr_t __RME_Thd_Reg_Swt(struct RME_Reg_Struct* Reg, struct RME_Reg_Struct* Next_Reg);
 __EXTERN__ ptr_t __RME_Thd_Cop_Init(ptr_t Entry, ptr_t Stack, struct RME_Cop_Struct* Cop_Reg);
-__EXTERN__ ptr_t __RME_Thd_Cop_Save(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg);
-__EXTERN__ ptr_t __RME_Thd_Cop_Restore(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg);
+__EXTERN__ RME_HOT_TEXT ptr_t __RME_Thd_Cop_Save(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg);
+__EXTERN__ RME_HOT_TEXT ptr_t __RME_Thd_Cop_Restore(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg);
 /* Invocation register sets */
 __EXTERN__ ptr_t __RME_Inv_Reg_Init(ptr_t Param, struct RME_Reg_Struct* Reg);
 __EXTERN__ ptr_t __RME_Inv_Cop_Init(ptr_t Param, struct RME_Cop_Struct* Cop_Reg);
 /* Kernel function handler */
-__EXTERN__ ptr_t __RME_Kern_Func_Handler(struct RME_Reg_Struct* Reg, ptr_t Func_ID, 
-                                         ptr_t Param1, ptr_t Param2);
+__EXTERN__ ptr_t __RME_Kern_Func_Handler(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                                         ptr_t Func_ID, ptr_t Param1, ptr_t Param2);
 /* Fault handler */
 __EXTERN__ void __RME_CMX_Fault_Handler(struct RME_Reg_Struct* Reg);
 /* Generic interrupt handler */
-__EXTERN__ void __RME_CMX_Generic_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num);
+__EXTERN__ RME_HOT_TEXT void __RME_CMX_Generic_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num);
+/* SysTick handler */
+__EXTERN__ RME_HOT_TEXT void __RME_CMX_Tick_Handler(struct RME_Reg_Struct* Reg);
 /* Page table operations */
 EXTERN void ___RME_CMX_MPU_Set(ptr_t MPU_Meta);
-__EXTERN__ void __RME_Pgtbl_Set(ptr_t Pgtbl);
+__EXTERN__ RME_HOT_TEXT void __RME_Pgtbl_Set(ptr_t Pgtbl);
 __EXTERN__ ptr_t __RME_Pgtbl_Kmem_Init(void);
 __EXTERN__ ptr_t __RME_Pgtbl_Check(ptr_t Start_Addr, ptr_t Top_Flag, ptr_t Size_Order, ptr_t Num_Order);
 __EXTERN__ ptr_t __RME_Pgtbl_Init(struct RME_Cap_Pgtbl* Pgtbl_Op);
@@ -15,6 +15,10 @@ Description: The configuration file for X64 supercomputer profile.
 #define RME_HYP_VA_START             0x20020000
 /* The size of the hypervisor reserved virtual memory */
 #define RME_HYP_SIZE                 0x60000
+/* The demand paging range - not-present page faults here are tagged for the pager */
+#define RME_X64_PAGER_VA_START       0x0000100000000000ULL
+/* The size of the demand paging range */
+#define RME_X64_PAGER_SIZE           0x0000010000000000ULL
 /* The granularity of kernel memory allocation, in bytes */
 #define RME_KMEM_SLOT_ORDER          4
 /* The maximum number of preemption priority levels in the system.
@@ -37,6 +41,12 @@ Description: The configuration file for X64 supercomputer profile.
 #define RME_CMX_NVIC_GROUPING        RME_CMX_NVIC_GROUPING_P2S6
 /* What is the Systick value? - 10ms per tick*/
 #define RME_CMX_SYSTICK_VAL          2160000
+/* What is the widest vector extension that the threads can use? */
+#define RME_X64_AVX                  RME_X64_AVX_512
+/* What is the kernel tick frequency? - 10ms per tick */
+#define RME_X64_TIMER_FREQ           100
+/* Where is the IOAPIC? - this is the standard address */
+#define RME_X64_IOAPIC_ADDR          0xFEC00000
 
 /* Kernel functions standard to Cortex-M, interrupt management and power */
 #define RME_CMX_KERN_INT(X)          (X)
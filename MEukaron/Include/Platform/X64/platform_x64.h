@@ -94,6 +94,9 @@ typedef s64 ret_t;
 #define EXTERN                  extern
 /* Compiler "inline" keyword setting */
 #define INLINE                  inline
+/* The sections of the hot kernel paths and data - no special memory on x64 */
+#define RME_HOT_TEXT
+#define RME_HOT_DATA
 /* Number of CPUs in the system - max. 16384 ones are supported */
 #define RME_CPU_NUM             16384
 /* The order of bits in one CPU machine word */
@@ -102,8 +105,14 @@ typedef s64 ret_t;
 #define RME_VA_EQU_PA           (RME_FALSE)
 /* Quiescence timeslice value - always 10 slices, roughly equivalent to 100ms */
 #define RME_QUIE_TIME           10
-/* Normal page directory size calculation macro */
-#define RME_PGTBL_SIZE_NOM(NUM_ORDER)   ((1<<(NUM_ORDER))*sizeof(ptr_t))
+/* Interrupts switch to the threads they wake up right away */
+#define RME_RESCHED_DEFER       (RME_FALSE)
+/* Thread budgets are counted in processor cycles with the TSC */
+#define RME_CYC_BUDGET          (RME_TRUE)
+/* The kernel console buffer is 2^12=4kB per CPU */
+#define RME_CONSOLE_ORDER       12
+/* Normal page directory size calculation macro - the table, then the metadata */
+#define RME_PGTBL_SIZE_NOM(NUM_ORDER)   ((1<<(NUM_ORDER))*sizeof(ptr_t)+sizeof(struct __RME_X64_Pgtbl_Meta))
 /* Top-level page directory size calculation macro */
 #define RME_PGTBL_SIZE_TOP(NUM_ORDER)   RME_PGTBL_SIZE_NOM(NUM_ORDER)
 /* Kernel stack size and address */
@@ -139,26 +148,32 @@ typedef s64 ret_t;
 /* SRAM base */
 #define RME_X64_SRAM_BASE        0x20000000
 /* For x64:
- * The layout of the page entry is:
- * [31:7] Paddr - The physical address to map this page to, or the physical
- *                address of the next layer of page table. This address is
- *                always aligned to 128 bytes. 
- * [6] Static - Is this page a static page?
- * [5] Bufferable - Is this page write-bufferable?
- * [4] Cacheable - Is this page cacheable?
- * [3] Execute - Do we allow execution(instruction fetch) on this page?
- * [2] Readonly - Is this page user read-only?
- * [1] Terminal - Is this page a terminal page, or points to another page table?
- * [0] Present - Is this entry present?
- *
- * The layout of a directory entry is:
- * [31:2] Paddr - The in-kernel physical address of the lower page directory.
- * [1] Terminal - Is this page a terminal page, or points to another page table?
- * [0] Present - Is this entry present?
- */
-/* Get the actual table positions */
-#define RME_X64_PGTBL_TBL_NOM(X)        ((X)+(sizeof(struct __RME_X64_Pgtbl_Meta)))
-#define RME_X64_PGTBL_TBL_TOP(X)        RME_X64_PGTBL_TBL_NOM(X)
+ * The page tables are the 4-level hardware ones, and each of them have 512 entries.
+ * The top-level one covers 2^39*512 bytes, and the others cover 2^30*512, 2^21*512 or
+ * 2^12*512 bytes. The 4kB table comes first so that the hardware can use it, and the
+ * metadata follows it. The PS bit tells if an entry of the middle two levels maps a
+ * page or points to the next level; all present entries of the last level map pages.
+ * The top-level tables share the kernel entries, which are the low 512GB that maps
+ * the kernel memory with VA=PA, and the upper half. The user can only change the
+ * entries in between */
+#define RME_X64_PGTBL_SIZE_512G         39
+#define RME_X64_PGTBL_USER_START        1
+#define RME_X64_PGTBL_USER_END          256
+/* The boot top-level table that we take the kernel entries from */
+#define RME_X64_PGTBL_BOOT              0x1000
+/* Get the metadata of a table */
+#define RME_X64_PGTBL_META(X)           ((struct __RME_X64_Pgtbl_Meta*)(((ptr_t)(X))+ \
+                                                                        RME_POW2(RME_PGTBL_NUM_512)*sizeof(ptr_t)))
+/* The kernel memory is mapped with VA=PA, so the tables are at their physical addresses */
+#define RME_X64_VA2PA(X)                ((ptr_t)(X))
+#define RME_X64_PA2VA(X)                ((ptr_t*)(X))
+/* Page directory page/directory count */
+#define RME_X64_PGTBL_PAGENUM(X)        ((X)&0x0000FFFF)
+#define RME_X64_PGTBL_DIRNUM(X)         ((X)>>16)
+#define RME_X64_PGTBL_INC_PAGENUM(X)    ((X)+=0x00000001)
+#define RME_X64_PGTBL_DEC_PAGENUM(X)    ((X)-=0x00000001)
+#define RME_X64_PGTBL_INC_DIRNUM(X)     ((X)+=0x00010000)
+#define RME_X64_PGTBL_DEC_DIRNUM(X)     ((X)-=0x00010000)
 
 /* Page entry bit definitions */
 /* No execution */
@@ -185,14 +200,195 @@ typedef s64 ret_t;
 #define RME_X64_MMU_G                   (((ptr_t)1)<<8)
 /* The page-attribute table bit for other page sizes */
 #define RME_X64_MMU_PDE_PAT             (((ptr_t)1)<<12)
+/* CPUID bit - 1GB page support in leaf 80000001H EDX */
+#define RME_X64_CPUID_E1_PAGE1GB        (1<<26)
 /* The generic address mask */
-#define RME_X64_MMU_ADDR(X)             ((X)&0x8FFFFFFFFF000)
+#define RME_X64_MMU_ADDR(X)             ((X)&0x000FFFFFFFFFF000ULL)
+/* The flags of a directory entry - the pages below it decide the access */
+#define RME_X64_MMU_PDE                 (RME_X64_MMU_P|RME_X64_MMU_RW|RME_X64_MMU_US)
 
 /* MMU definitions */
 /* Write info to MMU */
 #define RME_X64_CR3_PCD                 (1<<4)
 #define RME_X64_CR3_PWT                 (1<<3)
 
+/* Extended processor state definitions */
+/* Vector extension types - the largest one in use decides the XSAVE area size */
+#define RME_X64_AVX_NONE                0
+#define RME_X64_AVX_256                 1
+#define RME_X64_AVX_512                 2
+/* CR4 bits - FXSAVE/SSE enable, SSE exception enable, XSAVE enable */
+#define RME_X64_CR4_OSFXSR              (1<<9)
+#define RME_X64_CR4_OSXMMEXCPT          (1<<10)
+#define RME_X64_CR4_OSXSAVE             (1<<18)
+/* CPUID bits - XSAVE support in leaf 1 ECX, and XSAVEOPT/XSAVEC in leaf 0DH subleaf 1 EAX */
+#define RME_X64_CPUID_1_XSAVE           (1<<26)
+#define RME_X64_CPUID_D1_XSAVEOPT       (1<<0)
+#define RME_X64_CPUID_D1_XSAVEC         (1<<1)
+/* XSAVE state components */
+#define RME_X64_XSTATE_X87              (((ptr_t)1)<<0)
+#define RME_X64_XSTATE_SSE              (((ptr_t)1)<<1)
+#define RME_X64_XSTATE_AVX              (((ptr_t)1)<<2)
+#define RME_X64_XSTATE_OPMASK           (((ptr_t)1)<<5)
+#define RME_X64_XSTATE_ZMM_HI256        (((ptr_t)1)<<6)
+#define RME_X64_XSTATE_HI16_ZMM         (((ptr_t)1)<<7)
+/* The state components that the kernel can manage, and the standard format XSAVE
+ * area size for all of them. The actual size is read from CPUID on boot */
+#if(RME_X64_AVX==RME_X64_AVX_512)
+#define RME_X64_XSTATE_MASK             (RME_X64_XSTATE_X87|RME_X64_XSTATE_SSE|RME_X64_XSTATE_AVX| \
+                                         RME_X64_XSTATE_OPMASK|RME_X64_XSTATE_ZMM_HI256|RME_X64_XSTATE_HI16_ZMM)
+#define RME_X64_XSTATE_SIZE             2688
+#elif(RME_X64_AVX==RME_X64_AVX_256)
+#define RME_X64_XSTATE_MASK             (RME_X64_XSTATE_X87|RME_X64_XSTATE_SSE|RME_X64_XSTATE_AVX)
+#define RME_X64_XSTATE_SIZE             832
+#else
+#define RME_X64_XSTATE_MASK             (RME_X64_XSTATE_X87|RME_X64_XSTATE_SSE)
+#define RME_X64_XSTATE_SIZE             576
+#endif
+/* The legacy region and the header of the XSAVE area, and the MXCSR offset in it */
+#define RME_X64_XSTATE_LEGACY_SIZE      576
+#define RME_X64_XSTATE_MXCSR            24
+#define RME_X64_MXCSR_DEFAULT           0x1F80
+/* Which instruction do we use to save the state? */
+#define RME_X64_XSAVE_STD               0
+#define RME_X64_XSAVE_OPT               1
+#define RME_X64_XSAVE_CMP               2
+/* Get the aligned XSAVE area from the coprocessor register set */
+#define RME_X64_XSTATE_AREA(COP)        ((((ptr_t)((COP)->Area))+63)&(~((ptr_t)63)))
+
+/* Local APIC definitions */
+/* The APIC base MSR, and the enable and x2APIC mode bits in it */
+#define RME_X64_MSR_APIC_BASE           0x1B
+#define RME_X64_APIC_BASE_EXTD          (1<<10)
+#define RME_X64_APIC_BASE_EN            (1<<11)
+#define RME_X64_APIC_BASE_ADDR(X)       ((X)&0xFFFFFFFFFF000ULL)
+/* The TSC-deadline MSR */
+#define RME_X64_MSR_TSC_DEADLINE        0x6E0
+/* x2APIC registers are MSRs, and their numbers are the xAPIC offsets divided by 16 */
+#define RME_X64_MSR_X2APIC(REG)         (0x800+((REG)>>4))
+/* CPUID bits - x2APIC and TSC-deadline support in leaf 1 ECX */
+#define RME_X64_CPUID_1_X2APIC          (1<<21)
+#define RME_X64_CPUID_1_TSC_DEADLINE    (1<<24)
+/* The modes that we can run the local APIC and its timer in */
+#define RME_X64_LAPIC_XAPIC             0
+#define RME_X64_LAPIC_X2APIC            1
+#define RME_X64_TIMER_PERIODIC          0
+#define RME_X64_TIMER_DEADLINE          1
+/* Local APIC register offsets in the xAPIC MMIO page */
+#define RME_X64_LAPIC_ID                0x20
+#define RME_X64_LAPIC_TPR               0x80
+#define RME_X64_LAPIC_EOI               0xB0
+#define RME_X64_LAPIC_SVR               0xF0
+#define RME_X64_LAPIC_ESR               0x280
+#define RME_X64_LAPIC_ICRLO             0x300
+#define RME_X64_LAPIC_ICRHI             0x310
+#define RME_X64_LAPIC_TIMER             0x320
+#define RME_X64_LAPIC_LINT0             0x350
+#define RME_X64_LAPIC_LINT1             0x360
+#define RME_X64_LAPIC_ERROR             0x370
+#define RME_X64_LAPIC_TICR              0x380
+#define RME_X64_LAPIC_TCCR              0x390
+#define RME_X64_LAPIC_TDCR              0x3E0
+/* Local APIC register bits */
+#define RME_X64_LAPIC_SVR_ENABLE        (1<<8)
+#define RME_X64_LAPIC_LVT_MASKED        (1<<16)
+#define RME_X64_LAPIC_TIMER_PERIODIC    (1<<17)
+#define RME_X64_LAPIC_TIMER_DEADLINE    (2<<17)
+#define RME_X64_LAPIC_TDCR_DIV1         0x0B
+#define RME_X64_LAPIC_ICR_DELIVS        (1<<12)
+/* Interrupt vectors used by the kernel */
+#define RME_X64_TIMER_VECT              0x20
+#define RME_X64_IPI_VECT                0x21
+#define RME_X64_ERROR_VECT              0x22
+#define RME_X64_SPUR_VECT               0xFF
+/* The page fault exception vector */
+#define RME_X64_FAULT_PF                14
+/* Page fault error code bits - present, write, user, reserved bit set, instruction fetch */
+#define RME_X64_PF_P                    (1<<0)
+#define RME_X64_PF_W                    (1<<1)
+#define RME_X64_PF_U                    (1<<2)
+#define RME_X64_PF_RSVD                 (1<<3)
+#define RME_X64_PF_I                    (1<<4)
+/* The fault reason delivered to the fault handler. The vector is in [39:32], the
+ * error code is in [31:0], and the top bit tells if this is a fault that the pager
+ * should resolve. The access type of a pager fault can be read from the W and I bits */
+#define RME_X64_FAULT_REASON(VECT,ERR)  ((((ptr_t)(VECT))<<32)|((ERR)&0xFFFFFFFFULL))
+#define RME_X64_FAULT_VECT(REASON)      (((REASON)>>32)&0xFF)
+#define RME_X64_FAULT_ERR(REASON)       ((REASON)&0xFFFFFFFFULL)
+#define RME_X64_FAULT_PAGER             (((ptr_t)1)<<63)
+/* Device interrupt vectors - these can be routed and bound to endpoints */
+#define RME_X64_INT_NUM                 256
+#define RME_X64_DEV_VECT_START          0x30
+#define RME_X64_DEV_VECT_END            0xEF
+/* IOAPIC register select and window, and the registers */
+#define RME_X64_IOAPIC_REGSEL           0x00
+#define RME_X64_IOAPIC_WIN              0x10
+#define RME_X64_IOAPIC_VER              0x01
+#define RME_X64_IOAPIC_REDIR_LO(PIN)    (0x10+((PIN)<<1))
+#define RME_X64_IOAPIC_REDIR_HI(PIN)    (0x11+((PIN)<<1))
+/* Redirection entry flags that the user can choose */
+#define RME_X64_IOAPIC_ACTIVE_LOW       (1<<13)
+#define RME_X64_IOAPIC_LEVEL            (1<<15)
+#define RME_X64_IOAPIC_MASKED           (1<<16)
+#define RME_X64_IOAPIC_FLAGS            (RME_X64_IOAPIC_ACTIVE_LOW|RME_X64_IOAPIC_LEVEL|RME_X64_IOAPIC_MASKED)
+/* No pin is associated with this vector */
+#define RME_X64_NO_PIN                  ((ptr_t)(-1))
+/* PCI configuration space ports */
+#define RME_X64_PCI_CONF_ADDR           0xCF8
+#define RME_X64_PCI_CONF_DATA           0xCFC
+#define RME_X64_PCI_CONF(BDF,OFF)       (0x80000000|((BDF)<<8)|((OFF)&0xFC))
+/* MSI capability definitions */
+#define RME_X64_PCI_CAP_MSI             0x05
+#define RME_X64_MSI_CTRL_EN             (1<<0)
+#define RME_X64_MSI_CTRL_MME            (7<<4)
+#define RME_X64_MSI_CTRL_64             (1<<7)
+/* The MSI address that targets a local APIC ID, in physical destination mode */
+#define RME_X64_MSI_ADDR(APIC_ID)       (0xFEE00000|((APIC_ID)<<12))
+/* ACPI definitions */
+/* The signatures of the RDSP and the table that we use - "APIC" */
+#define RME_X64_ACPI_SIG_RDSP           "RSD PTR "
+#define RME_X64_ACPI_SIG_MADT           0x43495041
+/* Where to look for the RDSP - the EBDA segment pointer, and the BIOS ROM area */
+#define RME_X64_ACPI_EBDA_PTR           0x40E
+#define RME_X64_ACPI_EBDA_LEN           0x400
+#define RME_X64_ACPI_ROM_ADDR           0xE0000
+#define RME_X64_ACPI_ROM_LEN            0x20000
+/* The tables must be in the memory that the boot page table maps with VA=PA */
+#define RME_X64_ACPI_MAPPED(X)          (((X)<0x40000000)||((X)>=0xC0000000))
+/* MADT entry types and flags */
+#define RME_X64_MADT_LAPIC              0
+#define RME_X64_MADT_LAPIC_EN           (1<<0)
+
+/* The legacy 8259 PICs, which we mask off */
+#define RME_X64_PIC1_DATA               0x21
+#define RME_X64_PIC2_DATA               0xA1
+/* PIT channel 2, which is used to calibrate the timers. The gate of it is in port 0x61 */
+#define RME_X64_PIT_FREQ                1193182
+#define RME_X64_PIT_CH2                 0x42
+#define RME_X64_PIT_CMD                 0x43
+#define RME_X64_PIT_GATE                0x61
+#define RME_X64_PIT_GATE_ON             (1<<0)
+#define RME_X64_PIT_SPEAKER             (1<<1)
+#define RME_X64_PIT_OUT                 (1<<5)
+/* Channel 2, low byte then high byte, mode 0 (interrupt on terminal count) */
+#define RME_X64_PIT_CH2_MODE0           0xB0
+/* How long is the calibration, in milliseconds */
+#define RME_X64_PIT_CAL_MS              10
+
+/* Kernel functions standard to X64 */
+/* Set the state components that a thread may use. Param1 is the thread, Param2 is the mask */
+#define RME_X64_KERN_XSTATE             0
+/* Bind a device vector to an endpoint. Param1 is the vector, Param2 is the endpoint */
+#define RME_X64_KERN_INT_BIND           1
+/* Unbind a device vector from its endpoint. Param1 is the vector */
+#define RME_X64_KERN_INT_UNBIND         2
+/* Program an IOAPIC pin. Param1 is the pin(D1) and the vector(D0), Param2 is the CPU(D1)
+ * and the flags(D0) */
+#define RME_X64_KERN_IOAPIC             3
+/* Program the MSI capability of a PCI function. Param1 is the bus/device/function(D1) and
+ * the capability offset(D0), Param2 is the CPU(D1) and the vector(D0) */
+#define RME_X64_KERN_MSI                4
+
 /* Cortex-M (ARMv8) EXC_RETURN values */
 #define RME_X64_EXC_RET_BASE            (0xFFFFFF80)
 /* Whether we are returning to secure stack. 1 means yes, 0 means no */
@@ -291,6 +487,65 @@ typedef s64 ret_t;
 
 /* Hardware definitions */
 #define RME_X64_COM1                    0x3F8
+/* 16550 UART registers and bits */
+#define RME_X64_UART_THR                0
+#define RME_X64_UART_DLL                0
+#define RME_X64_UART_IER                1
+#define RME_X64_UART_DLH                1
+#define RME_X64_UART_IIR                2
+#define RME_X64_UART_FCR                2
+#define RME_X64_UART_LCR                3
+#define RME_X64_UART_MCR                4
+#define RME_X64_UART_LSR                5
+#define RME_X64_UART_IER_THRE           (1<<1)
+/* Enable the FIFOs and clear them, 14-byte receive trigger */
+#define RME_X64_UART_FCR_INIT           0xC7
+#define RME_X64_UART_LCR_DLAB           0x80
+#define RME_X64_UART_LCR_8N1            0x03
+/* DTR, RTS, and OUT2 which lets the interrupt out */
+#define RME_X64_UART_MCR_INIT           0x0B
+#define RME_X64_UART_LSR_THRE           (1<<5)
+#define RME_X64_UART_FIFO_SIZE          16
+/* 115200 baud, which is the divisor 1 */
+#define RME_X64_UART_DIVISOR            1
+/* COM1 is ISA IRQ 4, and we give it a kernel vector */
+#define RME_X64_UART_PIN                4
+#define RME_X64_UART_VECT               0x23
+
+/* Segment selectors */
+#define RME_X64_SEG_KERNEL_CODE         0x08
+#define RME_X64_SEG_KERNEL_DATA         0x10
+/* SYSRET loads SS from this plus 8, and CS from this plus 16 */
+#define RME_X64_SEG_USER_BASE           0x1B
+#define RME_X64_SEG_USER_DATA           0x23
+#define RME_X64_SEG_USER_CODE           0x2B
+#define RME_X64_SEG_TSS                 0x30
+
+/* Interrupt descriptor table */
+/* Each interrupt entry stub is 2^4=16 bytes */
+#define RME_X64_INT_STUB_ORDER          4
+/* 64-bit interrupt gate, present, DPL=0. Interrupts are disabled on entry, and the
+ * user cannot use INT to get in */
+#define RME_X64_IDT_INT_GATE            0x8E
+#define RME_X64_IDT_LO(ADDR)            (((ADDR)&0xFFFFULL)|(((ptr_t)RME_X64_SEG_KERNEL_CODE)<<16)| \
+                                         (((ptr_t)RME_X64_IDT_INT_GATE)<<40)|(((ADDR)&0xFFFF0000ULL)<<32))
+#define RME_X64_IDT_HI(ADDR)            ((ADDR)>>32)
+/* 64-bit available TSS descriptor, present, DPL=0 */
+#define RME_X64_GDT_TSS_TYPE            0x89
+#define RME_X64_GDT_TSS_LO(BASE,LIMIT)  (((LIMIT)&0xFFFFULL)|(((BASE)&0xFFFFFFULL)<<16)| \
+                                         (((ptr_t)RME_X64_GDT_TSS_TYPE)<<40)|((((LIMIT)>>16)&0xFULL)<<48)| \
+                                         ((((BASE)>>24)&0xFFULL)<<56))
+#define RME_X64_GDT_TSS_HI(BASE)        ((BASE)>>32)
+
+/* Model specific registers */
+#define RME_X64_MSR_EFER                0xC0000080
+#define RME_X64_MSR_STAR                0xC0000081
+#define RME_X64_MSR_LSTAR               0xC0000082
+#define RME_X64_MSR_FMASK               0xC0000084
+#define RME_X64_MSR_GS_BASE             0xC0000101
+#define RME_X64_MSR_KERNEL_GS_BASE      0xC0000102
+/* The RFLAGS bits that SYSCALL clears - TF, IF, DF, IOPL, NT and AC */
+#define RME_X64_SYSCALL_FMASK           0x00047700
 /*****************************************************************************/
 /* __PLATFORM_X64_H_DEFS__ */
 #endif
@@ -310,7 +565,11 @@ typedef s64 ret_t;
 /*****************************************************************************/
 /* The 6 registers that are used to pass arguments are RDI, RSI, RDX, RCX, R8, R9.
  * Note that this is different from Micro$oft: M$ use RCX, RDX, R8, R9. The return
- * value is always located at RAX. */
+ * value is always located at RAX. The last 5 words are laid out just like the
+ * hardware interrupt frame, so that the assembly entries can build this structure
+ * on the kernel stack and return with IRETQ directly. The vector number and the
+ * error code are pushed by the interrupt entry stubs, and are 0 for the system
+ * calls. The offsets are also used in the assembly file, so keep them in sync. */
 struct RME_Reg_Struct
 {
     ptr_t RAX;
@@ -320,7 +579,6 @@ struct RME_Reg_Struct
     ptr_t RSI;
     ptr_t RDI;
     ptr_t RBP;
-    ptr_t RSP;
     ptr_t R8;
     ptr_t R9;
     ptr_t R10;
@@ -329,92 +587,56 @@ struct RME_Reg_Struct
     ptr_t R13;
     ptr_t R14;
     ptr_t R15;
+    ptr_t INT_NUM;
+    ptr_t ERROR_CODE;
+    ptr_t RIP;
+    ptr_t CS;
     ptr_t RFLAGS;
+    ptr_t RSP;
+    ptr_t SS;
 };
 
-/* The coprocessor register set structure. MMX and SSE */
+/* The coprocessor register set structure. This is an XSAVE area, and the state
+ * components in it are the ones that this thread is allowed to use. XSAVE needs
+ * 64-byte alignment, which the kernel memory slots do not guarantee, so we leave
+ * some room and align it when using it */
 struct RME_Cop_Struct
 {
-	/* MMX registers first */
-	ptr_t FPR_MMX0[2];
-	ptr_t FPR_MMX1[2];
-	ptr_t FPR_MMX2[2];
-	ptr_t FPR_MMX3[2];
-	ptr_t FPR_MMX4[2];
-	ptr_t FPR_MMX5[2];
-	ptr_t FPR_MMX6[2];
-	ptr_t FPR_MMX7[2];
-	/* SSE registers follow */
-#if(RME_X64_AVX==RME_FALSE)
-	ptr_t XMM0[2];
-	ptr_t XMM1[2];
-	ptr_t XMM2[2];
-	ptr_t XMM3[2];
-	ptr_t XMM4[2];
-	ptr_t XMM5[2];
-	ptr_t XMM6[2];
-	ptr_t XMM7[2];
-	ptr_t XMM8[2];
-	ptr_t XMM9[2];
-	ptr_t XMM10[2];
-	ptr_t XMM11[2];
-	ptr_t XMM12[2];
-	ptr_t XMM13[2];
-	ptr_t XMM14[2];
-	ptr_t XMM15[2];
-#elif(RME_X64_AVX==RME_AVX)
-	ptr_t XYMM0[4];
-	ptr_t XYMM1[4];
-	ptr_t XYMM2[4];
-	ptr_t XYMM3[4];
-	ptr_t XYMM4[4];
-	ptr_t XYMM5[4];
-	ptr_t XYMM6[4];
-	ptr_t XYMM7[4];
-	ptr_t XYMM8[4];
-	ptr_t XYMM9[4];
-	ptr_t XYMM10[4];
-	ptr_t XYMM11[4];
-	ptr_t XYMM12[4];
-	ptr_t XYMM13[4];
-	ptr_t XYMM14[4];
-	ptr_t XYMM15[4];
-#elif(RME_X64_AVX==RME_AVX512)
-	ptr_t XYZMM0[8];
-	ptr_t XYZMM1[8];
-	ptr_t XYZMM2[8];
-	ptr_t XYZMM3[8];
-	ptr_t XYZMM4[8];
-	ptr_t XYZMM5[8];
-	ptr_t XYZMM6[8];
-	ptr_t XYZMM7[8];
-	ptr_t XYZMM8[8];
-	ptr_t XYZMM9[8];
-	ptr_t XYZMM10[8];
-	ptr_t XYZMM11[8];
-	ptr_t XYZMM12[8];
-	ptr_t XYZMM13[8];
-	ptr_t XYZMM14[8];
-	ptr_t XYZMM15[8];
-	ptr_t XYZMM16[8];
-	ptr_t XYZMM17[8];
-	ptr_t XYZMM18[8];
-	ptr_t XYZMM19[8];
-	ptr_t XYZMM20[8];
-	ptr_t XYZMM21[8];
-	ptr_t XYZMM22[8];
-	ptr_t XYZMM23[8];
-	ptr_t XYZMM24[8];
-	ptr_t XYZMM25[8];
-	ptr_t XYZMM26[8];
-	ptr_t XYZMM27[8];
-	ptr_t XYZMM28[8];
-	ptr_t XYZMM29[8];
-	ptr_t XYZMM30[8];
-	ptr_t XYZMM31[8];
-#endif
+    /* The state components that this thread may use - this is loaded into XCR0 */
+    ptr_t Mask;
+    /* The XSAVE area */
+    ptr_t Area[(RME_X64_XSTATE_SIZE+64)/sizeof(ptr_t)];
 };
 
+/* The page table metadata, which is after the table */
+struct __RME_X64_Pgtbl_Meta
+{
+    /* The start address of the mapping, and the top-level flag */
+    ptr_t Start_Addr;
+    /* The table that this table is mapped into, or 0 if not mapped */
+    ptr_t Toplevel;
+    /* The size order and the number order */
+    ptr_t Size_Num_Order;
+    /* The number of directories mapped in is in [31:16], and the pages in [15:0] */
+    ptr_t Dir_Page_Count;
+};
+
+/* The 64-bit task state segment. We only use it for the kernel stack that the
+ * interrupts from the user mode switch to */
+struct __RME_X64_TSS
+{
+    u32 Reserved1;
+    u64 RSP0;
+    u64 RSP1;
+    u64 RSP2;
+    u64 Reserved2;
+    u64 IST[7];
+    u64 Reserved3;
+    u16 Reserved4;
+    /* Set to the size of the TSS, so that there is no I/O permission bitmap */
+    u16 IO_Map_Base;
+} __attribute__((packed));
+
 /* Interrupt flags - this type of flags will only appear on MPU-based systems */
 struct __RME_X64_Flag_Set
 {
@@ -428,6 +650,80 @@ struct __RME_X64_Flags
     struct __RME_X64_Flag_Set Set0;
     struct __RME_X64_Flag_Set Set1;
 };
+
+/* The per-CPU kernel data. The kernel GS base points here, and the SYSCALL entry
+ * reaches it with SWAPGS. The offsets are also used in the assembly file */
+struct __RME_X64_CPU_Local
+{
+    /* The kernel stack of this CPU */
+    ptr_t Kern_Stack;
+    /* The user stack saved on the SYSCALL entry */
+    ptr_t User_Stack;
+    /* The CPUID of this CPU */
+    ptr_t CPUID;
+    /* The state components currently enabled in XCR0 */
+    ptr_t Xstate_Mask;
+    /* The local APIC ID of this CPU */
+    ptr_t APIC_ID;
+    /* The TSC value that the next timer interrupt is due */
+    ptr_t Deadline;
+    /* The TSS of this CPU */
+    struct __RME_X64_TSS TSS;
+};
+
+/* ACPI root system description pointer */
+struct __RME_X64_ACPI_RDSP
+{
+    u8 Signature[8];
+    u8 Checksum;
+    u8 OEM_ID[6];
+    u8 Revision;
+    u32 RSDT_Addr;
+    u32 Length;
+    u64 XSDT_Addr;
+    u8 Ext_Checksum;
+    u8 Reserved[3];
+} __attribute__((packed));
+
+/* ACPI system description table header */
+struct __RME_X64_ACPI_Desc_Hdr
+{
+    u8 Signature[4];
+    u32 Length;
+    u8 Revision;
+    u8 Checksum;
+    u8 OEM_ID[6];
+    u8 OEM_Table_ID[8];
+    u32 OEM_Revision;
+    u8 Creator_ID[4];
+    u32 Creator_Revision;
+} __attribute__((packed));
+
+/* ACPI root system description table */
+struct __RME_X64_ACPI_RSDT
+{
+    struct __RME_X64_ACPI_Desc_Hdr Header;
+    u32 Entry[0];
+} __attribute__((packed));
+
+/* Multiple APIC description table */
+struct __RME_X64_ACPI_MADT
+{
+    struct __RME_X64_ACPI_Desc_Hdr Header;
+    u32 LAPIC_Addr;
+    u32 Flags;
+    u8 Table[0];
+} __attribute__((packed));
+
+/* MADT local APIC entry */
+struct __RME_X64_MADT_LAPIC
+{
+    u8 Type;
+    u8 Length;
+    u8 ACPI_ID;
+    u8 APIC_ID;
+    u32 Flags;
+} __attribute__((packed));
 /*****************************************************************************/
 /* __PLATFORM_X64_H_STRUCTS__ */
 #endif
@@ -453,19 +749,45 @@ struct __RME_X64_Flags
 #ifndef __HDR_PUBLIC_MEMBERS__
 /*****************************************************************************/
 static ptr_t RME_X64_UART_Present;
+/* How many characters can go into the UART FIFO without checking it */
+static ptr_t RME_X64_UART_Room;
+/* The per-CPU kernel data */
+static struct __RME_X64_CPU_Local RME_X64_CPU_Local[RME_CPU_NUM];
+/* The state components supported by both the processor and the kernel */
+static ptr_t RME_X64_Xstate_Mask;
+/* The XSAVE area size needed by these components */
+static ptr_t RME_X64_Xstate_Size;
+/* The XSAVE instruction to use */
+static ptr_t RME_X64_Xsave_Type;
+/* Is the local APIC in xAPIC or x2APIC mode? */
+static ptr_t RME_X64_LAPIC_Mode;
+/* The address of the local APIC registers, in xAPIC mode only */
+static ptr_t RME_X64_LAPIC_Addr;
+/* Is the timer in periodic or TSC-deadline mode? */
+static ptr_t RME_X64_Timer_Mode;
+/* The TSC cycles and APIC timer counts per tick, from the calibration */
+static ptr_t RME_X64_Tick_TSC;
+static ptr_t RME_X64_Tick_APIC;
+/* The endpoints that the device vectors are bound to */
+static struct RME_Sig_Struct* RME_X64_Int_Sig[RME_X64_INT_NUM];
+/* The level-triggered IOAPIC pins that the device vectors come from */
+static ptr_t RME_X64_Int_Pin[RME_X64_INT_NUM];
+/* The number of processors found in the MADT */
+static ptr_t RME_X64_Num_CPU;
+/* The interrupt descriptor table, which all processors share */
+static ptr_t RME_X64_IDT[RME_X64_INT_NUM*2];
+/* Can we use 1GB pages? */
+static ptr_t RME_X64_Page_1G;
+/* The kernel console buffers, one for each processor found */
+static struct RME_Console* RME_X64_Console;
 /*****************************************************************************/
 /* End Private Global Variables **********************************************/
 
 /* Private C Function Prototypes *********************************************/ 
 /*****************************************************************************/
-static ptr_t ___RME_Pgtbl_MPU_Gen_RASR(ptr_t* Table, ptr_t Flags, ptr_t Entry_Size_Order);
-static ptr_t ___RME_Pgtbl_MPU_Clear(struct __RME_X64_MPU_Data* Top_MPU,
-                                    ptr_t Start_Addr, ptr_t Size_Order);
-static ptr_t ___RME_Pgtbl_MPU_Add(struct __RME_X64_MPU_Data* Top_MPU,
-                                  ptr_t Start_Addr, ptr_t Size_Order,
-                                  ptr_t MPU_RASR, ptr_t Static_Flag);
-
-static ptr_t ___RME_Pgtbl_MPU_Update(struct __RME_X64_Pgtbl_Meta* Meta, ptr_t Op_Flag);
+static ptr_t ___RME_X64_Pgtbl_Entry(ptr_t Flags);
+static ptr_t ___RME_X64_Pgtbl_Flags(ptr_t Entry);
+static ptr_t ___RME_X64_Pgtbl_Terminal(ptr_t Entry, ptr_t Size_Order);
 /*****************************************************************************/
 #define __EXTERN__
 /* End Private C Function Prototypes *****************************************/
@@ -490,16 +812,27 @@ EXTERN void __RME_Disable_Int(void);
 EXTERN void __RME_Enable_Int(void);
 EXTERN void __RME_X64_WFI(void);
 /* Atomics */
-__EXTERN__ ptr_t __RME_Comp_Swap(ptr_t* Ptr, ptr_t* Old, ptr_t New);
-__EXTERN__ ptr_t __RME_Fetch_Add(ptr_t* Ptr, cnt_t Addend);
-__EXTERN__ ptr_t __RME_Fetch_And(ptr_t* Ptr, ptr_t Operand);
+EXTERN ptr_t __RME_Comp_Swap(volatile ptr_t* Ptr, ptr_t* Old, ptr_t New);
+EXTERN ptr_t __RME_Fetch_Add(ptr_t* Ptr, cnt_t Addend);
+EXTERN ptr_t __RME_Fetch_And(ptr_t* Ptr, ptr_t Operand);
 /* MSB counting */
 EXTERN ptr_t __RME_MSB_Get(ptr_t Val);
 /* Debugging */
 __EXTERN__ ptr_t __RME_Putchar(char Char);
+__EXTERN__ void __RME_X64_UART_Init(void);
 /* Coprocessor */
-EXTERN void ___RME_X64_Thd_Cop_Save(struct RME_Cop_Struct* Cop_Reg);
-EXTERN void ___RME_X64_Thd_Cop_Restore(struct RME_Cop_Struct* Cop_Reg);
+EXTERN void ___RME_X64_XSETBV(ptr_t Mask);
+EXTERN void ___RME_X64_XSAVE(ptr_t Area, ptr_t Mask);
+EXTERN void ___RME_X64_XSAVEOPT(ptr_t Area, ptr_t Mask);
+EXTERN void ___RME_X64_XSAVEC(ptr_t Area, ptr_t Mask);
+EXTERN void ___RME_X64_XRSTOR(ptr_t Area, ptr_t Mask);
+__EXTERN__ void __RME_X64_Xstate_Init(void);
+/* ACPI */
+__EXTERN__ ptr_t __RME_X64_ACPI_Checksum(ptr_t Addr, ptr_t Len);
+__EXTERN__ struct __RME_X64_ACPI_RDSP* __RME_X64_RDSP_Scan(ptr_t Start, ptr_t Len);
+__EXTERN__ struct __RME_X64_ACPI_RDSP* __RME_X64_RDSP_Find(void);
+__EXTERN__ void __RME_X64_MADT_Parse(struct __RME_X64_ACPI_MADT* MADT);
+__EXTERN__ void __RME_X64_ACPI_Init(void);
 /* Booting */
 EXTERN void _RME_Kmain(ptr_t Stack);
 EXTERN void __RME_Enter_User_Mode(ptr_t Entry_Addr, ptr_t Stack_Addr);
@@ -509,14 +842,18 @@ __EXTERN__ void __RME_Reboot(void);
 __EXTERN__ void __RME_Shutdown(void);
 /* Syscall & invocation */
 __EXTERN__ ptr_t __RME_CPUID_Get(void);
+__EXTERN__ ptr_t __RME_Cycle_Get(void);
+__EXTERN__ void __RME_Budget_Set(ptr_t Budget);
 __EXTERN__ ptr_t __RME_Get_Syscall_Param(struct RME_Reg_Struct* Reg, ptr_t* Svc,
                                          ptr_t* Capid, ptr_t* Param);
+__EXTERN__ ptr_t __RME_Get_Syscall_Ext_Param(struct RME_Reg_Struct* Reg, ptr_t* Ext_Param);
 __EXTERN__ ptr_t __RME_Set_Syscall_Retval(struct RME_Reg_Struct* Reg, ret_t Retval);
 __EXTERN__ ptr_t __RME_Get_Inv_Retval(struct RME_Reg_Struct* Reg);
 __EXTERN__ ptr_t __RME_Set_Inv_Retval(struct RME_Reg_Struct* Reg, ret_t Retval);
 /* Thread register sets */
 __EXTERN__ ptr_t __RME_Thd_Reg_Init(ptr_t Entry, ptr_t Stack, struct RME_Reg_Struct* Reg);
 __EXTERN__ ptr_t __RME_Thd_Reg_Copy(struct RME_Reg_Struct* Dst, struct RME_Reg_Struct* Src);
+__EXTERN__ ptr_t __RME_Thd_Reg_Swt(struct RME_Reg_Struct* Reg, struct RME_Reg_Struct* Next_Reg);
 __EXTERN__ ptr_t __RME_Thd_Cop_Init(ptr_t Entry, ptr_t Stack, struct RME_Cop_Struct* Cop_Reg);
 __EXTERN__ ptr_t __RME_Thd_Cop_Save(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg);
 __EXTERN__ ptr_t __RME_Thd_Cop_Restore(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg);
@@ -524,14 +861,31 @@ __EXTERN__ ptr_t __RME_Thd_Cop_Restore(struct RME_Reg_Struct* Reg, struct RME_Co
 __EXTERN__ ptr_t __RME_Inv_Reg_Init(ptr_t Param, struct RME_Reg_Struct* Reg);
 __EXTERN__ ptr_t __RME_Inv_Cop_Init(ptr_t Param, struct RME_Cop_Struct* Cop_Reg);
 /* Kernel function handler */
-__EXTERN__ ptr_t __RME_Kern_Func_Handler(struct RME_Reg_Struct* Reg, ptr_t Func_ID, 
-                                         ptr_t Param1, ptr_t Param2);
+__EXTERN__ ptr_t __RME_Kern_Func_Handler(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                                         ptr_t Func_ID, ptr_t Param1, ptr_t Param2);
 /* Fault handler */
-__EXTERN__ void __RME_X64_Fault_Handler(struct RME_Reg_Struct* Reg);
+__EXTERN__ void __RME_X64_Fault_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num, ptr_t Err_Code);
+/* Interrupt descriptor table and task state segment */
+__EXTERN__ void __RME_X64_IDT_Init(void);
+__EXTERN__ void __RME_X64_TSS_Init(ptr_t CPUID);
+/* Local APIC and timer */
+__EXTERN__ ptr_t __RME_X64_LAPIC_Read(ptr_t Reg);
+__EXTERN__ void __RME_X64_LAPIC_Write(ptr_t Reg, ptr_t Val);
+__EXTERN__ void __RME_X64_LAPIC_Init(ptr_t CPUID);
+__EXTERN__ void __RME_X64_LAPIC_EOI(void);
+__EXTERN__ void __RME_X64_LAPIC_IPI(ptr_t CPUID, ptr_t Vect);
+__EXTERN__ void __RME_X64_Timer_Calibrate(void);
+__EXTERN__ void __RME_X64_Timer_Init(ptr_t CPUID);
+__EXTERN__ void __RME_X64_Timer_Rearm(ptr_t CPUID);
+/* IOAPIC and MSI */
+__EXTERN__ ptr_t __RME_X64_IOAPIC_Read(ptr_t Reg);
+__EXTERN__ void __RME_X64_IOAPIC_Write(ptr_t Reg, ptr_t Val);
+__EXTERN__ void __RME_X64_IOAPIC_Init(void);
+__EXTERN__ ptr_t __RME_X64_IOAPIC_Route(ptr_t Pin, ptr_t Vect, ptr_t CPUID, ptr_t Flags);
+__EXTERN__ ptr_t __RME_X64_MSI_Route(ptr_t BDF, ptr_t Cap, ptr_t CPUID, ptr_t Vect);
 /* Generic interrupt handler */
 __EXTERN__ void __RME_X64_Generic_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num);
 /* Page table operations */
-EXTERN void ___RME_X64_MPU_Set(ptr_t MPU_Meta);
 __EXTERN__ void __RME_Pgtbl_Set(ptr_t Pgtbl);
 __EXTERN__ ptr_t __RME_Pgtbl_Kmem_Init(void);
 __EXTERN__ ptr_t __RME_Pgtbl_Check(ptr_t Start_Addr, ptr_t Top_Flag, ptr_t Size_Order, ptr_t Num_Order);
@@ -547,8 +901,27 @@ __EXTERN__ ptr_t __RME_Pgtbl_Walk(struct RME_Cap_Pgtbl* Pgtbl_Op, ptr_t Vaddr, p
                                   ptr_t* Map_Vaddr, ptr_t* Paddr, ptr_t* Size_Order, ptr_t* Num_Order, ptr_t* Flags);
 
 /* X64 specific */
+/* The end of the kernel image, from the linker script */
+EXTERN u8 end[];
 EXTERN ptr_t __RME_X64_In(ptr_t Port);
 EXTERN void __RME_X64_Out(ptr_t Port, ptr_t Data);
+EXTERN ptr_t __RME_X64_In_Dword(ptr_t Port);
+EXTERN void __RME_X64_Out_Dword(ptr_t Port, ptr_t Data);
+EXTERN ptr_t __RME_X64_Read_MSR(ptr_t MSR);
+EXTERN void __RME_X64_Write_MSR(ptr_t MSR, ptr_t Value);
+EXTERN void __RME_X64_SYSCALL_Entry(void);
+EXTERN void __RME_X64_Int_Stubs(void);
+EXTERN void __RME_X64_LIDT(ptr_t Base, ptr_t Limit);
+EXTERN void __RME_X64_LTR(ptr_t Sel);
+EXTERN ptr_t __RME_X64_GDT_TSS[2];
+EXTERN void __RME_X64_CPUID_Get(ptr_t EAX, ptr_t ECX, ptr_t* Buf);
+EXTERN ptr_t __RME_X64_Read_CR4(void);
+EXTERN void __RME_X64_Write_CR4(ptr_t CR4);
+EXTERN ptr_t __RME_X64_Read_CR2(void);
+EXTERN ptr_t __RME_X64_Read_CR3(void);
+EXTERN void __RME_X64_Write_CR3(ptr_t CR3);
+EXTERN ptr_t __RME_X64_RDTSC(void);
+__EXTERN__ void __RME_X64_SYSCALL_Init(ptr_t CPUID, ptr_t Kern_Stack);
 /*****************************************************************************/
 /* Undefine "__EXTERN__" to avoid redefinition */
 #undef __EXTERN__
@@ -81,6 +81,25 @@ Description : The header of the RME RTOS. This header defines the error codes,
 #define RME_ERR_SIV_FREE             ((-6)+RME_ERR_SIV)
 /* The signal receive failed because we are the boot-time thread */
 #define RME_ERR_SIV_BOOT             ((-7)+RME_ERR_SIV)
+
+/* Process spawn stages - a failed spawn reports the stage where it stopped; the
+ * objects created in the stages before that are left in place for the caller */
+/* Creating the capability table */
+#define RME_SPAWN_CAPTBL             (0)
+/* Creating the process */
+#define RME_SPAWN_PROC               (1)
+/* Creating the thread */
+#define RME_SPAWN_THD                (2)
+/* Binding the thread to the scheduler thread */
+#define RME_SPAWN_BIND               (3)
+/* Setting the entry and stack of the thread */
+#define RME_SPAWN_EXEC               (4)
+/* Transferring time to the thread */
+#define RME_SPAWN_XFER               (5)
+/* Pack the stage and the error code into a spawn return value, and unpack them */
+#define RME_SPAWN_ERR(STAGE,ERR)     ((ERR)-(((ret_t)(STAGE))<<8))
+#define RME_SPAWN_STAGE(RET)         ((-(RET))>>8)
+#define RME_SPAWN_ERRNO(RET)         (-((-(RET))&0xFF))
 /* End Errors ****************************************************************/
 
 /* Operation Flags ***********************************************************/
@@ -143,6 +162,8 @@ Description : The header of the RME RTOS. This header defines the error codes,
 #define RME_PROC_FLAG_CPT            (1<<2)
 /* This cap to process allows changing its page table */
 #define RME_PROC_FLAG_PGT            (1<<3)
+/* This cap to process allows changing its fault handler */
+#define RME_PROC_FLAG_FLT            (1<<4)
 
 /* Thread */
 /* This cap to thread allows setting its execution parameters */
@@ -165,12 +186,16 @@ Description : The header of the RME RTOS. This header defines the error codes,
 #define RME_THD_FLAG_XFER_DST        (1<<8)
 /* This cap to thread allows switching to it */
 #define RME_THD_FLAG_SWT             (1<<9)
+/* This cap to thread allows resetting it */
+#define RME_THD_FLAG_RESET           (1<<10)
 
 /* Invocation */
 /* This cap to invocation allows setting parameters for it */
 #define RME_INV_FLAG_SET             (1<<0)
 /* This cap to invocation allows activating it */
 #define RME_INV_FLAG_ACT             (1<<1)
+/* This cap to invocation allows using it as a process fault handler */
+#define RME_INV_FLAG_FLT             (1<<2)
 /* The return operation does not need a flag, nor does it need a capability */
 
 /* Signal */
@@ -268,7 +293,7 @@ Description : The header of the RME RTOS. This header defines the error codes,
 #define RME_SVC_THD_SCHED_PRIO      5
 /* Free a thread from some core */
 #define RME_SVC_THD_SCHED_FREE      6
-/* Transfer time to a thread */
+/* Transfer time, in processor cycles, to a thread */
 #define RME_SVC_THD_TIME_XFER       7
 /* Switch to another thread */
 #define RME_SVC_THD_SWT             8
@@ -330,6 +355,18 @@ Description : The header of the RME RTOS. This header defines the error codes,
 #define RME_SVC_INV_DEL             33
 /* Set entry&stack */
 #define RME_SVC_INV_SET             34
+/* Compound IPC activation ***************************************************/
+/* Send to a signal endpoint, then receive from another one */
+#define RME_SVC_SIG_SND_RCV         35
+/* Compound object creation **************************************************/
+/* Create a process with its capability table and first thread, bound and funded */
+#define RME_SVC_PROC_SPAWN          36
+/* Thread recycling **********************************************************/
+/* Reset a thread to the state just after creation */
+#define RME_SVC_THD_RESET           37
+/* Fault handling ************************************************************/
+/* Set the fault handler of a process */
+#define RME_SVC_PROC_FLT            38
 /* End System Calls **********************************************************/
 /* End Defines ***************************************************************/
 
@@ -15,6 +15,7 @@ Description : The system call processing path, debugging primitives and kernel
 #include "Kernel/pgtbl.h"
 #include "Kernel/kotbl.h"
 #include "Kernel/prcthd.h"
+#include "Kernel/siginv.h"
 #undef __HDR_DEFS__
 
 #define __HDR_STRUCTS__
@@ -157,7 +158,7 @@ ret_t _RME_Kern_Act(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
        (Func_ID<RME_KERN_FLAG_LOW(Kern_Op->Head.Flags)))
         return RME_ERR_CAP_FLAG;
     /* Return whatever the function returns */
-    return __RME_Kern_Func_Handler(Reg,Func_ID,Param1,Param2);
+    return __RME_Kern_Func_Handler(Captbl,Reg,Func_ID,Param1,Param2);
 }
 /* End Function:_RME_Kern_Act ************************************************/
 
@@ -167,20 +168,30 @@ Description : This function is used to create boot-time kernel memory capability
               memory capabilities are the capabilities that allow you to create
               specific types of kernel objects in a specific kernel memory range.
               The initial kernel memory capability's content is supplied by the
-              kernel according to the initial memory setup macros.
+              kernel according to the initial memory setup macros. The platform may
+              create more than one of them, each covering a part of the kernel memory,
+              such as the memory of a NUMA node.
 Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
               cid_t Cap_Captbl - The capability to the captbl that may contain the cap
                                  to kernel function. 2-Level.
               cid_t Cap_Kmem - The capability to the kernel memory. 1-Level.
+              ptr_t Start - The start address of the kernel memory range.
+              ptr_t Size - The size of the kernel memory range.
 Output      : None.
 Return      : ret_t - If the mapping is successful, it will return 0; else error code.
 ******************************************************************************/
-ret_t _RME_Kmem_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Kmem)
+ret_t _RME_Kmem_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Kmem,
+                         ptr_t Start, ptr_t Size)
 {
     struct RME_Cap_Captbl* Captbl_Op;
     struct RME_Cap_Kmem* Kmem_Crt;
     ptr_t Type_Ref;
     
+    /* The range must be within the kernel memory */
+    if((Size==0)||(Start<RME_KMEM_VA_START)||
+       ((Start+Size-1)>(RME_KMEM_VA_START+RME_KMEM_SIZE-1)))
+        return RME_ERR_CAP_RANGE;
+    
     /* Get the cap location that we care about */
     RME_CAPTBL_GETCAP(Captbl,Cap_Captbl,RME_CAP_CAPTBL,struct RME_Cap_Captbl*,Captbl_Op);
     /* Check if the target captbl is not frozen and allows such operations */
@@ -199,8 +210,8 @@ ret_t _RME_Kmem_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t
                          RME_KMEM_FLAG_PROC|RME_KMEM_FLAG_THD| \
                          RME_KMEM_FLAG_SIG|RME_KMEM_FLAG_INV;
     /* Extra flags */
-    Kmem_Crt->Start=RME_KMEM_VA_START;
-    Kmem_Crt->End=RME_KMEM_VA_START+RME_KMEM_SIZE-1;
+    Kmem_Crt->Start=Start;
+    Kmem_Crt->End=Start+Size-1;
     /* Creation complete */
     Kmem_Crt->Head.Type_Ref=RME_CAP_TYPEREF(RME_CAP_KMEM,1);
     return 0;
@@ -221,7 +232,12 @@ ret_t _RME_Syscall_Init(void)
     RME_Timestamp=(~((ptr_t)(0)))>>(sizeof(ptr_t)*4);
     
     for(Count=0;Count<RME_CPU_NUM;Count++)
+    {
         RME_Cur_Thd[Count]=0;
+#if(RME_CYC_BUDGET==RME_TRUE)
+        RME_Cycle_Stamp[Count]=__RME_Cycle_Get();
+#endif
+    }
     
     return 0;
 }
@@ -240,6 +256,7 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
     ptr_t Svc;
     ptr_t Capid;
     ptr_t Param[3];
+    ptr_t Ext_Param[4];
     ret_t Retval;
     struct RME_Proc_Struct* Proc;
     struct RME_Cap_Captbl* Captbl;
@@ -262,7 +279,14 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
         /* Return from invocation */
         case RME_SVC_INV_RET:
         {
-            Retval=_RME_Inv_Ret(Reg /* struct RME_Reg_Struct* Reg */);
+            Retval=_RME_Inv_Ret(Reg /* struct RME_Reg_Struct* Reg */,
+                                0   /* ptr_t Fault */);
+            /* The fault handler did not resolve the fault that it was given */
+            if(Retval==RME_ERR_SIV_FAULT)
+            {
+                __RME_Thd_Fatal(Reg);
+                return;
+            }
             RME_SWITCH_RETURN(Reg,Retval);
         }
         /* Activate an invocation */
@@ -287,6 +311,14 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
                                         Param[0] /* cid_t Cap_Sig */);
             RME_SWITCH_RETURN(Reg,Retval);
         }
+        /* Send to a signal endpoint and receive from another one */
+        case RME_SVC_SIG_SND_RCV:
+        {
+            Retval=_RME_Sig_Snd_Rcv(Captbl, Reg      /* struct RME_Reg_Struct* Reg */,
+                                            Param[0] /* cid_t Cap_Sig_Snd */,
+                                            Param[1] /* cid_t Cap_Sig_Rcv */);
+            RME_SWITCH_RETURN(Reg,Retval);
+        }
         /* Call kernel functions */
         case RME_SVC_KERN:
         {
@@ -329,6 +361,25 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
                                         Param[1] /* ptr_t Full_Yield */);
             RME_SWITCH_RETURN(Reg, Retval);
         }
+        /* Spawn a process with its first thread */
+        case RME_SVC_PROC_SPAWN:
+        {
+            __RME_Get_Syscall_Ext_Param(Reg, Ext_Param);
+            Retval=_RME_Proc_Spawn(Captbl, Reg                        /* struct RME_Reg_Struct* Reg */,
+                                           Capid                      /* cid_t Cap_Captbl */,
+                                           RME_PARAM_D1(Param[0])     /* cid_t Cap_Kmem */,
+                                           RME_PARAM_D0(Param[0])     /* cid_t Cap_Base */,
+                                           RME_PARAM_D1(Param[2])     /* cid_t Cap_Pgtbl */,
+                                           RME_PARAM_D0(Param[2])     /* ptr_t Entry_Num */,
+                                           RME_PARAM_MP(Svc)          /* ptr_t Max_Prio */,
+                                           Param[1]                   /* ptr_t Vaddr */,
+                                           RME_PARAM_D1(Ext_Param[0]) /* cid_t Cap_Thd_Sched */,
+                                           RME_PARAM_D0(Ext_Param[0]) /* ptr_t Prio */,
+                                           Ext_Param[1]               /* ptr_t Time */,
+                                           Ext_Param[2]               /* ptr_t Entry */,
+                                           Ext_Param[3]               /* ptr_t Stack */);
+            RME_SWITCH_RETURN(Reg,Retval);
+        }
         default:break;
     } 
 
@@ -450,6 +501,13 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
                                          Param[1] /* cid_t Cap_Pgtbl */);
             break;
         }
+        case RME_SVC_PROC_FLT:
+        {
+            Retval=_RME_Proc_Flt(Captbl, Param[0] /* cid_t Cap_Proc */,
+                                         Param[1] /* cid_t Cap_Inv */,
+                                         Param[2] /* ptr_t Kaddr */);
+            break;
+        }
         /* Thread */
         case RME_SVC_THD_CRT:
         {
@@ -492,6 +550,11 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
             Retval=_RME_Thd_Sched_Rcv(Captbl, Param[0] /* cid_t Cap_Thd */);
             break;
         }
+        case RME_SVC_THD_RESET:
+        {
+            Retval=_RME_Thd_Reset(Captbl, Param[0] /* cid_t Cap_Thd */);
+            break;
+        }
         /* Signal */
         case RME_SVC_SIG_CRT:
         {
@@ -514,7 +577,8 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
                                         RME_PARAM_D1(Param[0]) /* cid_t Cap_Kmem */,
                                         RME_PARAM_D0(Param[0]) /* cid_t Cap_Inv */,
                                         Param[1]               /* cid_t Cap_Proc */,
-                                        Param[2]               /* ptr_t Vaddr */);
+                                        Param[2]               /* ptr_t Vaddr */,
+                                        RME_PARAM_IA(Svc)      /* ptr_t Act_Num */);
             break;
         }
         case RME_SVC_INV_DEL:
@@ -525,9 +589,10 @@ void _RME_Svc_Handler(struct RME_Reg_Struct* Reg)
         }
         case RME_SVC_INV_SET:
         {
-            Retval=_RME_Inv_Set(Captbl, Param[0] /* cid_t Cap_Inv */,
-                                        Param[1] /* ptr_t Entry */,
-                                        Param[2] /* ptr_t Stack */);
+            Retval=_RME_Inv_Set(Captbl, RME_PARAM_D0(Param[0]) /* cid_t Cap_Inv */,
+                                        Param[1]               /* ptr_t Entry */,
+                                        Param[2]               /* ptr_t Stack */,
+                                        RME_PARAM_D1(Param[0]) /* ptr_t Stack_Size */);
             break;
         }
         /* This is an error */
@@ -551,32 +616,34 @@ Return      : None.
 void _RME_Tick_Handler(struct RME_Reg_Struct* Reg)
 {
     ptr_t CPUID;
-    struct RME_Thd_Struct* Next_Thd;
     
     /* Increase the tick count */
     RME_Timestamp++;
     
     CPUID=RME_CPUID();
+#if(RME_CYC_BUDGET==RME_TRUE)
+    /* Charge the cycles consumed since the last switch or tick */
+    _RME_Run_Charge(RME_Cur_Thd[CPUID],CPUID);
+#else
+    /* Decrease timeslice count */
     if(RME_Cur_Thd[CPUID]->Sched.Slices<RME_THD_INF_TIME)
-    {
-        /* Decrease timeslice count */
         RME_Cur_Thd[CPUID]->Sched.Slices--;
-        /* See if the current thread's timeslice is used up */
-        if(RME_Cur_Thd[CPUID]->Sched.Slices==0)
-        {
-            /* Running out of time. Kick this guy out and pick someone else */
-            RME_Cur_Thd[CPUID]->Sched.State=RME_THD_TIMEOUT;
-            /* Send a scheduler notification to its parent */
-            _RME_Run_Notif(RME_Cur_Thd[CPUID]);
-            _RME_Run_Del(RME_Cur_Thd[CPUID]);
-            Next_Thd=_RME_Run_High(CPUID);
-            RME_ASSERT(Next_Thd!=0);
-            Next_Thd->Sched.State=RME_THD_RUNNING;
-            /* Do a solid context switch, to the new guy */
-            _RME_Run_Swt(Reg, RME_Cur_Thd[CPUID],Next_Thd);
-            RME_Cur_Thd[CPUID]=Next_Thd;
-        }
-    }
+#endif
+    /* See if the current thread's timeslice is used up */
+    if(RME_Cur_Thd[CPUID]->Sched.Slices==0)
+        _RME_Run_Timeout(Reg, CPUID);
+#if(RME_CYC_BUDGET==RME_TRUE)
+    /* The timer may be stopping at the budget instead, so start it again */
+    else
+        __RME_Budget_Set(RME_Cur_Thd[CPUID]->Sched.Slices);
+#endif
+    
+    /* Deliver the moderated signal batches that have waited long enough */
+    _RME_Sig_Mod_Tick(Reg);
+    
+    /* Drain whatever the kernel have printed, in case the console device cannot
+     * tell us when it is ready again */
+    _RME_Console_Flush();
     
     /* Send a signal to the kernel system ticker receive endpoint. This endpoint
      * is per-core */
@@ -584,6 +651,60 @@ void _RME_Tick_Handler(struct RME_Reg_Struct* Reg)
 }
 /* End Function:_RME_Tick_Handler ********************************************/
 
+#if(RME_CYC_BUDGET==RME_TRUE)
+/* Begin Function:_RME_Budget_Handler *****************************************
+Description : The budget timer handler of RME. The platform calls this instead of
+              _RME_Tick_Handler when its timer stops at the end of the current
+              thread's budget rather than at a tick, so the thread is timed out
+              right when its budget runs out.
+Input       : struct RME_Reg_Struct* Reg - The register set when entering the handler.
+Output      : struct RME_Reg_Struct* Reg - The register set when exiting the handler.
+Return      : None.
+******************************************************************************/
+void _RME_Budget_Handler(struct RME_Reg_Struct* Reg)
+{
+    ptr_t CPUID;
+    
+    CPUID=RME_CPUID();
+    /* The budget may have grown since the timer was set, so check it */
+    _RME_Run_Charge(RME_Cur_Thd[CPUID],CPUID);
+    if(RME_Cur_Thd[CPUID]->Sched.Slices==0)
+        _RME_Run_Timeout(Reg, CPUID);
+    else
+        __RME_Budget_Set(RME_Cur_Thd[CPUID]->Sched.Slices);
+}
+/* End Function:_RME_Budget_Handler ******************************************/
+#endif
+
+/* Begin Function:_RME_Resched_Handler ****************************************
+Description : The deferred rescheduling handler of RME. On platforms where
+              RME_RESCHED_DEFER is RME_TRUE, the kernel endpoint sends only put the
+              threads they wake up into the runqueue and ask for this handler, which
+              the platform runs after all the pending interrupts are processed. Thus,
+              a burst of interrupts only causes one switch here.
+Input       : struct RME_Reg_Struct* Reg - The register set when entering the handler.
+Output      : struct RME_Reg_Struct* Reg - The register set when exiting the handler.
+Return      : None.
+******************************************************************************/
+void _RME_Resched_Handler(struct RME_Reg_Struct* Reg)
+{
+    ptr_t CPUID;
+    struct RME_Thd_Struct* Next_Thd;
+    
+    CPUID=RME_CPUID();
+    Next_Thd=_RME_Run_High(CPUID);
+    RME_ASSERT(Next_Thd!=0);
+    /* Only a thread with a higher priority preempts us */
+    if(Next_Thd->Sched.Prio<=RME_Cur_Thd[CPUID]->Sched.Prio)
+        return;
+    
+    RME_Cur_Thd[CPUID]->Sched.State=RME_THD_READY;
+    _RME_Run_Swt(Reg, RME_Cur_Thd[CPUID], Next_Thd);
+    Next_Thd->Sched.State=RME_THD_RUNNING;
+    RME_Cur_Thd[CPUID]=Next_Thd;
+}
+/* End Function:_RME_Resched_Handler *****************************************/
+
 /* Begin Function:__RME_Low_Level_Check ***************************************
 Description : Do some low-level checking for the operating system.
 Input       : None.
@@ -638,6 +759,8 @@ ret_t RME_Kmain(void)
     _RME_Syscall_Init();
     /* Initialize process/threads control module */
     _RME_Prcthd_Init();
+    /* Initialize signal/invocation module */
+    _RME_Siginv_Init();
     
     /* Boot into the first process, and handle it all the other cases&enable the interrupt */
     __RME_Boot();
@@ -649,6 +772,111 @@ ret_t RME_Kmain(void)
 }
 /* End Function:RME_Kmain ****************************************************/
 
+/* Begin Function:_RME_Console_Init *******************************************
+Description : Give the kernel console the buffers of the booted CPUs. The platform
+              calls this once it knows how many CPUs there are, so that we do not
+              keep a buffer for each CPU that the platform could possibly have. The
+              buffer of CPU N is Console[N]. Before this, the characters are sent
+              to the device directly.
+Input       : struct RME_Console* Console - The buffers.
+              ptr_t Num - The number of buffers, which is the number of CPUs.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _RME_Console_Init(struct RME_Console* Console, ptr_t Num)
+{
+    ptr_t Count;
+    
+    for(Count=0;Count<Num;Count++)
+    {
+        Console[Count].Head=0;
+        Console[Count].Tail=0;
+    }
+    
+    RME_Console=Console;
+    RME_Console_Num=Num;
+}
+/* End Function:_RME_Console_Init ********************************************/
+
+/* Begin Function:_RME_Putchar ************************************************
+Description : Put a character into the kernel console buffer of this CPU, and try
+              to send out what is in the buffers without waiting for the device.
+              If the buffer is full, the character is dropped.
+Input       : s8 Char - The character to print.
+Output      : None.
+Return      : ptr_t - If the character is buffered, 0; else RME_ERR_PGT_OPFAIL.
+******************************************************************************/
+ptr_t _RME_Putchar(s8 Char)
+{
+    struct RME_Console* Console;
+    ptr_t CPUID;
+    ptr_t Retval;
+    
+    /* The buffers are not there yet, so this is early boot - wait for the device */
+    CPUID=RME_CPUID();
+    if(CPUID>=RME_Console_Num)
+    {
+        while(__RME_Putchar(Char)!=0);
+        return 0;
+    }
+    
+    Console=&RME_Console[CPUID];
+    if((Console->Tail-Console->Head)>=RME_CONSOLE_SIZE)
+        Retval=RME_ERR_PGT_OPFAIL;
+    else
+    {
+        Console->Buf[Console->Tail&(RME_CONSOLE_SIZE-1)]=Char;
+        /* The character must be there before the drainer sees the new tail */
+        Console->Tail++;
+        Retval=0;
+    }
+    
+    _RME_Console_Flush();
+    return Retval;
+}
+/* End Function:_RME_Putchar *************************************************/
+
+/* Begin Function:_RME_Console_Flush ******************************************
+Description : Send out what is in the kernel console buffers of all CPUs, until the
+              console device is busy. If another CPU is already doing this, we
+              just leave, because it will also send out ours. This is called when
+              characters are printed, and when the device may be ready again, e.g.
+              on a transmit interrupt, a timer tick or when idle. Only the buffers
+              of the booted CPUs are looked at.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _RME_Console_Flush(void)
+{
+    struct RME_Console* Console;
+    ptr_t Old;
+    cnt_t Count;
+    
+    Old=0;
+    if(__RME_Comp_Swap(&RME_Console_Lock,&Old,1)==0)
+        return;
+    
+    for(Count=0;Count<RME_Console_Num;Count++)
+    {
+        Console=&RME_Console[Count];
+        while(Console->Head!=Console->Tail)
+        {
+            /* The device is busy, try again later */
+            if(__RME_Putchar(Console->Buf[Console->Head&(RME_CONSOLE_SIZE-1)])!=0)
+            {
+                RME_Console_Lock=0;
+                return;
+            }
+            Console->Head++;
+        }
+    }
+    
+    /* The lock is volatile too, so it is released after all the Head stores */
+    RME_Console_Lock=0;
+}
+/* End Function:_RME_Console_Flush *******************************************/
+
 /* Begin Function:RME_Print_Int ***********************************************
 Description : Print a signed integer on the debugging console. This integer is
               printed as decimal with sign.
@@ -666,7 +894,7 @@ cnt_t RME_Print_Int(cnt_t Int)
     /* how many digits are there? */
     if(Int==0)
     {
-        __RME_Putchar('0');
+        _RME_Putchar('0');
         return 1;
     }
     else if(Int<0)
@@ -683,14 +911,14 @@ cnt_t RME_Print_Int(cnt_t Int)
         }
         Div/=10;
         
-        __RME_Putchar('-');
+        _RME_Putchar('-');
         Iter=-Int;
         Num=Count+1;
         
         while(Count>0)
         {
             Count--;
-            __RME_Putchar(Iter/Div+'0');
+            _RME_Putchar(Iter/Div+'0');
             Iter=Iter%Div;
             Div/=10;
         }
@@ -715,7 +943,7 @@ cnt_t RME_Print_Int(cnt_t Int)
         while(Count>0)
         {
             Count--;
-            __RME_Putchar(Iter/Div+'0');
+            _RME_Putchar(Iter/Div+'0');
             Iter=Iter%Div;
             Div/=10;
         }
@@ -741,7 +969,7 @@ cnt_t RME_Print_Uint(ptr_t Uint)
     /* how many digits are there? */
     if(Uint==0)
     {
-        __RME_Putchar('0');
+        _RME_Putchar('0');
         return 1;
     }
     else
@@ -762,9 +990,9 @@ cnt_t RME_Print_Uint(ptr_t Uint)
             Count--;
             Iter=(Uint>>(Count*4))&0x0F;
             if(Iter<10)
-                __RME_Putchar('0'+Iter);
+                _RME_Putchar('0'+Iter);
             else
-                __RME_Putchar('A'+Iter-10);
+                _RME_Putchar('A'+Iter-10);
         }
     }
     
@@ -789,7 +1017,7 @@ cnt_t RME_Print_String(s8* String)
         if(String[Count]=='\0')
             break;
         
-        __RME_Putchar(String[Count++]);
+        _RME_Putchar(String[Count++]);
     }
     
     return Count;
@@ -98,15 +98,15 @@ Return      : ret_t - Always 0.
 ret_t __RME_Thd_Inv_Top(struct RME_Thd_Struct* Thd, struct RME_Reg_Struct** Reg,
                         struct RME_Cop_Struct** Cop_Reg, struct RME_Proc_Struct** Proc)
 {
-    struct RME_Inv_Struct* Inv; 
+    struct RME_Inv_Act_Struct* Act; 
         
     /* Are we in any invocation? If yes, get the top */
     if(Thd->Inv_Stack.Next!=&(Thd->Inv_Stack))
     {
-        Inv=(struct RME_Inv_Struct*)(Thd->Inv_Stack.Next);
-        *Reg=&(Inv->Inv_Reg);
-        *Cop_Reg=&(Inv->Inv_Cop_Reg);
-        *Proc=Inv->Proc;
+        Act=(struct RME_Inv_Act_Struct*)(Thd->Inv_Stack.Next);
+        *Reg=&(Act->Inv_Reg);
+        *Cop_Reg=&(Act->Inv_Cop_Reg);
+        *Proc=Act->Inv->Proc;
     }
     else
     {
@@ -131,7 +131,7 @@ ret_t __RME_Thd_Inv_Top_Reg(struct RME_Thd_Struct* Thd, struct RME_Reg_Struct**
 {
     /* Are we in any invocation? */
     if(Thd->Inv_Stack.Next!=&(Thd->Inv_Stack))
-        *Reg=&(((struct RME_Inv_Struct*)(Thd->Inv_Stack.Next))->Inv_Reg);
+        *Reg=&(((struct RME_Inv_Act_Struct*)(Thd->Inv_Stack.Next))->Inv_Reg);
     else
         *Reg=&(Thd->Cur_Reg->Reg);
    
@@ -151,7 +151,7 @@ ret_t __RME_Thd_Inv_Top_Proc(struct RME_Thd_Struct* Thd, struct RME_Proc_Struct*
 {
     /* Are we in any invocation? */
     if(Thd->Inv_Stack.Next!=&(Thd->Inv_Stack))
-        *Proc=((struct RME_Inv_Struct*)(Thd->Inv_Stack.Next))->Proc;
+        *Proc=((struct RME_Inv_Act_Struct*)(Thd->Inv_Stack.Next))->Inv->Proc;
     else
         *Proc=Thd->Sched.Proc;
    
@@ -160,15 +160,18 @@ ret_t __RME_Thd_Inv_Top_Proc(struct RME_Thd_Struct* Thd, struct RME_Proc_Struct*
 /* End Function:__RME_Thd_Inv_Top_Proc ***************************************/
 
 /* Begin Function:__RME_Thd_Fatal *********************************************
-Description : The fatal fault handler of RME. This handler will be called by the 
-              ISR that handles the faults. This indicates that a fatal fault
-              has happenened and we need to see if this thread is in a synchronous
-              invocation. If yes, we stop the synchronous invocation immediately,
-              and return a fault value to the old register set. If not, we just
-              kill the thread. If the thread is killed, a timeout notification will
-              be sent to its parent, and if we try to delegate time to it, the time
-              delegation will just fail. A thread execution set is required to clear
-              the fatal fault status of the thread.
+Description : The fatal fault handler of RME. This handler will be called when a
+              fault cannot be resolved by the kernel or by a fault handler. This
+              indicates that a fatal fault has happenened and we need to see if
+              this thread is in a synchronous invocation. If yes, we stop the
+              synchronous invocation immediately, and return a fault value to the
+              old register set. If that invocation was itself delivering a fault,
+              that fault is not resolved either, and we keep on unwinding. If we
+              are not in any invocation, we just kill the thread. If the thread is
+              killed, a timeout notification will be sent to its parent, and if we
+              try to delegate time to it, the time delegation will just fail. A
+              thread execution set is required to clear the fatal fault status of
+              the thread.
 Input       : struct RME_Reg_Struct* Reg - The register set when entering the handler.
 Output      : struct RME_Reg_Struct* Reg - The register set when exiting the handler.
 Return      : ret_t - Always 0.
@@ -176,35 +179,68 @@ Return      : ret_t - Always 0.
 ret_t __RME_Thd_Fatal(struct RME_Reg_Struct* Reg)
 {
     struct RME_Thd_Struct* Thd;
+    struct RME_Thd_Struct* Next_Thd;
+    ret_t Retval;
     ptr_t CPUID;
     
-    /* Attempt to return from the invocation */
-    if(_RME_Inv_Ret(Reg)!=0)
+    /* Attempt to return from the invocations */
+    while(1)
     {
-        CPUID=RME_CPUID();
-        /* Return failure, we are not in an invocation. Kill the thread */
-        Thd=RME_Cur_Thd[CPUID];
-        /* Are we attempting to kill the init threads? If yes, panic */
-        RME_ASSERT(Thd->Sched.Slices!=RME_THD_INIT_TIME);
-        Thd->Sched.Slices=0;
-        Thd->Sched.State=RME_THD_FAULT;
-        _RME_Run_Del(Thd);
-        /* Finally, pick up something else to run */
-        Thd=_RME_Run_High(CPUID);
-        Thd->Sched.State=RME_THD_RUNNING;
-        RME_Cur_Thd[CPUID]=Thd;
-    
-        /* Send a signal to the fault receive endpoint. This endpoint is per-core */
-        _RME_Kern_Snd(Reg, RME_Fault_Sig[CPUID]);
+        Retval=_RME_Inv_Ret(Reg, 1);
+        /* Return successful, set the return value as "failure due to fault" */
+        if(Retval==0)
+        {
+            __RME_Set_Syscall_Retval(Reg,RME_ERR_SIV_FAULT);
+            return 0;
+        }
+        /* Return failure, we are not in an invocation */
+        if(Retval==RME_ERR_SIV_EMPTY)
+            break;
     }
-    /* Return successful, set the return value as "failure due to fault" */
-    else
-        __RME_Set_Syscall_Retval(Reg,RME_ERR_SIV_FAULT);
+    
+    /* Kill the thread */
+    CPUID=RME_CPUID();
+    Thd=RME_Cur_Thd[CPUID];
+    /* Are we attempting to kill the init threads? If yes, panic */
+    RME_ASSERT(Thd->Sched.Slices!=RME_THD_INIT_TIME);
+    Thd->Sched.Slices=0;
+    Thd->Sched.State=RME_THD_FAULT;
+    _RME_Run_Del(Thd);
+    /* Finally, pick up something else to run */
+    Next_Thd=_RME_Run_High(CPUID);
+    _RME_Run_Swt(Reg, Thd, Next_Thd);
+    Next_Thd->Sched.State=RME_THD_RUNNING;
+    RME_Cur_Thd[CPUID]=Next_Thd;
+
+    /* Send a signal to the fault receive endpoint. This endpoint is per-core */
+    _RME_Kern_Snd(Reg, RME_Fault_Sig[CPUID]);
         
     return 0;
 }
 /* End Function:__RME_Thd_Fatal **********************************************/
 
+/* Begin Function:__RME_Thd_Fault *********************************************
+Description : The fault handler of RME. This handler will be called by the ISR
+              that handles the faults, when the kernel cannot resolve the fault by
+              itself. If the process that the thread is executing in have a fault
+              handler, the fault is delivered to it; if not, or if it cannot take
+              the fault now, the fault is fatal.
+Input       : struct RME_Reg_Struct* Reg - The register set when entering the handler.
+              ptr_t Reason - The reason of the fault.
+              ptr_t Addr - The faulting address.
+Output      : struct RME_Reg_Struct* Reg - The register set when exiting the handler.
+Return      : ret_t - Always 0.
+******************************************************************************/
+ret_t __RME_Thd_Fault(struct RME_Reg_Struct* Reg, ptr_t Reason, ptr_t Addr)
+{
+    /* Try the fault handler first */
+    if(_RME_Inv_Fault(Reg, Reason, Addr)==0)
+        return 0;
+    
+    return __RME_Thd_Fatal(Reg);
+}
+/* End Function:__RME_Thd_Fault **********************************************/
+
 /* Begin Function:_RME_Run_Ins ************************************************
 Description : Insert a thread into the runqueue. In this function we do not check
               if the thread is on the current core, or is runnable, because it 
@@ -305,6 +341,99 @@ ret_t _RME_Run_Notif(struct RME_Thd_Struct* Thd)
 }
 /* End Function:_RME_Run_Notif ***********************************************/
 
+#if(RME_CYC_BUDGET==RME_TRUE)
+/* Begin Function:_RME_Run_Charge *********************************************
+Description : Charge a thread for the processor cycles that it consumed since the
+              last charge on this core, and take a new cycle stamp. Threads that
+              have infinite time or no time at all are not charged. If the budget
+              is used up, it drops to zero, and whatever the thread ran beyond it
+              is recorded as its debt; the caller must time the thread out.
+Input       : struct RME_Thd_Struct* Thd - The thread that have been running.
+              ptr_t CPUID - The cpu that it ran on.
+Output      : None.
+Return      : ret_t - If the budget is used up, -1; else 0.
+******************************************************************************/
+ret_t _RME_Run_Charge(struct RME_Thd_Struct* Thd, ptr_t CPUID)
+{
+    ptr_t Cycle;
+    ptr_t Used;
+    
+    /* The counter may wrap around, but it is charged at least once per tick */
+    Cycle=__RME_Cycle_Get();
+    Used=Cycle-RME_Cycle_Stamp[CPUID];
+    RME_Cycle_Stamp[CPUID]=Cycle;
+    
+    if((Thd->Sched.Slices==0)||(Thd->Sched.Slices>=RME_THD_INF_TIME))
+        return 0;
+    
+    if(Thd->Sched.Slices>Used)
+    {
+        Thd->Sched.Slices-=Used;
+        return 0;
+    }
+    
+    Thd->Sched.Debt+=Used-Thd->Sched.Slices;
+    Thd->Sched.Slices=0;
+    return -1;
+}
+/* End Function:_RME_Run_Charge **********************************************/
+
+/* Begin Function:_RME_Run_Repay **********************************************
+Description : Pay off the debt of a thread from the time that it have just been
+              given. If the debt is larger than that, the thread is left with no
+              time and the rest of the debt. An infinite budget clears the debt.
+Input       : struct RME_Thd_Struct* Thd - The thread that have been given time.
+Output      : None.
+Return      : ret_t - Always 0.
+******************************************************************************/
+ret_t _RME_Run_Repay(struct RME_Thd_Struct* Thd)
+{
+    if(Thd->Sched.Slices>=RME_THD_INF_TIME)
+        Thd->Sched.Debt=0;
+    else if(Thd->Sched.Slices>Thd->Sched.Debt)
+    {
+        Thd->Sched.Slices-=Thd->Sched.Debt;
+        Thd->Sched.Debt=0;
+    }
+    else
+    {
+        Thd->Sched.Debt-=Thd->Sched.Slices;
+        Thd->Sched.Slices=0;
+    }
+    
+    return 0;
+}
+/* End Function:_RME_Run_Repay ***********************************************/
+#endif
+
+/* Begin Function:_RME_Run_Timeout ********************************************
+Description : Time out the current thread on this core, which have used up its
+              time, and switch to the highest-priority thread in the runqueue.
+Input       : struct RME_Reg_Struct* Reg - The current register set.
+              ptr_t CPUID - The CPUID of the core.
+Output      : None.
+Return      : ret_t - Always 0.
+******************************************************************************/
+ret_t _RME_Run_Timeout(struct RME_Reg_Struct* Reg, ptr_t CPUID)
+{
+    struct RME_Thd_Struct* Next_Thd;
+    
+    /* Running out of time. Kick this guy out and pick someone else */
+    RME_Cur_Thd[CPUID]->Sched.State=RME_THD_TIMEOUT;
+    /* Send a scheduler notification to its parent */
+    _RME_Run_Notif(RME_Cur_Thd[CPUID]);
+    _RME_Run_Del(RME_Cur_Thd[CPUID]);
+    Next_Thd=_RME_Run_High(CPUID);
+    RME_ASSERT(Next_Thd!=0);
+    Next_Thd->Sched.State=RME_THD_RUNNING;
+    /* Do a solid context switch, to the new guy */
+    _RME_Run_Swt(Reg, RME_Cur_Thd[CPUID],Next_Thd);
+    RME_Cur_Thd[CPUID]=Next_Thd;
+    
+    return 0;
+}
+/* End Function:_RME_Run_Timeout *********************************************/
+
 /* Begin Function:_RME_Run_Swt ************************************************
 Description : Switch the register set and page table to another thread. 
 Input       : struct RME_Reg_Struct* Reg - The current register set.
@@ -326,6 +455,24 @@ ret_t _RME_Run_Swt(struct RME_Reg_Struct* Reg,
     struct RME_Reg_Struct* Next_Reg;
     struct RME_Cop_Struct* Next_Cop_Reg;
     
+#if(RME_CYC_BUDGET==RME_TRUE)
+    /* Charge the current thread for the cycles it ran up to now. If that used up
+     * its budget and it is still in the runqueue, time it out right away; if it
+     * is blocked, it will be timed out when it wakes up */
+    if(_RME_Run_Charge(Curr_Thd, RME_CPUID())!=0)
+    {
+        if((Curr_Thd->Sched.State==RME_THD_RUNNING)||(Curr_Thd->Sched.State==RME_THD_READY))
+        {
+            _RME_Run_Del(Curr_Thd);
+            Curr_Thd->Sched.State=RME_THD_TIMEOUT;
+            _RME_Run_Notif(Curr_Thd);
+        }
+    }
+    /* The next thread is charged from here on, and is stopped when its budget
+     * runs out */
+    __RME_Budget_Set(Next_Thd->Sched.Slices);
+#endif
+    
     /* Now do the register stuff */
     __RME_Thd_Inv_Top(Curr_Thd,&Curr_Reg, &Curr_Cop_Reg, &Curr_Proc);
     __RME_Thd_Inv_Top(Next_Thd,&Next_Reg, &Next_Cop_Reg, &Next_Proc);
@@ -334,7 +481,7 @@ ret_t _RME_Run_Swt(struct RME_Reg_Struct* Reg,
     __RME_Thd_Reg_Copy(Curr_Reg, Reg);
     __RME_Thd_Cop_Save(Reg, Curr_Cop_Reg);
     /* Restore next context */
-    __RME_Thd_Reg_Copy(Reg, Next_Reg);
+    __RME_Thd_Reg_Swt(Reg, Next_Reg);
     __RME_Thd_Cop_Restore(Reg, Next_Cop_Reg);
     
     /* Are we going to switch page tables? If yes, we change it now */
@@ -348,6 +495,41 @@ ret_t _RME_Run_Swt(struct RME_Reg_Struct* Reg,
 }
 /* End Function:_RME_Run_Swt *************************************************/
 
+/* Begin Function:_RME_Run_Handoff ********************************************
+Description : Hand the processor over to a thread that have just been woken up and
+              outranks the current thread. This is the fast path of the interrupt
+              wakeup: since no ready thread outranks the current one, the woken
+              thread is certainly the highest one after it is inserted, and we
+              switch straight into it without searching the bitmap with
+              _RME_Run_High. The preempted thread stays in the runqueue as it is.
+              The return value of the woken thread is written to the live register
+              set directly after the switch, rather than to its saved context.
+Input       : struct RME_Reg_Struct* Reg - The current register set.
+              struct RME_Thd_Struct* Curr_Thd - The current thread.
+              struct RME_Thd_Struct* Next_Thd - The woken thread.
+              ret_t Retval - The return value of the system call that the woken
+                             thread blocked in.
+Output      : None.
+Return      : ret_t - Always 0.
+******************************************************************************/
+ret_t _RME_Run_Handoff(struct RME_Reg_Struct* Reg,
+                       struct RME_Thd_Struct* Curr_Thd, 
+                       struct RME_Thd_Struct* Next_Thd, ret_t Retval)
+{
+    /* The thread must still be in the runqueue, or it cannot block later */
+    _RME_Run_Ins(Next_Thd);
+    
+    /* Switch to it, and write the return value to the restored register set. The
+     * current thread is set to ready first, as the switch may time it out */
+    Curr_Thd->Sched.State=RME_THD_READY;
+    _RME_Run_Swt(Reg,Curr_Thd,Next_Thd);
+    __RME_Set_Syscall_Retval(Reg,Retval);
+    Next_Thd->Sched.State=RME_THD_RUNNING;
+    
+    return 0;
+}
+/* End Function:_RME_Run_Handoff *********************************************/
+
 /* Begin Function:_RME_Prcthd_Init ********************************************
 Description : The system scheduling primitive initialization function.
 Input       : None.
@@ -431,6 +613,9 @@ ret_t _RME_Proc_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl_Crt,
     Proc_Struct=((struct RME_Proc_Struct*)Vaddr);
     /* Reference it to make the process undeletable */
     Proc_Struct->Refcnt=1;
+    /* There is no fault handler yet */
+    Proc_Struct->Fault_Inv=0;
+    Proc_Struct->Fault_Buf=0;
     /* Set the capability table, reference it and check for overflow */
     Proc_Struct->Captbl=Captbl_Op;
     Type_Ref=__RME_Fetch_Add(&(Captbl_Op->Head.Type_Ref), 1);
@@ -516,11 +701,15 @@ ret_t _RME_Proc_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl_Crt, cid_t C
     Proc_Crt->Head.Parent=0;
     Proc_Crt->Head.Object=Vaddr;
     Proc_Crt->Head.Flags=RME_PROC_FLAG_INV|RME_PROC_FLAG_THD|
-                         RME_PROC_FLAG_CPT|RME_PROC_FLAG_PGT;
+                         RME_PROC_FLAG_CPT|RME_PROC_FLAG_PGT|
+                         RME_PROC_FLAG_FLT;
     Proc_Struct=((struct RME_Proc_Struct*)Vaddr);
     /* Set the capability table, reference it and check for overflow */
     Proc_Struct->Captbl=Captbl_Op;
     Proc_Struct->Refcnt=0;
+    /* There is no fault handler yet */
+    Proc_Struct->Fault_Inv=0;
+    Proc_Struct->Fault_Buf=0;
     Type_Ref=__RME_Fetch_Add(&(Captbl_Op->Head.Type_Ref), 1);
     if(RME_CAP_REF(Type_Ref)>=RME_CAP_MAXREF)
     {
@@ -589,9 +778,11 @@ ret_t _RME_Proc_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_P
     /* Now we can safely delete the cap */
     RME_CAP_REMDEL(Proc_Del,Type_Ref);
     
-    /* Decrease the refcnt for the two caps */
+    /* Decrease the refcnt for the two caps, and the fault handler if there is one */
     __RME_Fetch_Add(&(Object->Captbl->Head.Type_Ref), -1);
     __RME_Fetch_Add(&(Object->Pgtbl->Head.Type_Ref), -1);
+    if(Object->Fault_Inv!=0)
+        __RME_Fetch_Add(&(Object->Fault_Inv->Head.Type_Ref), -1);
         
     /* Try to depopulate the area - this must be successful */
     RME_ASSERT(_RME_Kotbl_Erase((ptr_t)Object, RME_PROC_SIZE)!=0);
@@ -702,6 +893,82 @@ ret_t _RME_Proc_Pgt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Proc, cid_t Cap_Pgt
 }
 /* End Function:_RME_Proc_Pgt ************************************************/
 
+/* Begin Function:_RME_Proc_Flt ***********************************************
+Description : Change a process's fault handler. When a thread faults in this process
+              and the kernel cannot resolve the fault by itself, the fault will be
+              delivered to the handler, which is an invocation port. The fault
+              messages are placed in a buffer that have one message for each of
+              the activation records of the port.
+Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
+              cid_t Cap_Proc - The capability to the process that have been created
+                               already. 2-Level.
+              cid_t Cap_Inv - The capability to the invocation port to use as the
+                              fault handler. 2-Level.
+              ptr_t Kaddr - The kernel-accessible virtual address of the fault message
+                            buffer. If this is 0, the fault handler is removed and
+                            Cap_Inv is ignored.
+Output      : None.
+Return      : ret_t - If successful, 0; or an error code.
+******************************************************************************/
+ret_t _RME_Proc_Flt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Proc, cid_t Cap_Inv, ptr_t Kaddr)
+{
+    struct RME_Cap_Proc* Proc_Op;
+    struct RME_Cap_Inv* Inv_New;
+    struct RME_Cap_Inv* Inv_Old;
+    struct RME_Proc_Struct* Proc_Struct;
+    ptr_t Type_Ref;
+    
+    /* Get the capability slot */
+    RME_CAPTBL_GETCAP(Captbl,Cap_Proc,RME_CAP_PROC,struct RME_Cap_Proc*,Proc_Op); 
+    /* Check if the target cap is not frozen and allows such operations */
+    RME_CAP_CHECK(Proc_Op,RME_PROC_FLAG_FLT);
+    
+    if(Kaddr==0)
+        Inv_New=0;
+    else
+    {
+        RME_CAPTBL_GETCAP(Captbl,Cap_Inv,RME_CAP_INV,struct RME_Cap_Inv*,Inv_New);
+        RME_CAP_CHECK(Inv_New,RME_INV_FLAG_FLT);
+        
+        /* Message buffer must be aligned to word boundary and accessible to the kernel.
+         * The size is checked by division so that it cannot wrap around */
+        if(!(RME_IS_ALIGNED(Kaddr)&&(Kaddr>=RME_HYP_VA_START)&&
+             (Kaddr<(RME_HYP_VA_START+RME_HYP_SIZE))&&
+             (RME_CAP_GETOBJ(Inv_New,struct RME_Inv_Struct*)->Act_Num<=
+              ((RME_HYP_VA_START+RME_HYP_SIZE-Kaddr)/sizeof(struct RME_Fault_Frame)))))
+            return RME_ERR_PTH_PGTBL;
+        
+        /* Increase the reference count of the new cap first - If that fails, we can revert easily */
+        Type_Ref=__RME_Fetch_Add(&(Inv_New->Head.Type_Ref), 1);
+        if(RME_CAP_REF(Type_Ref)>=RME_CAP_MAXREF)
+        {
+            __RME_Fetch_Add(&(Inv_New->Head.Type_Ref), -1);
+            return RME_ERR_CAP_REFCNT;
+        }
+    }
+    
+    /* Read the old handler, and do CAS here. If we fail, revert the refcnt. The buffer
+     * is rechecked on each fault, so it is set after the handler is in place */
+    Proc_Struct=RME_CAP_GETOBJ(Proc_Op,struct RME_Proc_Struct*);
+    Inv_Old=Proc_Struct->Fault_Inv;
+    /* Actually commit the change */
+    if(__RME_Comp_Swap((ptr_t*)(&(Proc_Struct->Fault_Inv)),
+                              (ptr_t*)(&Inv_Old),
+                              (ptr_t)Inv_New)==0)
+    {
+        if(Inv_New!=0)
+            __RME_Fetch_Add(&(Inv_New->Head.Type_Ref), -1);
+        return RME_ERR_PTH_CONFLICT;
+    }
+    Proc_Struct->Fault_Buf=Kaddr;
+    /* Release the old handler */
+    if(Inv_Old!=0)
+        __RME_Fetch_Add(&(Inv_Old->Head.Type_Ref), -1);
+    
+    return 0;
+}
+/* End Function:_RME_Proc_Flt ************************************************/
+
 /* Begin Function:_RME_Thd_Boot_Crt *******************************************
 Description : Create a boot-time thread. The boot-time thread is per-core, and
               will have infinite budget. It have no parent, and will be bonded
@@ -756,6 +1023,9 @@ ret_t _RME_Thd_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
     /* Set this initially to 1 to make it virtually non-unbondable & undeletable */
     Thd_Struct->Sched.Refcnt=1;
     Thd_Struct->Sched.Slices=RME_THD_INIT_TIME;
+#if(RME_CYC_BUDGET==RME_TRUE)
+    Thd_Struct->Sched.Debt=0;
+#endif
     Thd_Struct->Sched.State=RME_THD_RUNNING;
     Thd_Struct->Sched.Signal=0;
     Thd_Struct->Sched.Prio=Prio;
@@ -769,6 +1039,8 @@ ret_t _RME_Thd_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
     Thd_Struct->Sched.Proc=RME_CAP_GETOBJ(Proc_Op,struct RME_Proc_Struct*);
     /* Point its pointer to itself - this will never be a hypervisor thread */
     Thd_Struct->Cur_Reg=&(Thd_Struct->Def_Reg);
+    /* The coprocessor state must be valid before the thread is ever switched to */
+    __RME_Thd_Cop_Init(0, 0, &(Thd_Struct->Cur_Reg->Cop_Reg));
     /* Initialize the invocation stack */
     __RME_List_Crt(&(Thd_Struct->Inv_Stack));
     
@@ -855,6 +1127,9 @@ ret_t _RME_Thd_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Km
     Thd_Struct->Sched.TID=__RME_Fetch_Add(&RME_TID_Inc, 1);
     Thd_Struct->Sched.Refcnt=0;
     Thd_Struct->Sched.Slices=0;
+#if(RME_CYC_BUDGET==RME_TRUE)
+    Thd_Struct->Sched.Debt=0;
+#endif
     Thd_Struct->Sched.State=RME_THD_TIMEOUT;
     Thd_Struct->Sched.Signal=0;
     Thd_Struct->Sched.Max_Prio=Max_Prio;
@@ -867,6 +1142,8 @@ ret_t _RME_Thd_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Km
     Thd_Struct->Sched.Proc=RME_CAP_GETOBJ(Proc_Op,struct RME_Proc_Struct*);
     /* Point its pointer to itself - this is not a hypervisor thread yet */
     Thd_Struct->Cur_Reg=&(Thd_Struct->Def_Reg);
+    /* The coprocessor state must be valid before the thread is ever switched to */
+    __RME_Thd_Cop_Init(0, 0, &(Thd_Struct->Cur_Reg->Cop_Reg));
     /* Initialize the invocation stack */
     __RME_List_Crt(&(Thd_Struct->Inv_Stack));
     
@@ -880,7 +1157,8 @@ ret_t _RME_Thd_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Km
                         RME_THD_FLAG_SCHED_CHILD|RME_THD_FLAG_SCHED_PARENT|
                         RME_THD_FLAG_SCHED_PRIO|RME_THD_FLAG_SCHED_FREE|
                         RME_THD_FLAG_SCHED_RCV|RME_THD_FLAG_SWT|
-                        RME_THD_FLAG_XFER_SRC|RME_THD_FLAG_XFER_DST;
+                        RME_THD_FLAG_XFER_SRC|RME_THD_FLAG_XFER_DST|
+                        RME_THD_FLAG_RESET;
     Thd_Crt->TID=Thd_Struct->Sched.TID;
     
     /* Creation complete */
@@ -905,7 +1183,7 @@ ret_t _RME_Thd_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Th
     ptr_t Type_Ref;
     /* These are for deletion */
     struct RME_Thd_Struct* Thd_Struct;
-    struct RME_Inv_Struct* Inv_Struct;
+    struct RME_Inv_Act_Struct* Act_Struct;
     
     /* Get the capability slot */
     RME_CAPTBL_GETCAP(Captbl,Cap_Captbl,RME_CAP_CAPTBL,struct RME_Cap_Captbl*,Captbl_Op);    
@@ -931,13 +1209,13 @@ ret_t _RME_Thd_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Th
     RME_CAP_REMDEL(Thd_Del,Type_Ref);
     
     /* Is the thread using any invocation? If yes, just pop the invocation
-     * stack to empty, and free all the invocation stubs. This can be virtually
+     * stack to empty, and free all the activation records. This can be virtually
      * unbounded if the invocation stack is just too deep. */
     while(Thd_Struct->Inv_Stack.Next!=&(Thd_Struct->Inv_Stack))
     {
-        Inv_Struct=(struct RME_Inv_Struct*)(Thd_Struct->Inv_Stack.Next);
-        __RME_List_Del(Inv_Struct->Head.Prev,Inv_Struct->Head.Next);
-        Inv_Struct->Active=0;
+        Act_Struct=(struct RME_Inv_Act_Struct*)(Thd_Struct->Inv_Stack.Next);
+        __RME_List_Del(Act_Struct->Head.Prev,Act_Struct->Head.Next);
+        Act_Struct->Active=0;
     }
     
     /* Dereference the process */
@@ -950,6 +1228,76 @@ ret_t _RME_Thd_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Th
 }
 /* End Function:_RME_Thd_Del *************************************************/
 
+/* Begin Function:_RME_Thd_Reset **********************************************
+Description : Reset a thread to the state that it was in just after creation. The
+              kernel object and the capability are kept, and so are the TID, the
+              maximum priority and the process that it is in. The invocation stack,
+              the registers and the scheduling state are cleared, and the thread
+              goes back to using its default register storage area. This is much
+              cheaper than deleting and creating the thread again, and is meant for
+              thread pools. Just like deletion, the thread must be unbonded first.
+Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
+              cid_t Cap_Thd - The capability to the thread. 2-Level.
+Output      : None.
+Return      : ret_t - If successful, 0; or an error code.
+******************************************************************************/
+ret_t _RME_Thd_Reset(struct RME_Cap_Captbl* Captbl, cid_t Cap_Thd)
+{
+    struct RME_Cap_Thd* Thd_Op;
+    struct RME_Thd_Struct* Thd_Struct;
+    struct RME_Inv_Act_Struct* Act_Struct;
+    ptr_t Old_CPUID;
+    ptr_t CPUID;
+    
+    /* Get the capability slot */
+    RME_CAPTBL_GETCAP(Captbl,Cap_Thd,RME_CAP_THD,struct RME_Cap_Thd*,Thd_Op);
+    /* Check if the target cap is not frozen and allows such operations */
+    RME_CAP_CHECK(Thd_Op,RME_THD_FLAG_RESET);
+    
+    /* See if the thread is unbonded. If not, we cannot proceed to reset */
+    Thd_Struct=RME_CAP_GETOBJ(Thd_Op,struct RME_Thd_Struct*);
+    Old_CPUID=Thd_Struct->Sched.CPUID_Bind;
+    if(Old_CPUID!=RME_THD_UNBIND)
+        return RME_ERR_PTH_INVSTATE;
+    
+    /* Bond it to this core for the time being, so that no other core can bond it
+     * while we are resetting it */
+    CPUID=RME_CPUID();
+    if(__RME_Comp_Swap(&(Thd_Struct->Sched.CPUID_Bind), &Old_CPUID, CPUID)==0)
+        return RME_ERR_PTH_CONFLICT;
+    
+    /* Pop the invocation stack to empty, and free all the activation records */
+    while(Thd_Struct->Inv_Stack.Next!=&(Thd_Struct->Inv_Stack))
+    {
+        Act_Struct=(struct RME_Inv_Act_Struct*)(Thd_Struct->Inv_Stack.Next);
+        __RME_List_Del(Act_Struct->Head.Prev,Act_Struct->Head.Next);
+        Act_Struct->Active=0;
+    }
+    
+    /* Go back to the default register storage area, and clear it */
+    Thd_Struct->Cur_Reg=&(Thd_Struct->Def_Reg);
+    _RME_Clear(&(Thd_Struct->Def_Reg), sizeof(struct RME_Thd_Regs));
+    __RME_Thd_Cop_Init(0, 0, &(Thd_Struct->Cur_Reg->Cop_Reg));
+    
+    /* Clear the scheduling state. An unbonded thread cannot be anyone's scheduler,
+     * so the reference count is already zero and there are no pending events */
+    Thd_Struct->Sched.Slices=0;
+#if(RME_CYC_BUDGET==RME_TRUE)
+    Thd_Struct->Sched.Debt=0;
+#endif
+    Thd_Struct->Sched.State=RME_THD_TIMEOUT;
+    Thd_Struct->Sched.Prio=0;
+    Thd_Struct->Sched.Signal=0;
+    Thd_Struct->Sched.Parent=0;
+    __RME_List_Crt(&(Thd_Struct->Sched.Notif));
+    __RME_List_Crt(&(Thd_Struct->Sched.Event));
+    
+    /* Set the state to unbonded so other cores can bond */
+    Thd_Struct->Sched.CPUID_Bind=RME_THD_UNBIND;
+    return 0;
+}
+/* End Function:_RME_Thd_Reset ***********************************************/
+
 /* Begin Function:_RME_Thd_Exec_Set *******************************************
 Description : Set a thread's entry point and stack. The registers will be initialized
               with these contents. Only when the thread has exited, or just after
@@ -1152,8 +1500,8 @@ ret_t _RME_Thd_Sched_Prio(struct RME_Cap_Captbl* Captbl,
         {
             /* This will cause a solid context switch - The current thread will be set to ready,
              * and we will set the thread that we switch to to be running. */
-            _RME_Run_Swt(Reg,RME_Cur_Thd[CPUID],Thd_Struct);
             RME_Cur_Thd[CPUID]->Sched.State=RME_THD_READY;
+            _RME_Run_Swt(Reg,RME_Cur_Thd[CPUID],Thd_Struct);
             Thd_Struct->Sched.State=RME_THD_RUNNING;
             RME_Cur_Thd[CPUID]=Thd_Struct;
         }
@@ -1232,12 +1580,17 @@ ret_t _RME_Thd_Sched_Free(struct RME_Cap_Captbl* Captbl,
          * we are not overwriting the return value of the caller thread */
         __RME_Thd_Inv_Top_Reg(Thd_Struct, &Block_Reg);
         __RME_Set_Syscall_Retval(Block_Reg,RME_ERR_SIV_FREE);
+        _RME_Sig_Mod_Clr(Thd_Struct->Sched.Signal);
         Thd_Struct->Sched.Signal->Thd=0;
         Thd_Struct->Sched.Signal=0;
         Thd_Struct->Sched.State=RME_THD_TIMEOUT;
     }
-    /* Delete all slices on it */
+    /* Delete all slices on it, and forget its debt; the next scheduler is not
+     * the one that should pay it off */
     Thd_Struct->Sched.Slices=0;
+#if(RME_CYC_BUDGET==RME_TRUE)
+    Thd_Struct->Sched.Debt=0;
+#endif
     
     CPUID=RME_CPUID();
     /* See if this thread is the current thread. If yes, then there will be a context switch */
@@ -1368,7 +1721,8 @@ Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
               cid_t Cap_Thd_Src - The source thread. 2-Level.
               ptr_t Time - The time to transfer, in slices, for normal transfers.
                            A slice is the minimal amount of time transfered in the
-                           system usually on the order of 100us or 1ms.
+                           system usually on the order of 100us or 1ms; if the
+                           RME_CYC_BUDGET is RME_TRUE, it is a processor cycle.
                            Use RME_THD_INIT_TIME for revoking transfer.
                            Use RME_THD_INF_TIME for infinite trasnfer.
 Output      : None.
@@ -1397,6 +1751,16 @@ ret_t _RME_Thd_Time_Xfer(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* R
 
     /* Check if the two threads are on the core that is accordance with what we are on */
     CPUID=RME_CPUID();
+#if(RME_CYC_BUDGET==RME_TRUE)
+    /* Bring the current thread's budget up to date, as it may be one of the two.
+     * If it have run out of time, it cannot make this call; time it out now */
+    if(_RME_Run_Charge(RME_Cur_Thd[CPUID], CPUID)!=0)
+    {
+        __RME_Set_Syscall_Retval(Reg,RME_ERR_PTH_INVSTATE);
+        _RME_Run_Timeout(Reg,CPUID);
+        return 0;
+    }
+#endif
     Thd_Src_Struct=RME_CAP_GETOBJ(Thd_Src,struct RME_Thd_Struct*);
     if(Thd_Src_Struct->Sched.CPUID_Bind!=CPUID)
         return RME_ERR_PTH_INVSTATE;
@@ -1460,6 +1824,11 @@ ret_t _RME_Thd_Time_Xfer(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* R
         }
     }
     
+#if(RME_CYC_BUDGET==RME_TRUE)
+    /* Whatever the destination overran before is paid off first */
+    _RME_Run_Repay(Thd_Dst_Struct);
+#endif
+    
     /* Is the source time used up? If yes, delete it from the run queue, and notify its 
      * parent. If it is not in the run queue, The state of the source must be BLOCKED. We
      * notify its parent when we are waking it up in the future, so do nothing here */
@@ -1478,8 +1847,9 @@ ret_t _RME_Thd_Time_Xfer(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* R
     __RME_Set_Syscall_Retval(Reg,Thd_Dst_Struct->Sched.Slices);  
     
     /* See what was the state of the destination thread. If it is timeout, then
-     * activate it. If it is other state, then leave it alone */
-    if(Thd_Dst_Struct->Sched.State==RME_THD_TIMEOUT)
+     * activate it, unless its debt took all the time. If it is other state, then
+     * leave it alone */
+    if((Thd_Dst_Struct->Sched.State==RME_THD_TIMEOUT)&&(Thd_Dst_Struct->Sched.Slices!=0))
     {
         Thd_Dst_Struct->Sched.State=RME_THD_READY;
         _RME_Run_Ins(Thd_Dst_Struct);
@@ -1500,11 +1870,16 @@ ret_t _RME_Thd_Time_Xfer(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* R
     else if((Thd_Dst_Struct->Sched.State==RME_THD_READY)&&
             (Thd_Dst_Struct->Sched.Prio>RME_Cur_Thd[CPUID]->Sched.Prio))
     {
+        RME_Cur_Thd[CPUID]->Sched.State=RME_THD_READY;
         _RME_Run_Swt(Reg, RME_Cur_Thd[CPUID], Thd_Dst_Struct);
         Thd_Dst_Struct->Sched.State=RME_THD_RUNNING;
-        RME_Cur_Thd[CPUID]->Sched.State=RME_THD_READY;
         RME_Cur_Thd[CPUID]=Thd_Dst_Struct;
     }
+#if(RME_CYC_BUDGET==RME_TRUE)
+    /* We gave some of our own time away, so we will run out of it earlier */
+    else if(Thd_Src_Struct==RME_Cur_Thd[CPUID])
+        __RME_Budget_Set(Thd_Src_Struct->Sched.Slices);
+#endif
     
     return 0;
 }
@@ -1612,6 +1987,95 @@ ret_t _RME_Thd_Swt(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
 }
 /* End Function:_RME_Thd_Swt *************************************************/
 
+/* Begin Function:_RME_Proc_Spawn *********************************************
+Description : Create a process together with its capability table and its first
+              thread, then bind the thread to a scheduler thread on this core, set
+              its entry and stack, and transfer time to it. This does in one system
+              call what would otherwise take six, and is meant for starting a lot of
+              short-lived components. The page table of the process must already
+              exist, because it needs to be populated before the thread can run.
+              The three new capabilities are placed in consecutive slots, starting
+              from Cap_Base: the capability table, the process, and the thread. The
+              three kernel objects are placed consecutively in kernel memory in the
+              same order, each rounded up to the kernel object slot size.
+              Each stage is carried out by the system call that would have done it
+              alone, so all checks are the same. If a stage fails, the objects made
+              in the stages before it are left alone, and the stage is returned in
+              the error code so that the caller knows what to clean up.
+              The scheduler thread is also where the time comes from.
+              This system call can cause a potential context switch.
+Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
+              struct RME_Reg_Struct* Reg - The current register set.
+              cid_t Cap_Captbl - The capability table to place the new capabilities
+                                 in. 1-Level.
+              cid_t Cap_Kmem - The kernel memory capability. 2-Level.
+              cid_t Cap_Base - The first of the three capability slots. 1-Level.
+              cid_t Cap_Pgtbl - The page table to use for this process. 2-Level.
+              ptr_t Entry_Num - The number of entries in the new capability table.
+              ptr_t Max_Prio - The maximum priority of the new thread.
+              ptr_t Vaddr - The virtual address to store the kernel objects.
+              cid_t Cap_Thd_Sched - The scheduler thread. 2-Level.
+              ptr_t Prio - The priority level of the new thread.
+              ptr_t Time - The time to transfer to the new thread.
+              ptr_t Entry - The entry of the new thread.
+              ptr_t Stack - The stack address of the new thread.
+Output      : None.
+Return      : ret_t - If successful, 0, and the final time transfer has already set the
+                      destination time amount as the return value of the caller; or
+                      an error code packed with the stage where the spawn stopped.
+******************************************************************************/
+ret_t _RME_Proc_Spawn(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                      cid_t Cap_Captbl, cid_t Cap_Kmem, cid_t Cap_Base,
+                      cid_t Cap_Pgtbl, ptr_t Entry_Num, ptr_t Max_Prio, ptr_t Vaddr,
+                      cid_t Cap_Thd_Sched, ptr_t Prio, ptr_t Time, ptr_t Entry, ptr_t Stack)
+{
+    cid_t Cap_Thd;
+    ret_t Retval;
+    
+    /* The new capabilities are addressed as 2-level caps below, so the capability
+     * table that holds them must be 1-level, and all three slots must fit in it */
+    if(((Cap_Captbl&RME_CAPID_2L)!=0)||((Cap_Base+2)>=RME_CAPID_2L))
+        return RME_SPAWN_ERR(RME_SPAWN_CAPTBL,RME_ERR_CAP_RANGE);
+    Cap_Thd=RME_CAPID(Cap_Captbl,Cap_Base+2);
+    
+    /* Create the capability table */
+    Retval=_RME_Captbl_Crt(Captbl, Cap_Captbl, Cap_Kmem, Cap_Base, Vaddr, Entry_Num);
+    if(Retval<0)
+        return RME_SPAWN_ERR(RME_SPAWN_CAPTBL,Retval);
+    Vaddr+=RME_KOTBL_ROUND(RME_CAPTBL_SIZE(Entry_Num));
+    
+    /* Create the process */
+    Retval=_RME_Proc_Crt(Captbl, Cap_Captbl, Cap_Kmem, Cap_Base+1,
+                         RME_CAPID(Cap_Captbl,Cap_Base), Cap_Pgtbl, Vaddr);
+    if(Retval<0)
+        return RME_SPAWN_ERR(RME_SPAWN_PROC,Retval);
+    Vaddr+=RME_KOTBL_ROUND(RME_PROC_SIZE);
+    
+    /* Create the thread */
+    Retval=_RME_Thd_Crt(Captbl, Cap_Captbl, Cap_Kmem, Cap_Base+2,
+                        RME_CAPID(Cap_Captbl,Cap_Base+1), Max_Prio, Vaddr);
+    if(Retval<0)
+        return RME_SPAWN_ERR(RME_SPAWN_THD,Retval);
+    
+    /* Bind it to the scheduler thread */
+    Retval=_RME_Thd_Sched_Bind(Captbl, Cap_Thd, Cap_Thd_Sched, Prio);
+    if(Retval<0)
+        return RME_SPAWN_ERR(RME_SPAWN_BIND,Retval);
+    
+    /* Set its entry and stack */
+    Retval=_RME_Thd_Exec_Set(Captbl, Cap_Thd, Entry, Stack);
+    if(Retval<0)
+        return RME_SPAWN_ERR(RME_SPAWN_EXEC,Retval);
+    
+    /* Give it some time - this saves the return value and may switch to it */
+    Retval=_RME_Thd_Time_Xfer(Captbl, Reg, Cap_Thd, Cap_Thd_Sched, Time);
+    if(Retval<0)
+        return RME_SPAWN_ERR(RME_SPAWN_XFER,Retval);
+
+    return 0;
+}
+/* End Function:_RME_Proc_Spawn **********************************************/
+
 /* End Of File ***************************************************************/
 
 /* Copyright (C) Evo-Devo Instrum. All rights reserved ***********************/
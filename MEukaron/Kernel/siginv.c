@@ -40,6 +40,24 @@ Description : The signal and invocation management code of RME RTOS.
 #undef __HDR_PUBLIC_MEMBERS__
 /* End Includes **************************************************************/
 
+/* Begin Function:_RME_Siginv_Init ********************************************
+Description : The signal and invocation module initialization function.
+Input       : None.
+Output      : None.
+Return      : ret_t - Always 0.
+******************************************************************************/
+ret_t _RME_Siginv_Init(void)
+{
+    cnt_t CPU_Cnt;
+    
+    /* Initialize the per-CPU moderation list */
+    for(CPU_Cnt=0;CPU_Cnt<RME_CPU_NUM;CPU_Cnt++)
+        __RME_List_Crt(&(RME_Mod_Sig[CPU_Cnt]));
+    
+    return 0;
+}
+/* End Function:_RME_Siginv_Init *********************************************/
+
 /* Begin Function:_RME_Sig_Boot_Crt *******************************************
 Description : Create a boot-time kernel signal capability. This is not a system 
               call, and is only used at boot-time to create endpoints that are
@@ -85,6 +103,10 @@ ret_t _RME_Sig_Boot_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
     Sig_Struct->Kernel_Flag=1;
     Sig_Struct->Signal_Num=0;
     Sig_Struct->Thd=0;
+    Sig_Struct->Mod_Num=0;
+    Sig_Struct->Mod_Time=0;
+    Sig_Struct->Mod_Stamp=0;
+    __RME_List_Crt(&(Sig_Struct->Mod_Head));
     
     /* Fill in the header part */
     Sig_Crt->Head.Parent=0;
@@ -146,6 +168,10 @@ ret_t _RME_Sig_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
     Sig_Struct->Kernel_Flag=0;
     Sig_Struct->Signal_Num=0;
     Sig_Struct->Thd=0;
+    Sig_Struct->Mod_Num=0;
+    Sig_Struct->Mod_Time=0;
+    Sig_Struct->Mod_Stamp=0;
+    __RME_List_Crt(&(Sig_Struct->Mod_Head));
     
     /* Fill in the header part */
     Sig_Crt->Head.Parent=0;
@@ -212,10 +238,102 @@ ret_t _RME_Sig_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Si
 }
 /* End Function:_RME_Sig_Del *************************************************/
 
+/* Begin Function:_RME_Sig_Take ***********************************************
+Description : Get the signal count that a thread woken up from an endpoint shall
+              receive, and detach the endpoint from the moderation list. If the
+              endpoint is holding back a moderated batch, the woken thread takes
+              the whole batch, and it is no longer pending on the endpoint. All
+              the paths that wake up a blocked thread shall go through this.
+Input       : struct RME_Sig_Struct* Sig_Struct - The signal structure.
+Output      : None.
+Return      : ptr_t - The signal count to return to the woken thread.
+******************************************************************************/
+static ptr_t _RME_Sig_Take(struct RME_Sig_Struct* Sig_Struct)
+{
+    ptr_t Signal_Num;
+    
+    Signal_Num=Sig_Struct->Signal_Num;
+    /* If this is the end of a moderated batch, all the signals held back are taken */
+    if(Sig_Struct->Mod_Head.Next!=&(Sig_Struct->Mod_Head))
+    {
+        _RME_Sig_Mod_Clr(Sig_Struct);
+        Sig_Struct->Signal_Num=0;
+    }
+    
+    return Signal_Num;
+}
+/* End Function:_RME_Sig_Take ************************************************/
+
+/* Begin Function:_RME_Kern_Wake **********************************************
+Description : Wake up the thread that is blocked on a kernel endpoint, and see if
+              it will preempt the current thread. If the endpoint is holding back
+              a moderated batch, the woken thread takes the whole batch. This is
+              only called when the blocked thread is on our core.
+Input       : struct RME_Reg_Struct* Reg - The register set.
+              struct RME_Sig_Struct* Sig_Struct - The signal structure.
+Output      : None.
+Return      : None.
+******************************************************************************/
+static void _RME_Kern_Wake(struct RME_Reg_Struct* Reg, struct RME_Sig_Struct* Sig_Struct)
+{
+    struct RME_Thd_Struct* Thd_Struct;
+    struct RME_Reg_Struct* Block_Reg;
+    ptr_t Retval;
+    ptr_t CPUID;
+    
+    CPUID=RME_CPUID();
+    Thd_Struct=Sig_Struct->Thd;
+    Retval=_RME_Sig_Take(Sig_Struct);
+#if(RME_RESCHED_DEFER==RME_FALSE)
+    /* Fast path - the thread still have time left and it will preempt us. Hand the
+     * processor over directly, and the return value goes to the live register set */
+    if((Thd_Struct->Sched.Slices!=0)&&(Thd_Struct->Sched.Prio>RME_Cur_Thd[CPUID]->Sched.Prio))
+    {
+        _RME_Run_Handoff(Reg,RME_Cur_Thd[CPUID],Thd_Struct,Retval);
+        RME_Cur_Thd[CPUID]=Thd_Struct;
+        /* Clear the blocking status of the endpoint up */
+        Sig_Struct->Thd=0;
+        return;
+    }
+#endif
+    
+    /* The thread is blocked, and it is on our core. Unblock it, and
+     * set the return value */
+    __RME_Thd_Inv_Top_Reg(Thd_Struct, &Block_Reg);
+    __RME_Set_Syscall_Retval(Block_Reg, Retval);
+    /* See if the thread still have time left */
+    if(Thd_Struct->Sched.Slices!=0)
+    {
+        /* Put this into the runqueue */
+        _RME_Run_Ins(Thd_Struct);
+        Thd_Struct->Sched.State=RME_THD_READY;
+#if(RME_RESCHED_DEFER==RME_TRUE)
+        /* If it will preempt us, we switch to it only once after all the pending
+         * interrupts have been processed; see _RME_Resched_Handler */
+        if(Thd_Struct->Sched.Prio>RME_Cur_Thd[CPUID]->Sched.Prio)
+            __RME_Resched_Pend();
+#endif
+    }
+    else
+    {
+        /* No slices left. This is because we delegated all of its time
+         * to someone else. Notify the parent, and change the state of this
+         * thread to TIMEOUT */
+        Thd_Struct->Sched.State=RME_THD_TIMEOUT;
+        /* Notify the parent about this */
+        _RME_Run_Notif(Thd_Struct);
+    }
+    
+    /* Clear the blocking status of the endpoint up */
+    Sig_Struct->Thd=0;
+}
+/* End Function:_RME_Kern_Wake ***********************************************/
+
 /* Begin Function:_RME_Kern_Snd ***********************************************
 Description : Try to send a signal to an endpoint from kernel. This is intended to
               be called in the interrupt routines in the kernel, and this is not a
-              system call.
+              system call. If the endpoint is moderated, the signals will be held
+              back until the batch is large enough or old enough.
 Input       : struct RME_Reg_Struct* Reg - The register set.
               struct RME_Sig_Struct* Sig - The signal structure.
 Output      : None.
@@ -224,7 +342,6 @@ Return      : ret_t - If successful, 0, or an error code.
 ret_t _RME_Kern_Snd(struct RME_Reg_Struct* Reg, struct RME_Sig_Struct* Sig_Struct)
 {
     struct RME_Thd_Struct* Thd_Struct;
-    struct RME_Reg_Struct* Block_Reg;
     ptr_t Unblock;
     ptr_t CPUID;
     
@@ -247,46 +364,27 @@ ret_t _RME_Kern_Snd(struct RME_Reg_Struct* Reg, struct RME_Sig_Struct* Sig_Struc
     else
         Unblock=0;
     
-    if(Unblock!=0)
+    /* If the endpoint is moderated, see if we should hold this signal back */
+    if((Unblock!=0)&&(Sig_Struct->Mod_Num>1))
     {
-        /* The thread is blocked, and it is on our core. Unblock it, and
-         * set the return value, then see if we need a preemption */
-        __RME_Thd_Inv_Top_Reg(Thd_Struct, &Block_Reg);
-        __RME_Set_Syscall_Retval(Block_Reg, Sig_Struct->Signal_Num);
-        /* See if the thread still have time left */
-        if(Thd_Struct->Sched.Slices!=0)
+        /* The first signal of a batch starts the clock */
+        if(Sig_Struct->Mod_Head.Next==&(Sig_Struct->Mod_Head))
         {
-            /* Put this into the runqueue */
-            _RME_Run_Ins(Thd_Struct);
-            /* See if it will preempt us */
-            if(Thd_Struct->Sched.Prio>RME_Cur_Thd[CPUID]->Sched.Prio)
-            {
-                /* Yes. Do a context switch */
-                _RME_Run_Swt(Reg,RME_Cur_Thd[CPUID],Thd_Struct);
-                RME_Cur_Thd[CPUID]->Sched.State=RME_THD_READY;
-                Thd_Struct->Sched.State=RME_THD_RUNNING;
-                RME_Cur_Thd[CPUID]=Thd_Struct;
-            }
-            else
-                Thd_Struct->Sched.State=RME_THD_READY;
+            Sig_Struct->Mod_Stamp=RME_Timestamp;
+            __RME_List_Ins(&(Sig_Struct->Mod_Head),RME_Mod_Sig[CPUID].Prev,&(RME_Mod_Sig[CPUID]));
         }
-        else
-        {
-            /* No slices left. This is because we delegated all of its time
-             * to someone else. Notify the parent, and change the state of this
-             * thread to TIMEOUT */
-            Thd_Struct->Sched.State=RME_THD_TIMEOUT;
-            /* Notify the parent about this */
-            _RME_Run_Notif(Thd_Struct);
-        }
-        
-        /* Clear the blocking status of the endpoint up */
-        Sig_Struct->Thd=0;
+        /* Neither the count nor the time have reached the limit */
+        if(((Sig_Struct->Signal_Num+1)<Sig_Struct->Mod_Num)&&
+           ((RME_Timestamp-Sig_Struct->Mod_Stamp)<Sig_Struct->Mod_Time))
+            Unblock=0;
     }
+    
+    if(Unblock!=0)
+        _RME_Kern_Wake(Reg, Sig_Struct);
     else
     {
-        /* The guy who blocked on it is not on our core, or nobody blocked.
-         * We just faa the counter value and return */
+        /* The guy who blocked on it is not on our core, or nobody blocked, or
+         * the signal is held back. We just faa the counter value and return */
         if(__RME_Fetch_Add(&(Sig_Struct->Signal_Num),1)>RME_MAX_SIG_NUM)
         {
             __RME_Fetch_Add(&(Sig_Struct->Signal_Num),-1);
@@ -298,6 +396,103 @@ ret_t _RME_Kern_Snd(struct RME_Reg_Struct* Reg, struct RME_Sig_Struct* Sig_Struc
 }
 /* End Function:_RME_Kern_Snd ************************************************/
 
+/* Begin Function:_RME_Sig_Mod_Set ********************************************
+Description : Arm or re-arm the interrupt moderation of a kernel endpoint. This is
+              intended to be called by the kernel functions of the platform, and
+              this is not a system call. If a batch is already being held back,
+              the new limits apply to it as well, and its clock starts over; if the
+              moderation is disarmed, that batch will be delivered on the next
+              timer tick. The window is counted in timer ticks.
+Input       : struct RME_Sig_Struct* Sig_Struct - The signal structure.
+              ptr_t Mod_Num - The number of signals to wake the receiver. 1 will
+                              disarm the moderation.
+              ptr_t Mod_Time - The maximum number of ticks to hold the signals back
+                               for.
+Output      : None.
+Return      : ret_t - If successful, 0; if the count or the time is 0, -1.
+******************************************************************************/
+ret_t _RME_Sig_Mod_Set(struct RME_Sig_Struct* Sig_Struct, ptr_t Mod_Num, ptr_t Mod_Time)
+{
+    ptr_t CPUID;
+    
+    /* A batch must be delivered after some signals and some time */
+    if((Mod_Num==0)||(Mod_Time==0))
+        return -1;
+    
+    Sig_Struct->Mod_Time=Mod_Time;
+    Sig_Struct->Mod_Num=Mod_Num;
+    /* If a batch is being held back, take it out and put it back to the end of the list
+     * of the core that the receiver is on, so that the new window starts from now */
+    if(Sig_Struct->Mod_Head.Next!=&(Sig_Struct->Mod_Head))
+    {
+        _RME_Sig_Mod_Clr(Sig_Struct);
+        if(Sig_Struct->Thd!=0)
+        {
+            CPUID=Sig_Struct->Thd->Sched.CPUID_Bind;
+            Sig_Struct->Mod_Stamp=RME_Timestamp;
+            __RME_List_Ins(&(Sig_Struct->Mod_Head),RME_Mod_Sig[CPUID].Prev,&(RME_Mod_Sig[CPUID]));
+        }
+    }
+    
+    return 0;
+}
+/* End Function:_RME_Sig_Mod_Set *********************************************/
+
+/* Begin Function:_RME_Sig_Mod_Clr ********************************************
+Description : Take an endpoint out of the moderation list, if it is holding back a
+              batch. This must be called whenever the blocked thread is detached
+              from the endpoint. The signals held back are not touched.
+Input       : struct RME_Sig_Struct* Sig_Struct - The signal structure.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _RME_Sig_Mod_Clr(struct RME_Sig_Struct* Sig_Struct)
+{
+    __RME_List_Del(Sig_Struct->Mod_Head.Prev,Sig_Struct->Mod_Head.Next);
+    __RME_List_Crt(&(Sig_Struct->Mod_Head));
+}
+/* End Function:_RME_Sig_Mod_Clr *********************************************/
+
+/* Begin Function:_RME_Sig_Mod_Tick *******************************************
+Description : Deliver the moderated batches on this core that have been held back
+              for long enough, or whose moderation have been disarmed. This is
+              called in the timer interrupt handler. If the receiver is no longer
+              blocked here, the endpoint just leaves the list, and the signals stay
+              on it for the next receive.
+Input       : struct RME_Reg_Struct* Reg - The register set.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void _RME_Sig_Mod_Tick(struct RME_Reg_Struct* Reg)
+{
+    struct RME_Sig_Struct* Sig_Struct;
+    volatile struct RME_List* Trav;
+    volatile struct RME_List* Next;
+    ptr_t CPUID;
+    
+    CPUID=RME_CPUID();
+    Trav=RME_Mod_Sig[CPUID].Next;
+    while(Trav!=&(RME_Mod_Sig[CPUID]))
+    {
+        /* The endpoint may be taken out of the list when woken up */
+        Next=Trav->Next;
+        /* The list head is the first member of the signal structure */
+        Sig_Struct=(struct RME_Sig_Struct*)Trav;
+        /* Only wake up the receiver if it is still blocked on our core, like _RME_Kern_Snd */
+        if((Sig_Struct->Thd==0)||(Sig_Struct->Thd->Sched.CPUID_Bind!=CPUID))
+            _RME_Sig_Mod_Clr(Sig_Struct);
+        else if((Sig_Struct->Mod_Num<2)||
+                ((RME_Timestamp-Sig_Struct->Mod_Stamp)>=Sig_Struct->Mod_Time))
+        {
+            /* The signal that started the batch is the one that wakes the thread up */
+            __RME_Fetch_Add(&(Sig_Struct->Signal_Num),-1);
+            _RME_Kern_Wake(Reg, Sig_Struct);
+        }
+        Trav=Next;
+    }
+}
+/* End Function:_RME_Sig_Mod_Tick ********************************************/
+
 /* Begin Function:_RME_Sig_Snd ************************************************
 Description : Try to send a signal from user level. This system call can cause
               a potential context switch.
@@ -345,7 +540,7 @@ ret_t _RME_Sig_Snd(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg, ci
         /* The thread is blocked, and it is on our core. Unblock it, and
          * set the return value, then see if we need a preemption */
         __RME_Thd_Inv_Top_Reg(Thd_Struct, &Block_Reg);
-        __RME_Set_Syscall_Retval(Block_Reg, Sig_Struct->Signal_Num);
+        __RME_Set_Syscall_Retval(Block_Reg, _RME_Sig_Take(Sig_Struct));
         /* See if the thread still have time left */
         if(Thd_Struct->Sched.Slices!=0)
         {
@@ -355,8 +550,8 @@ ret_t _RME_Sig_Snd(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg, ci
             if(Thd_Struct->Sched.Prio>RME_Cur_Thd[CPUID]->Sched.Prio)
             {
                 /* Yes. Do a context switch */
-                _RME_Run_Swt(Reg,RME_Cur_Thd[CPUID],Thd_Struct);
                 RME_Cur_Thd[CPUID]->Sched.State=RME_THD_READY;
+                _RME_Run_Swt(Reg,RME_Cur_Thd[CPUID],Thd_Struct);
                 Thd_Struct->Sched.State=RME_THD_RUNNING;
                 RME_Cur_Thd[CPUID]=Thd_Struct;
             }
@@ -467,6 +662,156 @@ ret_t _RME_Sig_Rcv(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg, ci
 }
 /* End Function:_RME_Sig_Rcv *************************************************/
 
+/* Begin Function:_RME_Sig_Snd_Rcv ********************************************
+Description : Send a signal to one endpoint, then try to receive from another
+              endpoint, in one system call. This is the reply-and-wait operation
+              of a server loop, and the send-and-receive operation of a client.
+              The receive side is checked before anything is sent, so if this
+              fails early, nothing is done. If the send wakes up a thread and
+              we block on the receive, the woken thread will be picked directly
+              if it is the highest priority thread on this core, so there is at
+              most one context switch in this system call.
+              This system call can potentially trigger a context switch.
+Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
+              struct RME_Reg_Struct* Reg - The register set.
+              cid_t Cap_Sig_Snd - The capability to the signal to send to. 2-Level.
+              cid_t Cap_Sig_Rcv - The capability to the signal to receive from. 2-Level.
+Output      : None.
+Return      : ret_t - If successful, a non-negative number containing the current
+                      counter value of the receive endpoint will be returned; else
+                      an error code. If the send is done but the receive have a
+                      conflict, RME_ERR_SIV_CONFLICT will be returned.
+******************************************************************************/
+ret_t _RME_Sig_Snd_Rcv(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                       cid_t Cap_Sig_Snd, cid_t Cap_Sig_Rcv)
+{
+    struct RME_Cap_Sig* Snd_Op;
+    struct RME_Cap_Sig* Rcv_Op;
+    struct RME_Sig_Struct* Snd_Struct;
+    struct RME_Sig_Struct* Rcv_Struct;
+    struct RME_Thd_Struct* Thd_Struct;
+    struct RME_Thd_Struct* Cur_Thd;
+    struct RME_Reg_Struct* Block_Reg;
+    ptr_t Unblock;
+    ptr_t Old_Value;
+    ptr_t CPUID;
+    
+    /* Get the capability slots */
+    RME_CAPTBL_GETCAP(Captbl,Cap_Sig_Snd,RME_CAP_SIG,struct RME_Cap_Sig*,Snd_Op);
+    RME_CAPTBL_GETCAP(Captbl,Cap_Sig_Rcv,RME_CAP_SIG,struct RME_Cap_Sig*,Rcv_Op);
+    /* Check if the target caps are not frozen and allow such operations */
+    RME_CAP_CHECK(Snd_Op,RME_SIG_FLAG_SND);
+    RME_CAP_CHECK(Rcv_Op,RME_SIG_FLAG_RCV);
+    
+    Snd_Struct=RME_CAP_GETOBJ(Snd_Op,struct RME_Sig_Struct*);
+    Rcv_Struct=RME_CAP_GETOBJ(Rcv_Op,struct RME_Sig_Struct*);
+    /* See if we can receive on that endpoint - if someone blocks, we must
+     * wait for it to unblock before we can proceed */
+    if(Rcv_Struct->Thd!=0)
+        return RME_ERR_SIV_ACT;
+    
+    /* Are we trying to let a boot-time thread block on a signal? This is NOT allowed */
+    CPUID=RME_CPUID();
+    Cur_Thd=RME_Cur_Thd[CPUID];
+    if(Cur_Thd->Sched.Slices==RME_THD_INIT_TIME)
+        return RME_ERR_SIV_BOOT;
+    
+    /* Do the send first. If and only if we are calling from the same core as the
+     * blocked thread do we actually unblock */
+    Thd_Struct=Snd_Struct->Thd;
+    if(Thd_Struct!=0)
+    {
+        if(Thd_Struct->Sched.CPUID_Bind==CPUID)
+            Unblock=1;
+        else
+            Unblock=0;
+    }
+    else
+        Unblock=0;
+    
+    if(Unblock!=0)
+    {
+        /* The thread is blocked, and it is on our core. Unblock it, and set the
+         * return value. We will decide whether to switch to it later */
+        __RME_Thd_Inv_Top_Reg(Thd_Struct, &Block_Reg);
+        __RME_Set_Syscall_Retval(Block_Reg, _RME_Sig_Take(Snd_Struct));
+        /* See if the thread still have time left */
+        if(Thd_Struct->Sched.Slices!=0)
+        {
+            /* Put this into the runqueue */
+            _RME_Run_Ins(Thd_Struct);
+            Thd_Struct->Sched.State=RME_THD_READY;
+        }
+        else
+        {
+            /* No slices left. Notify the parent, and change the state of this
+             * thread to TIMEOUT. It cannot run, so we will not switch to it */
+            Thd_Struct->Sched.State=RME_THD_TIMEOUT;
+            _RME_Run_Notif(Thd_Struct);
+            Thd_Struct=0;
+        }
+        
+        /* Clear the blocking status of the endpoint up */
+        Snd_Struct->Thd=0;
+    }
+    else
+    {
+        /* The guy who blocked on it is not on our core, we just faa */
+        Thd_Struct=0;
+        if(__RME_Fetch_Add(&(Snd_Struct->Signal_Num),1)>RME_MAX_SIG_NUM)
+        {
+            __RME_Fetch_Add(&(Snd_Struct->Signal_Num),-1);
+            return RME_ERR_SIV_FULL;
+        }
+    }
+    
+    /* Now do the receive. Are there any counts available? If yes, just take one */
+    Old_Value=Rcv_Struct->Signal_Num;
+    if(Old_Value>0)
+    {
+        /* Try to take it. The send is already done, so we cannot fail the system
+         * call here; we report the conflict in the return value instead */
+        if(__RME_Comp_Swap(&(Rcv_Struct->Signal_Num),&Old_Value,Old_Value-1)==0)
+            __RME_Set_Syscall_Retval(Reg, RME_ERR_SIV_CONFLICT);
+        else
+            __RME_Set_Syscall_Retval(Reg, Old_Value-1);
+    }
+    else
+    {
+        /* Try to take the rcv endpoint as blocked */
+        Old_Value=0;
+        if(__RME_Comp_Swap((ptr_t*)(&(Rcv_Struct->Thd)),&Old_Value,(ptr_t)Cur_Thd)==0)
+            __RME_Set_Syscall_Retval(Reg, RME_ERR_SIV_CONFLICT);
+        else
+        {
+            /* We have taken it, now we block our current thread. If the thread
+             * we just woke up is the highest one, it will be picked here */
+            Cur_Thd->Sched.State=RME_THD_BLOCKED;
+            Cur_Thd->Sched.Signal=Rcv_Struct;
+            _RME_Run_Del(Cur_Thd);
+            RME_Cur_Thd[CPUID]=_RME_Run_High(CPUID);
+            _RME_Run_Swt(Reg,Cur_Thd,RME_Cur_Thd[CPUID]);
+            RME_Cur_Thd[CPUID]->Sched.State=RME_THD_RUNNING;
+            return 0;
+        }
+    }
+    
+    /* We did not block. See if the thread we woke up will preempt us */
+    if(Thd_Struct!=0)
+    {
+        if(Thd_Struct->Sched.Prio>Cur_Thd->Sched.Prio)
+        {
+            Cur_Thd->Sched.State=RME_THD_READY;
+            _RME_Run_Swt(Reg,Cur_Thd,Thd_Struct);
+            Thd_Struct->Sched.State=RME_THD_RUNNING;
+            RME_Cur_Thd[CPUID]=Thd_Struct;
+        }
+    }
+    
+    return 0;
+}
+/* End Function:_RME_Sig_Snd_Rcv *********************************************/
+
 /* Begin Function:_RME_Inv_Crt ************************************************
 Description : Create an invocation capability.
 Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
@@ -478,18 +823,27 @@ Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
               cid_t Cap_Proc - The capability to the process that it is in. 2-Level.
               ptr_t Vaddr - The physical address to store the kernel data. This must fall
                             within the kernel virtual address.
+              ptr_t Act_Num - The number of activation records in this invocation port.
+                              This is also the number of threads that can be in the port
+                              at the same time. If 0, one record will be created.
 Output      : None.
 Return      : ret_t - If successful, 0; or an error code.
 ******************************************************************************/
-ret_t _RME_Inv_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
-                   cid_t Cap_Kmem, cid_t Cap_Inv, cid_t Cap_Proc, ptr_t Vaddr)
+ret_t _RME_Inv_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_Kmem,
+                   cid_t Cap_Inv, cid_t Cap_Proc, ptr_t Vaddr, ptr_t Act_Num)
 {
     struct RME_Cap_Captbl* Captbl_Op;
     struct RME_Cap_Proc* Proc_Op;
     struct RME_Cap_Kmem* Kmem_Op;
     struct RME_Cap_Inv* Inv_Crt;
     struct RME_Inv_Struct* Inv_Struct;
+    struct RME_Inv_Act_Struct* Act_Struct;
     ptr_t Type_Ref;
+    cnt_t Count;
+    
+    /* A port always have at least one activation record */
+    if(Act_Num==0)
+        Act_Num=1;
     
     /* Get the capability slots */
     RME_CAPTBL_GETCAP(Captbl,Cap_Captbl,RME_CAP_CAPTBL,struct RME_Cap_Captbl*,Captbl_Op);
@@ -499,7 +853,7 @@ ret_t _RME_Inv_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
     RME_CAP_CHECK(Captbl_Op,RME_CAPTBL_FLAG_CRT);
     RME_CAP_CHECK(Proc_Op,RME_PROC_FLAG_INV);
     /* See if the creation is valid for this kmem range */
-    RME_KMEM_CHECK(Kmem_Op,RME_KMEM_FLAG_INV,Vaddr,RME_INV_SIZE);
+    RME_KMEM_CHECK(Kmem_Op,RME_KMEM_FLAG_INV,Vaddr,RME_INV_SIZE(Act_Num));
     
     /* Get the cap slot */
     RME_CAPTBL_GETSLOT(Captbl_Op,Cap_Inv,struct RME_Cap_Inv*,Inv_Crt);
@@ -507,7 +861,7 @@ ret_t _RME_Inv_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
     RME_CAPTBL_OCCUPY(Inv_Crt,Type_Ref);
     
     /* Try to populate the area */
-    if(_RME_Kotbl_Mark(Vaddr, RME_INV_SIZE)!=0)
+    if(_RME_Kotbl_Mark(Vaddr, RME_INV_SIZE(Act_Num))!=0)
     {
         Inv_Crt->Head.Type_Ref=0;
         return RME_ERR_CAP_KOTBL;
@@ -516,13 +870,21 @@ ret_t _RME_Inv_Crt(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl,
     /* Fill in the structure */
     Inv_Struct=(struct RME_Inv_Struct*)Vaddr;
     Inv_Struct->Proc=RME_CAP_GETOBJ(Proc_Op,struct RME_Proc_Struct*);
+    Inv_Struct->Act_Num=Act_Num;
+    /* All the activation records are free at the beginning */
+    Act_Struct=RME_INV_ACT(Inv_Struct);
+    for(Count=0;Count<Act_Num;Count++)
+    {
+        Act_Struct[Count].Inv=Inv_Struct;
+        Act_Struct[Count].Active=0;
+    }
     /* Increase the reference count of the process structure(Not the process capability) */
     __RME_Fetch_Add(&(RME_CAP_GETOBJ(Proc_Op, struct RME_Proc_Struct*)->Refcnt), 1);
     
     /* Fill in the header part */
     Inv_Crt->Head.Parent=0;
     Inv_Crt->Head.Object=Vaddr;
-    Inv_Crt->Head.Flags=RME_INV_FLAG_SET|RME_INV_FLAG_ACT;
+    Inv_Crt->Head.Flags=RME_INV_FLAG_SET|RME_INV_FLAG_ACT|RME_INV_FLAG_FLT;
     
     /* Creation complete */
     Inv_Crt->Head.Type_Ref=RME_CAP_TYPEREF(RME_CAP_INV,0);
@@ -547,6 +909,8 @@ ret_t _RME_Inv_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_In
     ptr_t Type_Ref;
     /* These are for deletion */
     struct RME_Inv_Struct* Inv_Struct;
+    struct RME_Inv_Act_Struct* Act_Struct;
+    cnt_t Count;
     
     /* Get the capability slot */
     RME_CAPTBL_GETCAP(Captbl,Cap_Captbl,RME_CAP_CAPTBL,struct RME_Cap_Captbl*,Captbl_Op);    
@@ -561,11 +925,15 @@ ret_t _RME_Inv_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_In
     /* Get the thread */
     Inv_Struct=RME_CAP_GETOBJ(Inv_Del,struct RME_Inv_Struct*);
     
-    /* See if the invocation is currently used. If yes, we cannot delete it */
-    if(Inv_Struct->Active!=0)
+    /* See if any activation record is currently used. If yes, we cannot delete it */
+    Act_Struct=RME_INV_ACT(Inv_Struct);
+    for(Count=0;Count<Inv_Struct->Act_Num;Count++)
     {
-        RME_CAP_DEFROST(Inv_Del,Type_Ref);
-        return RME_ERR_SIV_ACT;
+        if(Act_Struct[Count].Active!=0)
+        {
+            RME_CAP_DEFROST(Inv_Del,Type_Ref);
+            return RME_ERR_SIV_ACT;
+        }
     }
     
     /* Now we can safely delete the cap */
@@ -573,7 +941,7 @@ ret_t _RME_Inv_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_In
     /* Dereference the process */
     __RME_Fetch_Add(&(Inv_Struct->Proc->Refcnt), -1);
     /* Try to depopulate the area - this must be successful */
-    RME_ASSERT(_RME_Kotbl_Erase((ptr_t)Inv_Struct,RME_INV_SIZE)!=0);
+    RME_ASSERT(_RME_Kotbl_Erase((ptr_t)Inv_Struct,RME_INV_SIZE(Inv_Struct->Act_Num))!=0);
     
     return 0;
 }
@@ -581,35 +949,92 @@ ret_t _RME_Inv_Del(struct RME_Cap_Captbl* Captbl, cid_t Cap_Captbl, cid_t Cap_In
 
 /* Begin Function:_RME_Inv_Set ************************************************
 Description : Set an invocation stub's entry point and stack. The registers will
-              be initialized with these contents.
+              be initialized with these contents. All the activation records share
+              the same entry; the stack of record N is placed at Stack-N*Stack_Size,
+              so that all records can run at the same time.
 Input       : struct RME_Cap_Captbl* Captbl - The capability table.
               cid_t Cap_Inv - The capability to the invocation stub. 2-Level.
               ptr_t Entry - The entry of the thread.
               ptr_t Stack - The stack address to use for execution.
+              ptr_t Stack_Size - The size of the stack of each activation record.
+                                 This is ignored if there is only one record.
 Output      : None.
-Return      : ret_t - If successful, 0; or an error code.
+Return      : ret_t - If successful, 0; or an error code. If there are multiple
+                      records and their stacks would overlap or go below address
+                      0, RME_ERR_SIV_ACT.
 ******************************************************************************/
-ret_t _RME_Inv_Set(struct RME_Cap_Captbl* Captbl, cid_t Cap_Inv, ptr_t Entry, ptr_t Stack)
+ret_t _RME_Inv_Set(struct RME_Cap_Captbl* Captbl, cid_t Cap_Inv,
+                   ptr_t Entry, ptr_t Stack, ptr_t Stack_Size)
 {
     struct RME_Cap_Inv* Inv_Op;
     struct RME_Inv_Struct* Inv_Struct;
+    struct RME_Inv_Act_Struct* Act_Struct;
+    cnt_t Count;
     
     /* Get the capability slot */
     RME_CAPTBL_GETCAP(Captbl,Cap_Inv,RME_CAP_INV,struct RME_Cap_Inv*,Inv_Op);
     /* Check if the target cap is not frozen and allows such operations */
     RME_CAP_CHECK(Inv_Op,RME_INV_FLAG_SET);
     
-    /* Commit the change - we do not care if the invocation is in use */
     Inv_Struct=RME_CAP_GETOBJ(Inv_Op,struct RME_Inv_Struct*);
-    __RME_Thd_Reg_Init(Entry, Stack, &(Inv_Struct->Reg));
-    __RME_Thd_Cop_Init(Entry, Stack, &(Inv_Struct->Cop_Reg));
+    /* Multiple records cannot share one stack, and the lowest one must not wrap around */
+    if(Inv_Struct->Act_Num>1)
+    {
+        if((Stack_Size==0)||(Stack_Size>(Stack/(Inv_Struct->Act_Num-1))))
+            return RME_ERR_SIV_ACT;
+    }
+    
+    /* Commit the change - we do not care if the invocation is in use */
+    Act_Struct=RME_INV_ACT(Inv_Struct);
+    for(Count=0;Count<Inv_Struct->Act_Num;Count++)
+    {
+        __RME_Thd_Reg_Init(Entry, Stack-Count*Stack_Size, &(Act_Struct[Count].Reg));
+        __RME_Thd_Cop_Init(Entry, Stack-Count*Stack_Size, &(Act_Struct[Count].Cop_Reg));
+    }
     
     return 0;
 }
 /* End Function:_RME_Inv_Set *************************************************/
 
+/* Begin Function:_RME_Inv_Act_Get ********************************************
+Description : Take a free activation record from an invocation port. The search
+              begins at a different record on each CPU, so that callers on
+              different cores will not contend on the same record.
+Input       : struct RME_Inv_Struct* Inv_Struct - The invocation port.
+Output      : None.
+Return      : struct RME_Inv_Act_Struct* - The activation record taken, or 0 if
+                                           all of them are active.
+******************************************************************************/
+static struct RME_Inv_Act_Struct* _RME_Inv_Act_Get(struct RME_Inv_Struct* Inv_Struct)
+{
+    struct RME_Inv_Act_Struct* Act_Struct;
+    ptr_t Active;
+    cnt_t Count;
+    
+    /* Look for a free activation record and try to do CAS to activate it */
+    Act_Struct=&(RME_INV_ACT(Inv_Struct)[RME_CPUID()%Inv_Struct->Act_Num]);
+    for(Count=0;Count<Inv_Struct->Act_Num;Count++)
+    {
+        Active=Act_Struct->Active;
+        if(Active==0)
+        {
+            if(__RME_Comp_Swap(&(Act_Struct->Active),&Active,1)!=0)
+                return Act_Struct;
+        }
+        /* Wrap around to the first record if we reached the end */
+        if(Act_Struct==&(RME_INV_ACT(Inv_Struct)[Inv_Struct->Act_Num-1]))
+            Act_Struct=RME_INV_ACT(Inv_Struct);
+        else
+            Act_Struct++;
+    }
+    
+    return 0;
+}
+/* End Function:_RME_Inv_Act_Get *********************************************/
+
 /* Begin Function:_RME_Inv_Act ************************************************
 Description : Activate an invocation capability. That means, do the invocation.
+              We will take a free activation record from the port.
 Input       : struct RME_Cap_Captbl* Captbl - The capability table.
               struct RME_Reg_Struct* Reg - The register set for this thread.
               cid_t Cap_Inv - The capability slot to the invocation stub. 2-Level.
@@ -624,27 +1049,25 @@ ret_t _RME_Inv_Act(struct RME_Cap_Captbl* Captbl,
     struct RME_Reg_Struct* Cur_Reg;
     struct RME_Cop_Struct* Cur_Cop_Reg;
     struct RME_Inv_Struct* Inv_Struct;
+    struct RME_Inv_Act_Struct* Act_Struct;
     struct RME_Thd_Struct* Thd_Struct;
     struct RME_Proc_Struct* Proc_Struct;
-    ptr_t Active;
     
     /* Get the capability slot */
     RME_CAPTBL_GETCAP(Captbl,Cap_Inv,RME_CAP_INV,struct RME_Cap_Inv*,Inv_Op);
     /* Check if the target cap is not frozen and allows such operations */
     RME_CAP_CHECK(Inv_Op,RME_INV_FLAG_ACT);
     
-    /* Get the invocation struct */
+    /* Get the invocation struct, and an activation record from it. If all of
+     * them are active, then we cannot enter the port now */
     Inv_Struct=RME_CAP_GETOBJ(Inv_Op,struct RME_Inv_Struct*);
-    /* See if we are currently active - If yes, we can activate it again */
-    Active=Inv_Struct->Active;
-    if(Active!=0)
+    Act_Struct=_RME_Inv_Act_Get(Inv_Struct);
+    if(Act_Struct==0)
         return RME_ERR_SIV_ACT;
+    Act_Struct->Fault=0;
     
-    /* Push this invocation stub capability into the current thread's invocation stack */
+    /* Push this activation record into the current thread's invocation stack */
     Thd_Struct=RME_Cur_Thd[RME_CPUID()];
-    /* Try to do CAS and activate it */
-    if(__RME_Comp_Swap(&(Inv_Struct->Active),&Active,1)==0)
-        return RME_ERR_SIV_ACT;
     
     /* Now save the system call return value to the caller stack */
     __RME_Set_Syscall_Retval(Reg,0);
@@ -655,12 +1078,14 @@ ret_t _RME_Inv_Act(struct RME_Cap_Captbl* Captbl,
     __RME_Thd_Reg_Copy(Cur_Reg, Reg);
     __RME_Thd_Cop_Save(Reg, Cur_Cop_Reg);
     /* Push this into the stack : insert after the thread list header */
-    __RME_List_Ins(&(Inv_Struct->Head),&(Thd_Struct->Inv_Stack),Thd_Struct->Inv_Stack.Next);
-    /* Setup the register contents, and do the invocation */
-    __RME_Inv_Reg_Init(Param, &(Inv_Struct->Reg));
-    __RME_Inv_Cop_Init(Param, &(Inv_Struct->Cop_Reg));
-    __RME_Thd_Reg_Copy(Reg,&(Inv_Struct->Reg));
-    __RME_Thd_Cop_Restore(Reg,&(Inv_Struct->Cop_Reg));
+    __RME_List_Ins(&(Act_Struct->Head),&(Thd_Struct->Inv_Stack),Thd_Struct->Inv_Stack.Next);
+    /* Setup the register contents, and do the invocation. The register set of the
+     * port is only a template, so the invocation runs on its own copy of it */
+    __RME_Inv_Reg_Init(Param, &(Act_Struct->Reg));
+    __RME_Inv_Cop_Init(Param, &(Act_Struct->Cop_Reg));
+    __RME_Thd_Reg_Copy(&(Act_Struct->Inv_Reg),&(Act_Struct->Reg));
+    __RME_Thd_Reg_Swt(Reg,&(Act_Struct->Inv_Reg));
+    __RME_Thd_Cop_Restore(Reg,&(Act_Struct->Cop_Reg));
     
     /* Are we invoking into a new process? If yes, switch the page table */
     if(Proc_Struct->Pgtbl!=Inv_Struct->Proc->Pgtbl)
@@ -674,19 +1099,26 @@ ret_t _RME_Inv_Act(struct RME_Cap_Captbl* Captbl,
 Description : Return from the invocation function, and set the return value to
               the old register set. This function does not need a capability
               table to work.
+              If the invocation is a fault handler, there is no return value to
+              set; instead, if the handler returned a non-negative value, the
+              faulting thread resumes with the register set in the fault message.
 Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
               struct RME_Reg_Struct* Reg - The register set for this thread.
+              ptr_t Fault - Whether we are forced out by a fault. If yes, the return
+                            value is always RME_ERR_SIV_FAULT.
 Output      : None.
-Return      : ret_t - If successful, 0; or an error code.
+Return      : ret_t - If successful, 0; RME_ERR_SIV_FAULT if we returned from a fault
+                      handler that did not resolve the fault; or an error code.
 ******************************************************************************/
-ret_t _RME_Inv_Ret(struct RME_Reg_Struct* Reg)
+ret_t _RME_Inv_Ret(struct RME_Reg_Struct* Reg, ptr_t Fault)
 {
     struct RME_Thd_Struct* Thd_Struct;
     struct RME_Reg_Struct* Cur_Reg;
     struct RME_Cop_Struct* Cur_Cop_Reg;
     struct RME_Proc_Struct* Proc_Struct;
-    struct RME_Inv_Struct* Inv_Struct;
-    ptr_t Retval;
+    struct RME_Inv_Act_Struct* Act_Struct;
+    struct RME_Fault_Frame* Frame;
+    ret_t Retval;
     
     /* See if we can return; If we can, get the structure */
     Thd_Struct=RME_Cur_Thd[RME_CPUID()];
@@ -694,30 +1126,121 @@ ret_t _RME_Inv_Ret(struct RME_Reg_Struct* Reg)
         return RME_ERR_SIV_EMPTY;
     
     /* Get the return value from the register set */
-    Retval=__RME_Get_Inv_Retval(Reg);
+    if(Fault!=0)
+        Retval=RME_ERR_SIV_FAULT;
+    else
+        Retval=(ret_t)__RME_Get_Inv_Retval(Reg);
     
-    /* Get the invocation struct, and pop it from the stack. We directly get the next one */
-    Inv_Struct=(struct RME_Inv_Struct*)(Thd_Struct->Inv_Stack.Next);
-    __RME_List_Del(Inv_Struct->Head.Prev,Inv_Struct->Head.Next);
+    /* Get the activation record, and pop it from the stack. We directly get the next one */
+    Act_Struct=(struct RME_Inv_Act_Struct*)(Thd_Struct->Inv_Stack.Next);
+    __RME_List_Del(Act_Struct->Head.Prev,Act_Struct->Head.Next);
+    Frame=Act_Struct->Fault;
     
     /* Restore the register contents, and set return value. The system call return
      * value is already set when we successfully make the invocation, so there's
-     * no need to do that again */
+     * no need to do that again. If the fault handler resolved the fault, the thread
+     * resumes from the message instead; it is on hypervisor accessible memory, just
+     * like the register set of a hypervisor-managed thread, so it is copied to the
+     * thread rather than used in place */
     __RME_Thd_Inv_Top(Thd_Struct,&Cur_Reg, &Cur_Cop_Reg, &Proc_Struct);
-    __RME_Thd_Reg_Copy(Reg, Cur_Reg);
+    if((Frame!=0)&&(Retval>=0))
+        __RME_Thd_Reg_Copy(Cur_Reg, &(Frame->Reg));
+    __RME_Thd_Reg_Swt(Reg, Cur_Reg);
     __RME_Thd_Cop_Restore(Reg, Cur_Cop_Reg);
-    __RME_Set_Inv_Retval(Reg, Retval);
+    if(Frame==0)
+        __RME_Set_Inv_Retval(Reg, Retval);
     
     /* Are we returning into a new process? If yes, switch the page table */
-    if(Proc_Struct->Pgtbl!=Inv_Struct->Proc->Pgtbl)
+    if(Proc_Struct->Pgtbl!=Act_Struct->Inv->Proc->Pgtbl)
         __RME_Pgtbl_Set(RME_CAP_GETOBJ(Proc_Struct->Pgtbl,ptr_t));
     
-    /* We have successfully returned, set the invocation as inactive */
-    Inv_Struct->Active=0;
+    /* We have successfully returned, set the activation record as inactive */
+    Act_Struct->Active=0;
+    
+    /* The fault handler did not resolve the fault, the caller will deal with it */
+    if((Frame!=0)&&(Retval<0))
+        return RME_ERR_SIV_FAULT;
+    
     return 0;
 }
 /* End Function:_RME_Inv_Ret *************************************************/
 
+/* Begin Function:_RME_Inv_Fault **********************************************
+Description : Deliver a fault to the fault handler of the process that the current
+              thread is executing in. This is just an invocation on behalf of the
+              faulting thread: the fault reason, the fault address and the register
+              set are put into the fault message of the activation record taken,
+              and the handler gets the address of the message as its parameter.
+              When the handler returns, the faulting thread resumes.
+Input       : struct RME_Reg_Struct* Reg - The register set of the faulting thread.
+              ptr_t Reason - The reason of the fault.
+              ptr_t Addr - The faulting address.
+Output      : struct RME_Reg_Struct* Reg - The register set of the fault handler.
+Return      : ret_t - If successful, 0; or an error code.
+******************************************************************************/
+ret_t _RME_Inv_Fault(struct RME_Reg_Struct* Reg, ptr_t Reason, ptr_t Addr)
+{
+    struct RME_Cap_Inv* Inv_Op;
+    struct RME_Reg_Struct* Cur_Reg;
+    struct RME_Cop_Struct* Cur_Cop_Reg;
+    struct RME_Inv_Struct* Inv_Struct;
+    struct RME_Inv_Act_Struct* Act_Struct;
+    struct RME_Thd_Struct* Thd_Struct;
+    struct RME_Proc_Struct* Proc_Struct;
+    struct RME_Fault_Frame* Frame;
+    ptr_t Fault_Buf;
+    ptr_t Act_Index;
+    
+    /* Does the process that we are executing in have a fault handler? */
+    Thd_Struct=RME_Cur_Thd[RME_CPUID()];
+    __RME_Thd_Inv_Top(Thd_Struct,&Cur_Reg, &Cur_Cop_Reg, &Proc_Struct);
+    Inv_Op=Proc_Struct->Fault_Inv;
+    if(Inv_Op==0)
+        return RME_ERR_CAP_NULL;
+    Fault_Buf=Proc_Struct->Fault_Buf;
+    
+    /* Get an activation record from it. If the handler is itself faulting and
+     * all of its records are used up, we give up here */
+    Inv_Struct=RME_CAP_GETOBJ(Inv_Op,struct RME_Inv_Struct*);
+    Act_Struct=_RME_Inv_Act_Get(Inv_Struct);
+    if(Act_Struct==0)
+        return RME_ERR_SIV_ACT;
+    
+    /* Each record have its own message. The handler may have been changed after
+     * we read the buffer, so check the range again before writing to it. This is
+     * done in a way that cannot wrap around the top of the address space */
+    Act_Index=(ptr_t)(Act_Struct-RME_INV_ACT(Inv_Struct));
+    if((Fault_Buf<RME_HYP_VA_START)||(Fault_Buf>=(RME_HYP_VA_START+RME_HYP_SIZE))||
+       (Act_Index>=((RME_HYP_VA_START+RME_HYP_SIZE-Fault_Buf)/sizeof(struct RME_Fault_Frame))))
+    {
+        Act_Struct->Active=0;
+        return RME_ERR_PTH_PGTBL;
+    }
+    Frame=(struct RME_Fault_Frame*)(Fault_Buf+Act_Index*sizeof(struct RME_Fault_Frame));
+    Frame->Reason=Reason;
+    Frame->Addr=Addr;
+    __RME_Thd_Reg_Copy(&(Frame->Reg), Reg);
+    Act_Struct->Fault=Frame;
+    
+    /* Save the register contents, and push this into the invocation stack */
+    __RME_Thd_Reg_Copy(Cur_Reg, Reg);
+    __RME_Thd_Cop_Save(Reg, Cur_Cop_Reg);
+    __RME_List_Ins(&(Act_Struct->Head),&(Thd_Struct->Inv_Stack),Thd_Struct->Inv_Stack.Next);
+    /* Setup the register contents, and start the handler on its own copy of them */
+    __RME_Inv_Reg_Init((ptr_t)Frame, &(Act_Struct->Reg));
+    __RME_Inv_Cop_Init((ptr_t)Frame, &(Act_Struct->Cop_Reg));
+    __RME_Thd_Reg_Copy(&(Act_Struct->Inv_Reg),&(Act_Struct->Reg));
+    __RME_Thd_Reg_Swt(Reg,&(Act_Struct->Inv_Reg));
+    __RME_Thd_Cop_Restore(Reg,&(Act_Struct->Cop_Reg));
+    
+    /* Are we invoking into a new process? If yes, switch the page table */
+    if(Proc_Struct->Pgtbl!=Inv_Struct->Proc->Pgtbl)
+        __RME_Pgtbl_Set(RME_CAP_GETOBJ(Inv_Struct->Proc->Pgtbl,ptr_t));
+    
+    return 0;
+}
+/* End Function:_RME_Inv_Fault ***********************************************/
+
 /* End Of File ***************************************************************/
 
 /* Copyright (C) Evo-Devo Instrum. All rights reserved ***********************/
@@ -20,6 +20,7 @@ Description : The hardware abstraction layer for Cortex-M microcontrollers.
 #define __HDR_STRUCTS__
 #include "Platform/CortexM/platform_cmx.h"
 #include "Kernel/captbl.h"
+#include "Kernel/kernel.h"
 #include "Kernel/pgtbl.h"
 #include "Kernel/prcthd.h"
 #include "Kernel/siginv.h"
@@ -37,20 +38,62 @@ Description : The hardware abstraction layer for Cortex-M microcontrollers.
 #undef __HDR_PUBLIC_MEMBERS__
 /* End Includes **************************************************************/
 
+/* Begin Function:__RME_Disable_Int *******************************************
+Description : Mask the kernel's interrupts. This does not use PRIMASK; only the
+              interrupts at or below RME_CMX_INT_MASK_PRIO are masked with BASEPRI,
+              and the zero-latency ones above it can still come in.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_Disable_Int(void)
+{
+    __set_BASEPRI(RME_CMX_INT_MASK_PRIO);
+    /* Make sure that no kernel interrupt can come in after this */
+    __ISB();
+}
+/* End Function:__RME_Disable_Int ********************************************/
+
+/* Begin Function:__RME_Enable_Int ********************************************
+Description : Unmask the kernel's interrupts.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_Enable_Int(void)
+{
+    __set_BASEPRI(0);
+}
+/* End Function:__RME_Enable_Int *********************************************/
+
+/* Begin Function:__RME_Resched_Pend ******************************************
+Description : Ask for a deferred rescheduling. The PendSV is the lowest of all the
+              kernel's interrupts, so it will only come after all of them; setting
+              it again before it comes does nothing.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_Resched_Pend(void)
+{
+    SCB->ICSR=RME_CMX_ICSR_PENDSVSET;
+}
+/* End Function:__RME_Resched_Pend *******************************************/
+
 /* Begin Function:__RME_Comp_Swap *********************************************
 Description : The compare-and-swap atomic instruction. If the *Old value is equal to
               *Ptr, then set the *Ptr as New and return 1; else set the *Old as *Ptr,
               and return 0.
               On Cortex-M there is only one core. There's basically no need to do
               anything special, and we just disable interrupt for a very short time.
-Input       : ptr_t* Ptr - The pointer to the data.
+Input       : volatile ptr_t* Ptr - The pointer to the data.
               ptr_t* Old - The old value.
               ptr_t New - The new value.
-Output      : ptr_t* Ptr - The pointer to the data.
+Output      : volatile ptr_t* Ptr - The pointer to the data.
               ptr_t* Old - The old value.
 Return      : ptr_t - If successful, 1; else 0.
 ******************************************************************************/
-ptr_t __RME_Comp_Swap(ptr_t* Ptr, ptr_t* Old, ptr_t New)
+ptr_t __RME_Comp_Swap(volatile ptr_t* Ptr, ptr_t* Old, ptr_t New)
 {
     __RME_Disable_Int();
     if(*Ptr==*Old)
@@ -114,13 +157,17 @@ ptr_t __RME_Fetch_And(ptr_t* Ptr, ptr_t Operand)
 
 /* Begin Function:__RME_Putchar ***********************************************
 Description : Output a character to console. In Cortex-M, under most circumstances, 
-              we should use the ITM for such outputs.
+              we should use the ITM for such outputs. This never waits for the
+              device; the kernel console buffer will try again later.
 Input       : char Char - The character to print.
 Output      : None.
-Return      : ptr_t - Always 0.
+Return      : ptr_t - If the character is sent, 0; if the device is busy, 1.
 ******************************************************************************/
 ptr_t __RME_Putchar(char Char)
 {
+    if(RME_CMX_PUTCHAR_BUSY())
+        return 1;
+    
     RME_CMX_PUTCHAR(Char);
     return 0;
 }
@@ -135,28 +182,49 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Low_Level_Init(void)
 {
+    cnt_t Count;
+    
+    /* All interrupts are the kernel's unless the chip raises some of them above
+     * the kernel interrupt mask priority to make them zero-latency */
+    for(Count=0;Count<RME_CMX_INT_NUM;Count++)
+        NVIC_SetPriority((IRQn_Type)Count, RME_CMX_NVIC_PRIO(RME_CMX_INT_KERN_PRIO));
+    
     RME_CMX_LOW_LEVEL_INIT();
+    /* The console device is ready, start buffering the kernel console */
+    _RME_Console_Init(&RME_CMX_Console, 1);
+    
+    /* Start the DWT cycle counter for the thread budget accounting */
+    CoreDebug->DEMCR|=CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT=0;
+    DWT->CTRL|=DWT_CTRL_CYCCNTENA_Msk;
     
     /* Enable the MPU */
     SCB->SHCSR&=~SCB_SHCSR_MEMFAULTENA_Msk;
     MPU->CTRL&=~MPU_CTRL_ENABLE_Msk;
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    MPU->MAIR0=RME_CMX_MPU_V8_MAIR0;
+#endif
     MPU->CTRL=RME_CMX_MPU_PRIVDEF|MPU_CTRL_ENABLE_Msk;
     SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk;
     
     /* Enable all fault handlers */
     SCB->SHCSR|=RME_CMX_SHCSR_USGFAULTENA|RME_CMX_SHCSR_BUSFAULTENA|RME_CMX_SHCSR_MEMFAULTENA;
     
-    /* Set the priority of timer, svc and faults to the lowest */
+    /* Set the priority of timer, svc and faults to the lowest group. Within that,
+     * the PendSV is the lowest so it does the deferred rescheduling last */
     NVIC_SetPriorityGrouping(RME_CMX_NVIC_GROUPING);
-    NVIC_SetPriority(SVCall_IRQn, 0xFF);
+    NVIC_SetPriority(SVCall_IRQn, RME_CMX_NVIC_PRIO(RME_CMX_INT_KERN_PRIO));
     NVIC_SetPriority(PendSV_IRQn, 0xFF);
-    NVIC_SetPriority(SysTick_IRQn, 0xFF);
+    NVIC_SetPriority(SysTick_IRQn, RME_CMX_NVIC_PRIO(RME_CMX_INT_KERN_PRIO));
     NVIC_SetPriority(BusFault_IRQn, 0xFF);
     NVIC_SetPriority(UsageFault_IRQn, 0xFF);
     NVIC_SetPriority(DebugMonitor_IRQn, 0xFF);
     
-    /* Configure systick */
+    /* Configure systick. It is set again at every switch to stop the thread that
+     * runs out of budget, see __RME_Budget_Set */
     SysTick_Config(RME_CMX_SYSTICK_VAL);
+    RME_CMX_Tick_Left=RME_CMX_SYSTICK_VAL;
+    RME_CMX_Tick_Load=RME_CMX_SYSTICK_VAL;
     return 0;
 }
 /* End Function:__RME_Low_Level_Init *****************************************/
@@ -213,7 +281,8 @@ ptr_t __RME_Boot(void)
     
     /* Create the initial kernel function capability, and kernel memory capability */
     RME_ASSERT(_RME_Kern_Boot_Crt(RME_CMX_CPT, RME_BOOT_CAPTBL, RME_BOOT_INIT_KERN)==0);
-    RME_ASSERT(_RME_Kmem_Boot_Crt(RME_CMX_CPT, RME_BOOT_CAPTBL, RME_BOOT_INIT_KMEM)==0);
+    RME_ASSERT(_RME_Kmem_Boot_Crt(RME_CMX_CPT, RME_BOOT_CAPTBL, RME_BOOT_INIT_KMEM,
+                                  RME_KMEM_VA_START, RME_KMEM_SIZE)==0);
     
     /* Create the initial kernel endpoint for timer ticks */
     RME_Tick_Sig[0]=(struct RME_Sig_Struct*)Cur_Addr;
@@ -240,6 +309,8 @@ ptr_t __RME_Boot(void)
     
     /* Before we go into user level, make sure that the kernel object allocation is within the limits */
     RME_ASSERT(Cur_Addr<RME_CMX_KMEM_BOOT_FRONTIER);
+    /* The handlers will save the registers of the init thread to its own area */
+    RME_CMX_Cur_Reg=&(RME_Cur_Thd[RME_CPUID()]->Cur_Reg->Reg);
     /* Enable the MPU & interrupt */
     __RME_Pgtbl_Set(RME_CAP_GETOBJ(RME_Cur_Thd[RME_CPUID()]->Sched.Proc->Pgtbl,ptr_t));
     __RME_Enable_Int();
@@ -287,6 +358,69 @@ ptr_t __RME_CPUID_Get(void)
 }
 /* End Function:__RME_CPUID_Get **********************************************/
 
+/* Begin Function:__RME_Cycle_Get *********************************************
+Description : Get the processor cycle count, for the thread budget accounting.
+              The 32-bit DWT counter wraps around in about 20 seconds at 216MHz,
+              which is far longer than a tick.
+Input       : None.
+Output      : None.
+Return      : ptr_t - The DWT cycle count.
+******************************************************************************/
+ptr_t __RME_Cycle_Get(void)
+{
+    return DWT->CYCCNT;
+}
+/* End Function:__RME_Cycle_Get **********************************************/
+
+/* Begin Function:__RME_Budget_Set ********************************************
+Description : Set the SysTick to go off when the current thread runs out of its
+              budget, or at the next tick, whichever comes first. The SysTick
+              counts processor cycles, so the budget is used as it is. The part
+              of the last period that have passed is taken off the time left to
+              the tick, so the ticks do not move.
+Input       : ptr_t Budget - The budget left for the current thread, in cycles.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_Budget_Set(ptr_t Budget)
+{
+    ptr_t Val;
+    ptr_t Load;
+    
+    /* The PendSV runs below the SysTick, so keep it out while we do this */
+    __RME_Disable_Int();
+    
+    /* If the SysTick have already gone off, leave this to its handler, which will
+     * count the whole period. Otherwise a zero means that it have just been set */
+    Val=SysTick->VAL;
+    if((SCB->ICSR&RME_CMX_ICSR_PENDSTSET)!=0)
+    {
+        __RME_Enable_Int();
+        return;
+    }
+    if(Val!=0)
+    {
+        if(RME_CMX_Tick_Left>(RME_CMX_Tick_Load-Val))
+            RME_CMX_Tick_Left-=RME_CMX_Tick_Load-Val;
+        else
+            RME_CMX_Tick_Left=RME_CMX_SYSTICK_MIN;
+    }
+    
+    Load=RME_CMX_Tick_Left;
+    if(Budget<Load)
+        Load=Budget;
+    if(Load<RME_CMX_SYSTICK_MIN)
+        Load=RME_CMX_SYSTICK_MIN;
+    
+    /* Writing the value clears it, and the new period starts from the next cycle */
+    SysTick->LOAD=Load-1;
+    SysTick->VAL=0;
+    RME_CMX_Tick_Load=Load;
+    
+    __RME_Enable_Int();
+}
+/* End Function:__RME_Budget_Set *********************************************/
+
 /* Begin Function:__RME_Get_Syscall_Param *************************************
 Description : Get the system call parameters from the stack frame.
 Input       : struct RME_Reg_Struct* Reg - The register set.
@@ -297,6 +431,7 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Get_Syscall_Param(struct RME_Reg_Struct* Reg, ptr_t* Svc, ptr_t* Capid, ptr_t* Param)
 {
+    Reg=RME_CMX_REG(Reg);
     *Svc=(Reg->R4)>>16;
     *Capid=(Reg->R4)&0xFFFF;
     Param[0]=Reg->R5;
@@ -306,6 +441,24 @@ ptr_t __RME_Get_Syscall_Param(struct RME_Reg_Struct* Reg, ptr_t* Svc, ptr_t* Cap
 }
 /* End Function:__RME_Get_Syscall_Param **************************************/
 
+/* Begin Function:__RME_Get_Syscall_Ext_Param *********************************
+Description : Get the extra system call parameters from the stack frame. These
+              are only used by the compound system calls.
+Input       : struct RME_Reg_Struct* Reg - The register set.
+Output      : ptr_t* Ext_Param - The extra parameters.
+Return      : ptr_t - Always 0.
+******************************************************************************/
+ptr_t __RME_Get_Syscall_Ext_Param(struct RME_Reg_Struct* Reg, ptr_t* Ext_Param)
+{
+    Reg=RME_CMX_REG(Reg);
+    Ext_Param[0]=Reg->R8;
+    Ext_Param[1]=Reg->R9;
+    Ext_Param[2]=Reg->R10;
+    Ext_Param[3]=Reg->R11;
+    return 0;
+}
+/* End Function:__RME_Get_Syscall_Ext_Param **********************************/
+
 /* Begin Function:__RME_Set_Syscall_Retval ************************************
 Description : Set the system call return value to the stack frame. This function 
               may carry up to 4 return values. If the last 3 is not needed, just set
@@ -316,7 +469,7 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Set_Syscall_Retval(struct RME_Reg_Struct* Reg, ret_t Retval)
 {
-    Reg->R4=(ptr_t)Retval;
+    RME_CMX_REG(Reg)->R4=(ptr_t)Retval;
     return 0;
 }
 /* End Function:__RME_Set_Syscall_Retval *************************************/
@@ -329,7 +482,7 @@ Return      : ptr_t - The return value.
 ******************************************************************************/
 ptr_t __RME_Get_Inv_Retval(struct RME_Reg_Struct* Reg)
 {
-    return Reg->R5;
+    return RME_CMX_REG(Reg)->R5;
 }
 /* End Function:__RME_Get_Inv_Retval *****************************************/
 
@@ -341,7 +494,7 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Set_Inv_Retval(struct RME_Reg_Struct* Reg, ret_t Retval)
 {
-    Reg->R5=(ptr_t)Retval;
+    RME_CMX_REG(Reg)->R5=(ptr_t)Retval;
     return 0;
 }
 /* End Function:__RME_Set_Inv_Retval *****************************************/
@@ -384,13 +537,19 @@ ptr_t __RME_Thd_Reg_Read(ptr_t* Entry, ptr_t* Stack, ptr_t* Status, struct RME_R
 /* End Function:__RME_Thd_Reg_Read *******************************************/
 
 /* Begin Function:__RME_Thd_Reg_Copy ******************************************
-Description : Copy one set of registers into another.
+Description : Copy one set of registers into another. Saving the live register set
+              to the area that it is already in does nothing.
 Input       : struct RME_Reg_Struct* Src - The source register set.
 Output      : struct RME_Reg_Struct* Dst - The destination register set.
 Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Thd_Reg_Copy(struct RME_Reg_Struct* Dst, struct RME_Reg_Struct* Src)
 {
+    Dst=RME_CMX_REG(Dst);
+    Src=RME_CMX_REG(Src);
+    if(Dst==Src)
+        return 0;
+    
     /* Make sure that the ordering is the same so the compiler can optimize */
     Dst->SP=Src->SP;
     Dst->R4=Src->R4;
@@ -406,6 +565,20 @@ ptr_t __RME_Thd_Reg_Copy(struct RME_Reg_Struct* Dst, struct RME_Reg_Struct* Src)
 }
 /* End Function:__RME_Thd_Reg_Copy *******************************************/
 
+/* Begin Function:__RME_Thd_Reg_Swt *******************************************
+Description : Resume a saved register set. The handlers restore the registers from
+              where RME_CMX_Cur_Reg points to, so we just point it to the set.
+Input       : struct RME_Reg_Struct* Next_Reg - The register set to resume.
+Output      : struct RME_Reg_Struct* Reg - The live register set.
+Return      : ptr_t - Always 0.
+******************************************************************************/
+ptr_t __RME_Thd_Reg_Swt(struct RME_Reg_Struct* Reg, struct RME_Reg_Struct* Next_Reg)
+{
+    RME_CMX_Cur_Reg=Next_Reg;
+    return 0;
+}
+/* End Function:__RME_Thd_Reg_Swt ********************************************/
+
 /* Begin Function:__RME_Thd_Cop_Init ******************************************
 Description : Initialize the coprocessor register set for the thread.
 Input       : ptr_t Entry - The thread entry address.
@@ -434,7 +607,7 @@ ptr_t __RME_Thd_Cop_Save(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_
 #ifdef RME_CMX_FPU_TYPE
 #if(RME_CMX_FPU_TYPE!=RME_CMX_FPU_NONE)
     /* If this is a standard frame which does not contain FPU usage&context */
-    if(((Reg->LR)&RME_CMX_EXC_RET_STD_FRAME)!=0)
+    if(((RME_CMX_REG(Reg)->LR)&RME_CMX_EXC_RET_STD_FRAME)!=0)
         return 0;
     /* Not. We save the context of FPU */
     ___RME_CMX_Thd_Cop_Save(Cop_Reg);
@@ -458,7 +631,7 @@ ptr_t __RME_Thd_Cop_Restore(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* C
 #ifdef RME_CMX_FPU_TYPE
 #if(RME_CMX_FPU_TYPE!=RME_CMX_FPU_NONE)
     /* If this is a standard frame which does not contain FPU usage&context */
-    if(((Reg->LR)&RME_CMX_EXC_RET_STD_FRAME)!=0)
+    if(((RME_CMX_REG(Reg)->LR)&RME_CMX_EXC_RET_STD_FRAME)!=0)
         return 0;
     /* Not. We restore the context of FPU */
     ___RME_CMX_Thd_Cop_Restore(Cop_Reg);
@@ -495,27 +668,37 @@ ptr_t __RME_Inv_Cop_Init(ptr_t Param, struct RME_Cop_Struct* Cop_Reg)
 /* End Function:__RME_Inv_Cop_Init *******************************************/
 
 /* Begin Function:__RME_Kern_Func_Handler *************************************
-Description : Initialize the coprocessor register set for the invocation.
-Input       : struct RME_Reg_Struct* Reg - The current register set.
+Description : Handle kernel function calls.
+Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
+              struct RME_Reg_Struct* Reg - The current register set.
               ptr_t Func_ID - The function ID.
               ptr_t Param1 - The first parameter.
               ptr_t Param2 - The second parameter.
 Output      : None.
 Return      : ptr_t - The value that the function returned.
 ******************************************************************************/
-ptr_t __RME_Kern_Func_Handler(struct RME_Reg_Struct* Reg, ptr_t Func_ID,
-                              ptr_t Param1, ptr_t Param2)
+ptr_t __RME_Kern_Func_Handler(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                              ptr_t Func_ID, ptr_t Param1, ptr_t Param2)
 {
+    struct RME_Cap_Sig* Sig_Op;
+    struct RME_Sig_Struct* Sig_Struct;
+    struct RME_Proc_Struct* Proc;
+    struct __RME_CMX_MPU_Data* Top_MPU;
+    
     /* It must be interrupt-related operations */
-    if(Func_ID<240)
+    if(Func_ID<RME_CMX_INT_NUM)
     {
+        /* Zero-latency interrupts are outside of the kernel and cannot be touched */
+        if((NVIC_GetPriority((IRQn_Type)Func_ID)<<(8-__NVIC_PRIO_BITS))<RME_CMX_INT_MASK_PRIO)
+            return RME_ERR_PGT_OPFAIL;
+        
         if(Param1==RME_CMX_INT_OP)
         {
             if(Param2==RME_CMX_INT_ENABLE)
             {
                 NVIC_DisableIRQ((IRQn_Type)Func_ID);
                 /* When the IRQ is newly enabled, we set its priority to as low as the rest as always */
-                NVIC_SetPriority((IRQn_Type)Func_ID, 0xFF);
+                NVIC_SetPriority((IRQn_Type)Func_ID, RME_CMX_NVIC_PRIO(RME_CMX_INT_KERN_PRIO));
                 NVIC_EnableIRQ((IRQn_Type)Func_ID);
             }
             else
@@ -526,14 +709,70 @@ ptr_t __RME_Kern_Func_Handler(struct RME_Reg_Struct* Reg, ptr_t Func_ID,
         }
         else if(Param1==RME_CMX_INT_PRIO)
         {
-            /* Only changing the subpriority is allowed. main priority is as low as the rest */
-            NVIC_SetPriority((IRQn_Type)Func_ID,((0xFF<<(RME_CMX_NVIC_GROUPING+1))|Param2)&0xFF);
+            /* Only changing the subpriority is allowed. main priority is as low as the rest,
+             * and the lowest subpriority is reserved for the PendSV */
+            if(RME_CMX_NVIC_PRIO(RME_CMX_INT_KERN_PRIO|Param2)==RME_CMX_NVIC_PRIO(0xFF))
+                return RME_ERR_PGT_OPFAIL;
+            NVIC_SetPriority((IRQn_Type)Func_ID,RME_CMX_NVIC_PRIO(RME_CMX_INT_KERN_PRIO|Param2));
+            __RME_Set_Syscall_Retval(Reg,0);
+            return 0;
+        }
+        else if(Param1==RME_CMX_INT_BIND)
+        {
+            /* Bind this interrupt source to its own endpoint. Binding multiple sources
+             * to the same endpoint will make them a group */
+            RME_CAPTBL_GETCAP(Captbl,(cid_t)Param2,RME_CAP_SIG,struct RME_Cap_Sig*,Sig_Op);
+            RME_CAP_CHECK(Sig_Op,RME_SIG_FLAG_SND);
+            Sig_Struct=RME_CAP_GETOBJ(Sig_Op,struct RME_Sig_Struct*);
+            /* The endpoint is now a kernel endpoint - it cannot be deleted until unbound */
+            __RME_Fetch_Add(&(Sig_Struct->Kernel_Flag),1);
+            /* If it was bound to another endpoint, release that one */
+            if(RME_CMX_Int_Sig[Func_ID]!=0)
+                __RME_Fetch_Add(&(RME_CMX_Int_Sig[Func_ID]->Kernel_Flag),-1);
+            RME_CMX_Int_Sig[Func_ID]=Sig_Struct;
             __RME_Set_Syscall_Retval(Reg,0);
             return 0;
         }
+        else if(Param1==RME_CMX_INT_UNBIND)
+        {
+            /* Send this interrupt source back to the shared interrupt endpoint */
+            if(RME_CMX_Int_Sig[Func_ID]==0)
+                return RME_ERR_PGT_OPFAIL;
+            Sig_Struct=RME_CMX_Int_Sig[Func_ID];
+            RME_CMX_Int_Sig[Func_ID]=0;
+            __RME_Fetch_Add(&(Sig_Struct->Kernel_Flag),-1);
+            __RME_Set_Syscall_Retval(Reg,0);
+            return 0;
+        }
+        else if(Param1==RME_CMX_INT_MOD)
+        {
+            /* Arm or re-arm the moderation of the endpoint that this source signals.
+             * The higher half is the number of signals, the lower half is the ticks;
+             * neither can be 0, and a count of 1 disarms it */
+            if(RME_CMX_Int_Sig[Func_ID]!=0)
+                Sig_Struct=RME_CMX_Int_Sig[Func_ID];
+            else
+                Sig_Struct=RME_Int_Sig[RME_CPUID()];
+            if(_RME_Sig_Mod_Set(Sig_Struct,RME_PARAM_D1(Param2),RME_PARAM_D0(Param2))!=0)
+                return RME_ERR_PGT_OPFAIL;
+            __RME_Set_Syscall_Retval(Reg,0);
+            return 0;
+        }
+    }
+    else if(Func_ID==RME_CMX_KERN_MPU)
+    {
+        /* Return the MPU refill fault count of the current address space, and clear it if asked to */
+        __RME_Thd_Inv_Top_Proc(RME_Cur_Thd[RME_CPUID()], &Proc);
+        Top_MPU=RME_CMX_PGTBL_MPU(Proc->Pgtbl);
+        __RME_Set_Syscall_Retval(Reg,(ret_t)(Top_MPU->Fault_Cnt));
+        if(Param1!=0)
+            Top_MPU->Fault_Cnt=0;
+        return 0;
     }
-    else if(Func_ID==240)
+    else if(Func_ID==RME_CMX_KERN_PWR)
     {
+        /* We are idle, send out the kernel console output before we sleep */
+        _RME_Console_Flush();
         /* Wait for interrupt to happen */
         __RME_CMX_WFI();
         __RME_Set_Syscall_Retval(Reg,0);
@@ -591,6 +830,152 @@ ptr_t ___RME_Pgtbl_MPU_Gen_RASR(ptr_t* Table, ptr_t Flags, ptr_t Entry_Size_Orde
 }
 /* End Function:___RME_Pgtbl_MPU_Gen_RASR ************************************/
 
+/* Begin Function:___RME_Pgtbl_MPU_Gen_Merge **********************************
+Description : Generate the RASR for a region of twice the size that covers two
+              buddy directories. Each subregion of that region covers two pages,
+              so this is only possible when the pages come in present or absent
+              pairs.
+Input       : ptr_t Low_RASR - The RASR of the directory at the lower address.
+              ptr_t High_RASR - The RASR of the directory at the higher address.
+              ptr_t Size_Order - The size order of each entry in the directories.
+Output      : None.
+Return      : ptr_t - The RASR value returned, or 0 if they cannot be merged.
+******************************************************************************/
+ptr_t ___RME_Pgtbl_MPU_Gen_Merge(ptr_t Low_RASR, ptr_t High_RASR, ptr_t Size_Order)
+{
+    ptr_t RASR;
+    ptr_t Present;
+    ptr_t Count;
+    
+    if((Low_RASR==0)||(High_RASR==0))
+        return 0;
+    
+    /* The pages present in both directories - the SRD bits are set for absent ones */
+    Present=((~Low_RASR)>>8)&0xFF;
+    Present|=(((~High_RASR)>>8)&0xFF)<<8;
+    /* The two pages in each subregion must agree */
+    if(((Present^(Present>>1))&0x5555)!=0)
+        return 0;
+    
+    /* Get the SRD part */
+    RASR=0;
+    for(Count=0;Count<8;Count++)
+    {
+        if((Present&(((ptr_t)1)<<(Count<<1)))==0)
+            RASR|=(((ptr_t)1)<<(Count+8));
+    }
+    /* The attributes are the same, because the page flags are the same */
+    RASR|=RME_CMX_MPU_ATTR(Low_RASR)|RME_CMX_MPU_SZENABLE;
+    RASR|=RME_CMX_MPU_REGIONSIZE(Size_Order+1);
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    /* One base/limit region must cover the pages of both exactly */
+    if(___RME_Pgtbl_MPU_V8_Check(RASR)!=0)
+        return 0;
+#endif
+    
+    return RASR;
+}
+/* End Function:___RME_Pgtbl_MPU_Gen_Merge ***********************************/
+
+/* Begin Function:___RME_Pgtbl_MPU_Buddy **************************************
+Description : Find the buddy of a page directory. The buddy is the directory next
+              to it, so that the two of them together is naturally aligned to twice
+              the size of one. Buddies that have the same page flags can share one
+              MPU region. Because child directories are always mapped into the
+              top-level directly, the buddy, if exists, must be in the neighbouring
+              slot of the top-level.
+Input       : struct __RME_CMX_Pgtbl_Meta* Meta - The page directory.
+Output      : None.
+Return      : struct __RME_CMX_Pgtbl_Meta* - The buddy, or 0 if there is none.
+******************************************************************************/
+struct __RME_CMX_Pgtbl_Meta* ___RME_Pgtbl_MPU_Buddy(struct __RME_CMX_Pgtbl_Meta* Meta)
+{
+    ptr_t* Table;
+    ptr_t Pos;
+    struct __RME_CMX_Pgtbl_Meta* Top_Meta;
+    struct __RME_CMX_Pgtbl_Meta* Buddy;
+    
+    /* The top-level itself have no buddies */
+    if(Meta->Toplevel==0)
+        return 0;
+    
+    /* The two buddies must fill their top-level slots exactly */
+    Top_Meta=(struct __RME_CMX_Pgtbl_Meta*)(Meta->Toplevel);
+    if((RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order)+3)!=RME_CMX_PGTBL_SIZEORD(Top_Meta->Size_Num_Order))
+        return 0;
+    
+    /* Where are we in the top-level, and what is in the neighbouring slot */
+    Pos=(RME_CMX_PGTBL_START(Meta->Start_Addr)-RME_CMX_PGTBL_START(Top_Meta->Start_Addr))>>
+        RME_CMX_PGTBL_SIZEORD(Top_Meta->Size_Num_Order);
+    Table=RME_CMX_PGTBL_TBL_TOP((ptr_t*)Top_Meta);
+    if(((Table[Pos^1]&RME_CMX_PGTBL_PRESENT)==0)||((Table[Pos^1]&RME_CMX_PGTBL_TERMINAL)!=0))
+        return 0;
+    
+    /* It must look exactly like us */
+    Buddy=(struct __RME_CMX_Pgtbl_Meta*)RME_CMX_PGTBL_PGD_ADDR(Table[Pos^1]);
+    if((Buddy->Size_Num_Order!=Meta->Size_Num_Order)||(Buddy->Page_Flags!=Meta->Page_Flags))
+        return 0;
+    
+    return Buddy;
+}
+/* End Function:___RME_Pgtbl_MPU_Buddy ***************************************/
+
+/* Begin Function:___RME_Pgtbl_MPU_Refill *************************************
+Description : Record or remove a dynamic region in the refill table, which is
+              consulted by the MemManage handler before the generic fault handler.
+              When the table is full, the entries are replaced in turn; a region
+              that is not in the table is still refilled by the generic path.
+Input       : struct __RME_CMX_MPU_Data* Top_MPU - The top-level MPU metadata.
+              ptr_t Start_Addr - The start mapping address of the region.
+              ptr_t Size_Order - The size order of each subregion in the region.
+              ptr_t MPU_RASR - The RASR of the region, or 0 to remove it.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void ___RME_Pgtbl_MPU_Refill(struct __RME_CMX_MPU_Data* Top_MPU, 
+                             ptr_t Start_Addr, ptr_t Size_Order, ptr_t MPU_RASR)
+{
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    /* The MemManage handler only programs the ARMv7-M MPU, leave the table empty */
+#else
+    ptr_t Count;
+    ptr_t Slot;
+    
+    Slot=RME_CMX_MPU_REFILL;
+    for(Count=0;Count<RME_CMX_MPU_REFILL;Count++)
+    {
+        if(Top_MPU->Refill[Count].MPU_RASR==0)
+        {
+            if(Slot==RME_CMX_MPU_REFILL)
+                Slot=Count;
+        }
+        else if((Top_MPU->Refill[Count].MPU_RBAR==RME_CMX_MPU_ADDR(Start_Addr))&&
+                (RME_CMX_MPU_SZORD(Top_MPU->Refill[Count].MPU_RASR)==Size_Order))
+        {
+            /* Update or remove the existing entry */
+            Top_MPU->Refill[Count].MPU_RASR=MPU_RASR;
+            return;
+        }
+    }
+    
+    /* Nothing to remove */
+    if(MPU_RASR==0)
+        return;
+    
+    /* Take an empty entry, or replace one in turn */
+    if(Slot==RME_CMX_MPU_REFILL)
+    {
+        Slot=Top_MPU->Refill_Hand;
+        Top_MPU->Refill_Hand++;
+        if(Top_MPU->Refill_Hand>=RME_CMX_MPU_REFILL)
+            Top_MPU->Refill_Hand=0;
+    }
+    Top_MPU->Refill[Slot].MPU_RBAR=RME_CMX_MPU_ADDR(Start_Addr);
+    Top_MPU->Refill[Slot].MPU_RASR=MPU_RASR;
+#endif
+}
+/* End Function:___RME_Pgtbl_MPU_Refill **************************************/
+
 /* Begin Function:___RME_Pgtbl_MPU_Clear **************************************
 Description : Clear the MPU setting of this directory. If it exists, clear it;
               If it does not exist, don't do anything.
@@ -605,6 +990,9 @@ ptr_t ___RME_Pgtbl_MPU_Clear(struct __RME_CMX_MPU_Data* Top_MPU,
 {
     ptr_t Count;
     
+    /* The MemManage handler must not bring it back either */
+    ___RME_Pgtbl_MPU_Refill(Top_MPU, Start_Addr, Size_Order, 0);
+    
     for(Count=0;Count<RME_CMX_MPU_REGIONS;Count++)
     {
         if((Top_MPU->State&(((ptr_t)1)<<Count))!=0)
@@ -619,6 +1007,10 @@ ptr_t ___RME_Pgtbl_MPU_Clear(struct __RME_CMX_MPU_Data* Top_MPU,
                 Top_MPU->State&=~(((ptr_t)1)<<Count);
                 /* Maybe no need to clean the static flag */
                 Top_MPU->State&=~(((ptr_t)1)<<(Count+16));
+                Top_MPU->Ref&=~(((ptr_t)1)<<Count);
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+                ___RME_Pgtbl_MPU_V8_Sync(Top_MPU, Count);
+#endif
                 return 0;
             }
         }
@@ -628,9 +1020,57 @@ ptr_t ___RME_Pgtbl_MPU_Clear(struct __RME_CMX_MPU_Data* Top_MPU,
 }
 /* End Function:___RME_Pgtbl_MPU_Clear ***************************************/
 
+/* Begin Function:___RME_Pgtbl_MPU_Victim *************************************
+Description : Choose a dynamic MPU region to replace, with the CLOCK algorithm.
+              The hand sweeps the regions; a dynamic region that is referenced is
+              given a second chance and have its reference bit cleared, and the
+              first dynamic region that is not referenced is chosen. Static regions
+              are never chosen. A region is referenced when it is loaded or updated,
+              so a region that was just refilled will not be evicted by the next
+              refill, which stops two dynamic pages from kicking each other out.
+Input       : struct __RME_CMX_MPU_Data* Top_MPU - The top-level MPU metadata.
+              ptr_t Static_Flag - The flag denoting if the new entry is static. If
+                                  it is, region 0 cannot be chosen.
+Output      : None.
+Return      : ptr_t - The region chosen, or RME_CMX_MPU_REGIONS if no dynamic
+                      region can be replaced.
+******************************************************************************/
+ptr_t ___RME_Pgtbl_MPU_Victim(struct __RME_CMX_MPU_Data* Top_MPU, ptr_t Static_Flag)
+{
+    ptr_t Count;
+    ptr_t Victim;
+    
+    /* Two rounds are enough - the first round clears all the reference bits */
+    for(Count=0;Count<(RME_CMX_MPU_REGIONS<<1);Count++)
+    {
+        Victim=Top_MPU->Hand;
+        Top_MPU->Hand++;
+        if(Top_MPU->Hand>=RME_CMX_MPU_REGIONS)
+            Top_MPU->Hand=0;
+        
+        /* Static regions stay, and region 0 cannot take static pages */
+        if((Top_MPU->State&(((ptr_t)1)<<(Victim+16)))!=0)
+            continue;
+        if((Victim==0)&&(Static_Flag!=0))
+            continue;
+        /* Referenced since the hand last passed - give it a second chance */
+        if((Top_MPU->Ref&(((ptr_t)1)<<Victim))!=0)
+        {
+            Top_MPU->Ref&=~(((ptr_t)1)<<Victim);
+            continue;
+        }
+        
+        return Victim;
+    }
+    
+    return RME_CMX_MPU_REGIONS;
+}
+/* End Function:___RME_Pgtbl_MPU_Victim **************************************/
+
 /* Begin Function:___RME_Pgtbl_MPU_Add ****************************************
 Description : Add or update the MPU entry in the top-level MPU table. MPU region
-              0 is always reserved for dynamic pages.
+              0 is always reserved for dynamic pages. If there are no empty regions,
+              a dynamic region is replaced as chosen by ___RME_Pgtbl_MPU_Victim.
 Input       : struct __RME_CMX_MPU_Data* Top_MPU - The top-level MPU metadata
               ptr_t Start_Addr - The start mapping address of the directory.
               ptr_t Size_Order - The size order of each entry in the directory.
@@ -644,20 +1084,21 @@ ptr_t ___RME_Pgtbl_MPU_Add(struct __RME_CMX_MPU_Data* Top_MPU,
                            ptr_t MPU_RASR, ptr_t Static_Flag)
 {
     ptr_t Count;
-    /* The last empty slot */
-    ptr_t Last_Empty;
-    /* The last dynamic slot */
-    ptr_t Last_Dynamic;
-    
-    /* Set these values to some overrange value */
-    Last_Empty=RME_CMX_MPU_REGIONS;
-    Last_Dynamic=RME_CMX_MPU_REGIONS;
+    /* The slot that we will use */
+    ptr_t Slot;
+    
+    /* Dynamic regions can be refilled by the MemManage handler later if evicted */
+    if(Static_Flag!=0)
+        ___RME_Pgtbl_MPU_Refill(Top_MPU, Start_Addr, Size_Order, 0);
+    else
+        ___RME_Pgtbl_MPU_Refill(Top_MPU, Start_Addr, Size_Order, MPU_RASR);
+    
+    /* Set this value to some overrange value */
+    Slot=RME_CMX_MPU_REGIONS;
     for(Count=0;Count<RME_CMX_MPU_REGIONS;Count++)
     {
         if((Top_MPU->State&(((ptr_t)1)<<Count))!=0)
         {
-            if((Top_MPU->State&(((ptr_t)1)<<(Count+16)))==0)
-                Last_Dynamic=Count;
             /* We got one MPU region valid here */
             if((RME_CMX_MPU_ADDR(Top_MPU->Data[Count].MPU_RBAR)==Start_Addr)&&
                (RME_CMX_MPU_SZORD(Top_MPU->Data[Count].MPU_RASR)==Size_Order))
@@ -669,54 +1110,52 @@ ptr_t ___RME_Pgtbl_MPU_Add(struct __RME_CMX_MPU_Data* Top_MPU,
                     Top_MPU->State|=((ptr_t)1)<<(Count+16);
                 else
                     Top_MPU->State&=~(((ptr_t)1)<<(Count+16));
+                Top_MPU->Ref|=((ptr_t)1)<<Count;
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+                ___RME_Pgtbl_MPU_V8_Sync(Top_MPU, Count);
+#endif
                 return 0;
             }
         }
-        else
-            Last_Empty=Count;
+        /* Region 0 cannot take static pages */
+        else if((Slot==RME_CMX_MPU_REGIONS)&&((Count!=0)||(Static_Flag==0)))
+            Slot=Count;
     }
     
-    /* Update unsuccessful, we didn't find any match. We will need a new slot. 
-     * See if there are any new empty slots that we can use. 
-     * See if the last empty slot is 0. If yes, we can only map dynamic pages */
-    if((Last_Empty!=RME_CMX_MPU_REGIONS)&&((Last_Empty!=0)||(Static_Flag==0)))
+    /* Update unsuccessful, we didn't find any match, and there are no empty
+     * slots that we can use. We must replace a dynamic region */
+    if(Slot==RME_CMX_MPU_REGIONS)
     {
-        /* Put the data to this slot */
-        Top_MPU->State|=((ptr_t)1)<<(Last_Empty);
-        Top_MPU->Data[Last_Empty].MPU_RBAR=RME_CMX_MPU_ADDR(Start_Addr)|RME_CMX_MPU_VALID|Last_Empty;
-        Top_MPU->Data[Last_Empty].MPU_RASR=MPU_RASR;
-        /* Static or not is reflected in the state */
-        if(Static_Flag!=0)
-            Top_MPU->State|=((ptr_t)1)<<(Last_Empty+16);
-        else
-            Top_MPU->State&=~(((ptr_t)1)<<(Last_Empty+16));
-        
-        return 0;
+        Slot=___RME_Pgtbl_MPU_Victim(Top_MPU, Static_Flag);
+        /* All effort is futile. we report failure */
+        if(Slot==RME_CMX_MPU_REGIONS)
+            return RME_ERR_PGT_OPFAIL;
     }
     
-    /* No empty slots exist. We must replace a dynamic region */
-    if((Last_Dynamic!=RME_CMX_MPU_REGIONS)&&((Last_Dynamic!=0)||(Static_Flag==0)))
-    {
-        /* Put the data to this slot */
-        Top_MPU->State|=((ptr_t)1)<<(Last_Empty);
-        Top_MPU->Data[Last_Empty].MPU_RBAR=RME_CMX_MPU_ADDR(Start_Addr)|RME_CMX_MPU_VALID|Last_Empty;
-        Top_MPU->Data[Last_Empty].MPU_RASR=MPU_RASR;
-        /* Static or not is reflected in the state */
-        if(Static_Flag!=0)
-            Top_MPU->State|=((ptr_t)1)<<(Last_Empty+16);
-        else
-            Top_MPU->State&=~(((ptr_t)1)<<(Last_Empty+16));
-        
-        return 0;
-    }
+    /* Put the data to this slot */
+    Top_MPU->State|=((ptr_t)1)<<Slot;
+    Top_MPU->Data[Slot].MPU_RBAR=RME_CMX_MPU_ADDR(Start_Addr)|RME_CMX_MPU_VALID|Slot;
+    Top_MPU->Data[Slot].MPU_RASR=MPU_RASR;
+    /* Static or not is reflected in the state */
+    if(Static_Flag!=0)
+        Top_MPU->State|=((ptr_t)1)<<(Slot+16);
+    else
+        Top_MPU->State&=~(((ptr_t)1)<<(Slot+16));
+    Top_MPU->Ref|=((ptr_t)1)<<Slot;
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    ___RME_Pgtbl_MPU_V8_Sync(Top_MPU, Slot);
+#endif
     
-    /* All effort is futile. we report failure */
-    return RME_ERR_PGT_OPFAIL;
+    return 0;
 }
 /* End Function:___RME_Pgtbl_MPU_Add *****************************************/
 
 /* Begin Function:___RME_Pgtbl_MPU_Update *************************************
 Description : Update the top-level MPU metadata for this level of page table.
+              If the directory have a buddy, the two of them are represented
+              again together: with one region of twice the size if possible, or
+              with one region each if not. If the update fails, the MPU metadata
+              is left as it was.
 Input       : struct __RME_CMX_Pgtbl_Meta* Meta - This page table.
               ptr_t Op_Flag - The operation flag. 1 for add, 0 for clean.
 Output      : None.
@@ -726,7 +1165,13 @@ ptr_t ___RME_Pgtbl_MPU_Update(struct __RME_CMX_Pgtbl_Meta* Meta, ptr_t Op_Flag)
 {
     ptr_t* Table;
     ptr_t MPU_RASR;
+    ptr_t Start;
+    ptr_t Size_Order;
+    ptr_t Buddy_RASR;
+    ptr_t Merge_RASR;
     struct __RME_CMX_MPU_Data* Top_MPU;
+    struct __RME_CMX_MPU_Data Backup;
+    struct __RME_CMX_Pgtbl_Meta* Buddy;
     
     /* Is it possible for MPU to represent this? */
     if(RME_CMX_PGTBL_NUMORD(Meta->Size_Num_Order)!=3)
@@ -748,33 +1193,67 @@ ptr_t ___RME_Pgtbl_MPU_Update(struct __RME_CMX_Pgtbl_Meta* Meta, ptr_t Op_Flag)
     else
         return RME_ERR_PGT_OPFAIL;
     
+    Start=RME_CMX_PGTBL_START(Meta->Start_Addr);
+    Size_Order=RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order);
+    /* See if the RASR contains anything - if we are clearing, this contains nothing */
     if(Op_Flag==RME_CMX_MPU_CLR)
-    {
-        /* Clear the metadata - this function will never fail */
-        ___RME_Pgtbl_MPU_Clear(Top_MPU,
-                               RME_CMX_PGTBL_START(Meta->Start_Addr),
-                               RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order));
-    }
+        MPU_RASR=0;
     else
+        MPU_RASR=___RME_Pgtbl_MPU_Gen_RASR(Table, Meta->Page_Flags, Size_Order);
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    /* Base/limit regions have no subregions, so the pages must be contiguous */
+    if(___RME_Pgtbl_MPU_V8_Check(MPU_RASR)!=0)
+        return RME_ERR_PGT_OPFAIL;
+#endif
+    
+    Backup=*Top_MPU;
+    Buddy=___RME_Pgtbl_MPU_Buddy(Meta);
+    if(Buddy!=0)
     {
-        /* See if the RASR contains anything */
-        MPU_RASR=___RME_Pgtbl_MPU_Gen_RASR(Table, Meta->Page_Flags, 
-                                           RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order));
-        if(MPU_RASR==0)
+        Buddy_RASR=___RME_Pgtbl_MPU_Gen_RASR(RME_CMX_PGTBL_TBL_NOM((ptr_t*)Buddy),
+                                             Buddy->Page_Flags, Size_Order);
+        /* Remove whatever represents the two of them now - these will never fail */
+        ___RME_Pgtbl_MPU_Clear(Top_MPU, RME_ROUND_DOWN(Start,Size_Order+4), Size_Order+1);
+        ___RME_Pgtbl_MPU_Clear(Top_MPU, RME_CMX_PGTBL_START(Buddy->Start_Addr), Size_Order);
+        
+        /* Try to represent the two of them with one region */
+        if(Start<RME_CMX_PGTBL_START(Buddy->Start_Addr))
+            Merge_RASR=___RME_Pgtbl_MPU_Gen_Merge(MPU_RASR, Buddy_RASR, Size_Order);
+        else
+            Merge_RASR=___RME_Pgtbl_MPU_Gen_Merge(Buddy_RASR, MPU_RASR, Size_Order);
+        if(Merge_RASR!=0)
         {
-            /* All pages are unmapped. Clear this from the MPU data */
-            ___RME_Pgtbl_MPU_Clear(Top_MPU,
-                                   RME_CMX_PGTBL_START(Meta->Start_Addr),
-                                   RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order));
+            ___RME_Pgtbl_MPU_Clear(Top_MPU, Start, Size_Order);
+            if(___RME_Pgtbl_MPU_Add(Top_MPU, RME_ROUND_DOWN(Start,Size_Order+4), Size_Order+1,
+                                    Merge_RASR, Meta->Page_Flags&RME_PGTBL_STATIC)==0)
+                return 0;
         }
-        else
+        
+        /* Cannot merge. The buddy have a region of its own */
+        if(Buddy_RASR!=0)
         {
-            /* At least one of the pages are there. Map it */
-            if(___RME_Pgtbl_MPU_Add(Top_MPU,
-                                    RME_CMX_PGTBL_START(Meta->Start_Addr),
-                                    RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order),
-                                    MPU_RASR,Meta->Page_Flags&RME_PGTBL_STATIC)!=0)
+            if(___RME_Pgtbl_MPU_Add(Top_MPU, RME_CMX_PGTBL_START(Buddy->Start_Addr), Size_Order,
+                                    Buddy_RASR, Buddy->Page_Flags&RME_PGTBL_STATIC)!=0)
+            {
+                *Top_MPU=Backup;
                 return RME_ERR_PGT_OPFAIL;
+            }
+        }
+    }
+    
+    if(MPU_RASR==0)
+    {
+        /* All pages are unmapped. Clear this from the MPU data - this will never fail */
+        ___RME_Pgtbl_MPU_Clear(Top_MPU, Start, Size_Order);
+    }
+    else
+    {
+        /* At least one of the pages are there. Map it */
+        if(___RME_Pgtbl_MPU_Add(Top_MPU, Start, Size_Order,
+                                MPU_RASR, Meta->Page_Flags&RME_PGTBL_STATIC)!=0)
+        {
+            *Top_MPU=Backup;
+            return RME_ERR_PGT_OPFAIL;
         }
     }
     
@@ -782,6 +1261,81 @@ ptr_t ___RME_Pgtbl_MPU_Update(struct __RME_CMX_Pgtbl_Meta* Meta, ptr_t Op_Flag)
 }
 /* End Function:___RME_Pgtbl_MPU_Update **************************************/
 
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+/* Begin Function:___RME_Pgtbl_MPU_V8_Check ***********************************
+Description : Check if a region in ARMv7-M format can be represented by a single
+              ARMv8-M base/limit region, that is, its enabled subregions are
+              contiguous.
+Input       : ptr_t MPU_RASR - The RASR of the region. 0 means no region.
+Output      : None.
+Return      : ptr_t - If it can, 0; else RME_ERR_PGT_OPFAIL.
+******************************************************************************/
+ptr_t ___RME_Pgtbl_MPU_V8_Check(ptr_t MPU_RASR)
+{
+    ptr_t Present;
+    
+    if(MPU_RASR==0)
+        return 0;
+    
+    /* Shift the enabled subregions down to bit 0, then they must be all ones */
+    Present=((~MPU_RASR)>>8)&0xFF;
+    Present>>=__RME_MSB_Get(Present&(-Present));
+    if((Present&(Present+1))!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    return 0;
+}
+/* End Function:___RME_Pgtbl_MPU_V8_Check ************************************/
+
+/* Begin Function:___RME_Pgtbl_MPU_V8_Sync ************************************
+Description : Convert one region of the top-level MPU metadata to the ARMv8-M
+              base/limit format. The rest of the page table layer works on the
+              ARMv7-M format; the base is the first enabled subregion and the limit
+              is the end of the last one, which is exact because they are always
+              contiguous.
+Input       : struct __RME_CMX_MPU_Data* Top_MPU - The top-level MPU metadata.
+              ptr_t Slot - The region to convert.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void ___RME_Pgtbl_MPU_V8_Sync(struct __RME_CMX_MPU_Data* Top_MPU, ptr_t Slot)
+{
+    ptr_t RASR;
+    ptr_t Base;
+    ptr_t Present;
+    ptr_t Size_Order;
+    ptr_t RBAR;
+    
+    RASR=Top_MPU->Data[Slot].MPU_RASR;
+    if(((Top_MPU->State&(((ptr_t)1)<<Slot))==0)||(RASR==0))
+    {
+        Top_MPU->HW[Slot].MPU_RBAR=0;
+        Top_MPU->HW[Slot].MPU_RASR=0;
+        return;
+    }
+    
+    Present=((~RASR)>>8)&0xFF;
+    Base=RME_CMX_MPU_ADDR(Top_MPU->Data[Slot].MPU_RBAR);
+    Size_Order=RME_CMX_MPU_SZORD(RASR);
+    
+    /* Access permissions and execute never go to the RBAR */
+    RBAR=RME_CMX_MPU_ADDR(Base+(__RME_MSB_Get(Present&(-Present))<<Size_Order));
+    if((RASR&RME_CMX_MPU_RW)==RME_CMX_MPU_RW)
+        RBAR|=RME_CMX_MPU_V8_RW;
+    else
+        RBAR|=RME_CMX_MPU_V8_RO;
+    if((RASR&RME_CMX_MPU_XN)!=0)
+        RBAR|=RME_CMX_MPU_V8_XN;
+    Top_MPU->HW[Slot].MPU_RBAR=RBAR;
+    
+    /* The cacheable and bufferable bits select the attributes in MAIR0 */
+    Top_MPU->HW[Slot].MPU_RASR=RME_CMX_MPU_ADDR(Base+((__RME_MSB_Get(Present)+1)<<Size_Order)-1)|
+                               RME_CMX_MPU_V8_ATTRIDX((RASR&(RME_CMX_MPU_CACHEABLE|RME_CMX_MPU_BUFFERABLE))>>16)|
+                               RME_CMX_MPU_V8_EN;
+}
+/* End Function:___RME_Pgtbl_MPU_V8_Sync *************************************/
+#endif
+
 /* Begin Function:__RME_Pgtbl_Set *********************************************
 Description : Set the processor's page table.
 Input       : ptr_t Pgtbl - The virtual address of the page table.
@@ -791,12 +1345,28 @@ Return      : None.
 void __RME_Pgtbl_Set(ptr_t Pgtbl)
 {
     struct __RME_CMX_MPU_Data* MPU_Data;
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    ptr_t Count;
+#endif
     
     MPU_Data=(struct __RME_CMX_MPU_Data*)(Pgtbl+sizeof(struct __RME_CMX_Pgtbl_Meta));
     /* Get the physical address of the page table - here we do not need any conversion,
      * because VA = PA as always. We just need to extract the MPU metadata part
      * and pass it down */
+    RME_CMX_Cur_MPU=MPU_Data;
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+    /* The ARMv8-M MPU have no region number in the RBAR, so select each region */
+    for(Count=0;Count<RME_CMX_MPU_REGIONS;Count++)
+    {
+        MPU->RNR=Count;
+        MPU->RBAR=MPU_Data->HW[Count].MPU_RBAR;
+        MPU->RLAR=MPU_Data->HW[Count].MPU_RASR;
+    }
+    __DSB();
+    __ISB();
+#else
     ___RME_CMX_MPU_Set((ptr_t)(&(MPU_Data->Data[0].MPU_RBAR)));
+#endif
 }
 /* End Function:__RME_Pgtbl_Set **********************************************/
 
@@ -812,12 +1382,13 @@ void __RME_CMX_Fault_Handler(struct RME_Reg_Struct* Reg)
     ptr_t Cur_HFSR;
     ptr_t Cur_CFSR;
     ptr_t Cur_MMFAR;
+    ptr_t Fault_Addr;
     ptr_t Flags;
     struct RME_Proc_Struct* Proc;
     struct __RME_CMX_Pgtbl_Meta* Meta;
     
     /* Is it a kernel-level fault? If yes, panic */
-    RME_ASSERT((Reg->LR&RME_CMX_EXC_RET_RET_USER)!=0);
+    RME_ASSERT((RME_CMX_REG(Reg)->LR&RME_CMX_EXC_RET_RET_USER)!=0);
     
     /* Get the address of this faulty address, and what caused this fault */
     Cur_HFSR=SCB->HFSR;
@@ -837,28 +1408,41 @@ void __RME_CMX_Fault_Handler(struct RME_Reg_Struct* Reg)
         return;
     }
     
+    /* The MMFAR is only meaningful when MMARVALID is set. Otherwise, report the
+     * stacked PC, unless the fault happened when the frame itself was being stacked */
+    if((Cur_CFSR&RME_CMX_MFSR_MMARVALID)!=0)
+        Fault_Addr=Cur_MMFAR;
+    else if((Cur_CFSR&RME_CMX_FAULT_STACK)==0)
+        Fault_Addr=((ptr_t*)(RME_CMX_REG(Reg)->SP))[RME_CMX_STACK_PC];
+    else
+        Fault_Addr=0;
+    
     /* Can we cover from this? */
     if(((Cur_CFSR&RME_CMX_FAULT_FATAL)!=0)||((Cur_CFSR&RME_CMX_MFSR_MMARVALID)==0))
-        __RME_Thd_Fatal(Reg);
+        __RME_Thd_Fault(Reg, Cur_CFSR, Fault_Addr);
     else
     {
         /* See if the fault address can be found in our current page table, and
          * if it is there, we only care about the flags */
         __RME_Thd_Inv_Top_Proc(RME_Cur_Thd[RME_CPUID()], &Proc);
         if(__RME_Pgtbl_Walk(Proc->Pgtbl, Cur_MMFAR, (ptr_t*)(&Meta), 0, 0, 0, 0, &Flags)!=0)
-            __RME_Thd_Fatal(Reg);
+            __RME_Thd_Fault(Reg, Cur_CFSR, Cur_MMFAR);
         else
         {
             /* This fault involves instruction fetch, and that page would not allow this */
             if(((Cur_CFSR&RME_CMX_MFSR_IACCVIOL)!=0)&&((Flags&RME_PGTBL_EXECUTE)==0))
-                __RME_Thd_Fatal(Reg);
+                __RME_Thd_Fault(Reg, Cur_CFSR, Cur_MMFAR);
             else
             {
                 /* This must be a dynamic page. Or there must be something wrong in the kernel */
                 RME_ASSERT((Flags&RME_PGTBL_STATIC)==0);
-                /* Try to update the dynamic page */
+                /* Count the MPU refill faults of this address space */
+                RME_CMX_PGTBL_MPU(Proc->Pgtbl)->Fault_Cnt++;
+                /* Try to update the dynamic page, and load the new regions */
                 if(___RME_Pgtbl_MPU_Update(Meta, 1)!=0)
-                    __RME_Thd_Fatal(Reg);
+                    __RME_Thd_Fault(Reg, Cur_CFSR, Cur_MMFAR);
+                else
+                    __RME_Pgtbl_Set(RME_CAP_GETOBJ(Proc->Pgtbl,ptr_t));
             }
         }
     }
@@ -884,6 +1468,13 @@ void __RME_CMX_Generic_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num)
     RME_CMX_VECT_HOOK(Int_Num);
 #endif
     
+    /* If this source have its own endpoint, signal it directly and we are done */
+    if(RME_CMX_Int_Sig[Int_Num]!=0)
+    {
+        _RME_Kern_Snd(Reg, RME_CMX_Int_Sig[Int_Num]);
+        return;
+    }
+    
     /* Choose a data structure that is not locked at the moment */
     if(((struct __RME_CMX_Flags*)RME_CMX_INT_FLAG_ADDR)->Set0.Lock==0)
         Flags=&(((struct __RME_CMX_Flags*)RME_CMX_INT_FLAG_ADDR)->Set0);
@@ -897,6 +1488,31 @@ void __RME_CMX_Generic_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num)
 }
 /* End Function:__RME_CMX_Generic_Handler ************************************/
 
+/* Begin Function:__RME_CMX_Tick_Handler **************************************
+Description : The SysTick handler of RME for Cortex-M. The SysTick is set to stop
+              at the budget of the current thread if that runs out before the next
+              tick, so this decides which of the two it is.
+Input       : struct RME_Reg_Struct* Reg - The register set when entering the handler.
+Output      : struct RME_Reg_Struct* Reg - The register set when exiting the handler.
+Return      : None.
+******************************************************************************/
+void __RME_CMX_Tick_Handler(struct RME_Reg_Struct* Reg)
+{
+    /* The whole period that the SysTick was set to have passed */
+    if(RME_CMX_Tick_Left>RME_CMX_Tick_Load)
+    {
+        RME_CMX_Tick_Left-=RME_CMX_Tick_Load;
+        _RME_Budget_Handler(Reg);
+    }
+    else
+    {
+        /* The tick is due. If the period went past it, the next tick comes earlier */
+        RME_CMX_Tick_Left+=RME_CMX_SYSTICK_VAL-RME_CMX_Tick_Load;
+        _RME_Tick_Handler(Reg);
+    }
+}
+/* End Function:__RME_CMX_Tick_Handler ***************************************/
+
 /* Begin Function:__RME_Pgtbl_Kmem_Init ***************************************
 Description : Initialize the kernel mapping tables, so it can be added to all the
               top-level page tables. In STM32, we do not need to add such pages.
@@ -962,11 +1578,25 @@ ptr_t __RME_Pgtbl_Init(struct RME_Cap_Pgtbl* Pgtbl_Op)
     if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
     {
         ((struct __RME_CMX_MPU_Data*)Ptr)->State=0;
+        ((struct __RME_CMX_MPU_Data*)Ptr)->Hand=0;
+        ((struct __RME_CMX_MPU_Data*)Ptr)->Ref=0;
+        ((struct __RME_CMX_MPU_Data*)Ptr)->Fault_Cnt=0;
+        ((struct __RME_CMX_MPU_Data*)Ptr)->Refill_Hand=0;
         
-        for(Count=0;Count<8;Count++)
+        for(Count=0;Count<RME_CMX_MPU_REGIONS;Count++)
         {
             ((struct __RME_CMX_MPU_Data*)Ptr)->Data[Count].MPU_RBAR=RME_CMX_MPU_VALID|Count;
             ((struct __RME_CMX_MPU_Data*)Ptr)->Data[Count].MPU_RASR=0;
+#if(RME_CMX_MPU_TYPE==RME_CMX_MPU_V8M)
+            ((struct __RME_CMX_MPU_Data*)Ptr)->HW[Count].MPU_RBAR=0;
+            ((struct __RME_CMX_MPU_Data*)Ptr)->HW[Count].MPU_RASR=0;
+#endif
+        }
+        
+        for(Count=0;Count<RME_CMX_MPU_REFILL;Count++)
+        {
+            ((struct __RME_CMX_MPU_Data*)Ptr)->Refill[Count].MPU_RBAR=0;
+            ((struct __RME_CMX_MPU_Data*)Ptr)->Refill[Count].MPU_RASR=0;
         }
         
         Ptr+=sizeof(struct __RME_CMX_MPU_Data)/sizeof(ptr_t);
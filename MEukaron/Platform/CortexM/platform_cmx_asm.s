@@ -45,10 +45,6 @@ __heap_limit
 ;/* End Header ***************************************************************/
 
 ;/* Begin Exports ************************************************************/
-                ;Disable all interrupts
-                EXPORT          __RME_Disable_Int
-                ;Enable all interrupts            
-                EXPORT          __RME_Enable_Int
                 ;Wait until interrupts happen
                 EXPORT          __RME_CMX_WFI
                 ;Get the MSB in a word
@@ -338,11 +334,17 @@ __heap_limit
                 ;The system call handler of RME. This will be defined in C language.
                 IMPORT          _RME_Svc_Handler
                 ;The system tick handler of RME. This will be defined in C language.
-                IMPORT          _RME_Tick_Handler
+                IMPORT          __RME_CMX_Tick_Handler
+                ;The deferred rescheduling handler of RME. This will be defined in C language.
+                IMPORT          _RME_Resched_Handler
                 ;The memory management fault handler of RME. This will be defined in C language.
                 IMPORT          __RME_CMX_Fault_Handler
                 ;The generic interrupt handler for all other vectors.
                 IMPORT          __RME_CMX_Generic_Handler
+                ;The MPU metadata of the current address space.
+                IMPORT          RME_CMX_Cur_MPU
+                ;The register area of the current thread.
+                IMPORT          RME_CMX_Cur_Reg
 ;/* End Imports **************************************************************/
 
 ;/* Begin Vector Table *******************************************************/
@@ -660,6 +662,14 @@ Reset_Handler   PROC
                  LDR           R0, =__main
                  BX            R0
                  ENDP
+                 
+;/* The rest are the vectors' targets and the kernel entry and exit paths, which
+;   are placed in the fast memory if the scatter file says so. Reset_Handler is
+;   not among them because the fast memory is not initialized before __main */
+                AREA            RME_HOT_TEXT,CODE,READONLY,ALIGN=3
+                THUMB
+                REQUIRE8
+                PRESERVE8
                      
 Default_Handler  PROC
 
@@ -1190,50 +1200,26 @@ IRQ236_Handler
 IRQ237_Handler
 IRQ238_Handler
 IRQ239_Handler
-                PUSH      {LR}
-                PUSH      {R4-R11}         ; Spill all the general purpose registers; empty descending
-                MRS       R0,PSP
-                PUSH      {R0}
+                LDR       R0,=RME_CMX_Cur_Reg ; This is also the handle that the handler gets
+                LDR       R1,[R0]          ; Spill the registers to the current thread's area
+                MRS       R2,PSP
+                STMIA     R1,{R2,R4-R11,LR}
                 
-                MOV       R0,SP            ; Pass in the pt_regs parameter, and call the handler.
                 MRS       R1,xPSR          ; Pass in the interrupt number
                 UBFX      R1,R1,#0,#9      ; Extract the interrupt number bitfield
                 SUB       R1,#16           ; The IRQ0's starting number is 16. we subtract it here
                 BL        __RME_CMX_Generic_Handler
                 
-                POP       {R0}
-                MSR       PSP,R0
-                POP       {R4-R11}
-                POP       {PC}             ; Now we reset the PC.
+                LDR       R0,=RME_CMX_Cur_Reg ; Restore from wherever it points to now
+                LDR       R0,[R0]
+                LDR       R1,[R0],#4
+                MSR       PSP,R1
+                LDMIA     R0,{R4-R11,PC}   ; Now we reset the PC.
                 B         .                ; Capture faults
                 
                 ENDP
 ;/* End Handlers *************************************************************/
 
-;/* Begin Function:__RME_Disable_Int ******************************************
-;Description    : The function for disabling all interrupts.
-;Input          : None.
-;Output         : None.    
-;Register Usage : None.                                  
-;*****************************************************************************/    
-__RME_Disable_Int
-                ;Disable all interrupts (I is primask, F is faultmask.)
-                CPSID     I 
-                BX        LR                                                 
-;/* End Function:__RME_Disable_Int *******************************************/
-
-;/* Begin Function:__RME_Enable_Int *******************************************
-;Description    : The function for enabling all interrupts.
-;Input          : None.
-;Output         : None.    
-;Register Usage : None.                                  
-;*****************************************************************************/
-__RME_Enable_Int
-                ;Enable all interrupts.
-                CPSIE    I 
-                BX       LR
-;/* End Function:__RME_Enable_Int ********************************************/
-
 ;/* Begin Function:__RME_CMX_WFI **********************************************
 ;Description    : Wait until a new interrupt comes, to save power.
 ;Input          : None.
@@ -1296,18 +1282,18 @@ __RME_Enter_User_Mode
 ;Output      : None.
 ;*****************************************************************************/
 SysTick_Handler
-                PUSH      {LR}
-                PUSH      {R4-R11}         ; Spill all the general purpose registers; empty descending
-                MRS       R0,PSP
-                PUSH      {R0}
+                LDR       R0,=RME_CMX_Cur_Reg ; This is also the handle that the handler gets
+                LDR       R1,[R0]          ; Spill the registers to the current thread's area
+                MRS       R2,PSP
+                STMIA     R1,{R2,R4-R11,LR}
                 
-                MOV       R0,SP            ; Pass in the pt_regs parameter, and call the handler.
-                BL        _RME_Tick_Handler
+                BL        __RME_CMX_Tick_Handler
                 
-                POP       {R0}
-                MSR       PSP,R0
-                POP       {R4-R11}
-                POP       {PC}             ; Now we reset the PC.
+                LDR       R0,=RME_CMX_Cur_Reg ; Restore from wherever it points to now
+                LDR       R0,[R0]
+                LDR       R1,[R0],#4
+                MSR       PSP,R1
+                LDMIA     R0,{R4-R11,PC}   ; Now we reset the PC.
                 B         .                ; Capture faults
 ;/* End Function:SysTick_Handler *********************************************/
 
@@ -1318,21 +1304,43 @@ SysTick_Handler
 ;Output      : None.
 ;*****************************************************************************/
 SVC_Handler
-                PUSH      {LR}
-                PUSH      {R4-R11}         ; Spill all the general purpose registers; empty descending
-                MRS       R0,PSP
-                PUSH      {R0}
+                LDR       R0,=RME_CMX_Cur_Reg ; This is also the handle that the handler gets
+                LDR       R1,[R0]          ; Spill the registers to the current thread's area
+                MRS       R2,PSP
+                STMIA     R1,{R2,R4-R11,LR}
                 
-                MOV       R0,SP            ; Pass in the pt_regs parameter, and call the handler.
                 BL        _RME_Svc_Handler
                 
-                POP       {R0}
-                MSR       PSP,R0
-                POP       {R4-R11}
-                POP       {PC}             ; Now we reset the PC.
+                LDR       R0,=RME_CMX_Cur_Reg ; Restore from wherever it points to now
+                LDR       R0,[R0]
+                LDR       R1,[R0],#4
+                MSR       PSP,R1
+                LDMIA     R0,{R4-R11,PC}   ; Now we reset the PC.
                 B         .                ; Capture faults
 ;/* End Function:SVC_Handler *************************************************/
 
+;/* Begin Function:PendSV_Handler *********************************************
+;Description : The PendSV handler routine. This does the deferred rescheduling,
+;              after all the other kernel interrupts have been processed.
+;Input       : None.
+;Output      : None.
+;*****************************************************************************/
+PendSV_Handler
+                LDR       R0,=RME_CMX_Cur_Reg ; This is also the handle that the handler gets
+                LDR       R1,[R0]          ; Spill the registers to the current thread's area
+                MRS       R2,PSP
+                STMIA     R1,{R2,R4-R11,LR}
+                
+                BL        _RME_Resched_Handler
+                
+                LDR       R0,=RME_CMX_Cur_Reg ; Restore from wherever it points to now
+                LDR       R0,[R0]
+                LDR       R1,[R0],#4
+                MSR       PSP,R1
+                LDMIA     R0,{R4-R11,PC}   ; Now we reset the PC.
+                B         .                ; Capture faults
+;/* End Function:PendSV_Handler **********************************************/
+
 ;/* Begin Function:NMI/HardFault/MemManage/BusFault/UsageFault_Handler ********
 ;Description : The multi-purpose handler routine. This will in fact call
 ;              a C function to resolve the system service routines.             
@@ -1341,33 +1349,127 @@ SVC_Handler
 ;*****************************************************************************/
 NMI_Handler
                 NOP
-PendSV_Handler
-                NOP
 DebugMon_Handler
                 NOP
 HardFault_Handler
                 NOP
-                
-MemManage_Handler
-                NOP
 BusFault_Handler
                 NOP
 UsageFault_Handler
-                PUSH      {LR}
-                PUSH      {R4-R11}         ; Spill all the general purpose registers; empty descending
-                MRS       R0,PSP
-                PUSH      {R0}
+__RME_CMX_Fault_Slow
+                LDR       R0,=RME_CMX_Cur_Reg ; This is also the handle that the handler gets
+                LDR       R1,[R0]          ; Spill the registers to the current thread's area
+                MRS       R2,PSP
+                STMIA     R1,{R2,R4-R11,LR}
                 
-                MOV       R0,SP            ; Pass in the pt_regs parameter, and call the handler.
                 BL        __RME_CMX_Fault_Handler
                 
-                POP       {R0}
-                MSR       PSP,R0
-                POP       {R4-R11}
-                POP       {PC}             ; Now we reset the PC.
+                LDR       R0,=RME_CMX_Cur_Reg ; Restore from wherever it points to now
+                LDR       R0,[R0]
+                LDR       R1,[R0],#4
+                MSR       PSP,R1
+                LDMIA     R0,{R4-R11,PC}   ; Now we reset the PC.
                 B         .                ; Capture faults
 ;/* End Function:NMI/HardFault/MemManage/BusFault/UsageFault_Handler *********/
 
+;/* Begin Function:MemManage_Handler ******************************************
+;Description : The MemManage handler. A data access miss on a dynamic region that
+;              is in the refill table of the current address space is resolved
+;              here by loading that region into MPU region 0, without saving the
+;              context or walking the page table. Everything else, including a
+;              miss on a region that is already loaded (thus a true fault), goes
+;              to the generic fault handler. The offsets below must agree with
+;              struct __RME_CMX_MPU_Data.
+;Input       : None.
+;Output      : None.
+;*****************************************************************************/
+MPU_DATA_STATE  EQU       0
+MPU_DATA_REF    EQU       8
+MPU_DATA_FLTCNT EQU       12
+MPU_DATA_REFILL EQU       20
+MPU_DATA_DATA   EQU       84
+MemManage_Handler
+                TST       LR,#0x04                     ; Only faults from the threads can be refilled
+                BEQ       __RME_CMX_Fault_Slow
+                LDR       R0,=0xE000ED28               ; The MMFSR
+                LDRB      R1,[R0]
+                CMP       R1,#0x82                     ; A data access violation with MMFAR valid, and nothing else
+                BNE       __RME_CMX_Fault_Slow
+                
+                PUSH      {R4-R7}                      ; R0-R3 and R12 are already saved by hardware
+                LDR       R1,=0xE000ED34               ; The MMFAR
+                LDR       R1,[R1]
+                LDR       R2,=RME_CMX_Cur_MPU
+                LDR       R2,[R2]
+                ADD       R3,R2,#MPU_DATA_REFILL
+                MOV       R12,#8                       ; RME_CMX_MPU_REFILL
+MemManage_Search
+                LDR       R4,[R3]                      ; The region address
+                LDR       R5,[R3,#4]                   ; The region RASR
+                CBZ       R5,MemManage_Next
+                SUB       R6,R1,R4                     ; The offset into the region
+                UBFX      R7,R5,#1,#5                  ; The region size order is SIZE+1
+                ADD       R7,R7,#1
+                LSRS      R0,R6,R7
+                BNE       MemManage_Next               ; Not in this region
+                SUB       R7,R7,#3                     ; The subregion size order
+                LSR       R6,R6,R7
+                ADD       R6,R6,#8
+                LSR       R0,R5,R6
+                TST       R0,#1                        ; Is this subregion disabled?
+                BEQ       MemManage_Found
+MemManage_Next
+                ADD       R3,R3,#8
+                SUBS      R12,R12,#1
+                BNE       MemManage_Search
+                B         MemManage_Fault
+                
+MemManage_Found
+                ADD       R6,R2,#MPU_DATA_DATA         ; Is it loaded already?
+                MOV       R7,#8                        ; RME_CMX_MPU_REGIONS
+MemManage_Check
+                LDR       R0,[R6,#4]
+                CMP       R0,R5
+                BNE       MemManage_Check_Next
+                LDR       R0,[R6]
+                BIC       R0,R0,#0x1F
+                CMP       R0,R4
+                BEQ       MemManage_Fault              ; Yes, so this is a true fault
+MemManage_Check_Next
+                ADD       R6,R6,#8
+                SUBS      R7,R7,#1
+                BNE       MemManage_Check
+                
+                ORR       R4,R4,#0x10                  ; Region 0, and the RBAR is valid
+                STR       R4,[R2,#MPU_DATA_DATA]       ; Keep the metadata in sync with the MPU
+                STR       R5,[R2,#(MPU_DATA_DATA+4)]
+                LDR       R0,[R2,#MPU_DATA_STATE]      ; Region 0 is present and dynamic
+                ORR       R0,R0,#0x01
+                BIC       R0,R0,#0x10000
+                STR       R0,[R2,#MPU_DATA_STATE]
+                LDR       R0,[R2,#MPU_DATA_REF]        ; Region 0 is referenced
+                ORR       R0,R0,#0x01
+                STR       R0,[R2,#MPU_DATA_REF]
+                LDR       R0,[R2,#MPU_DATA_FLTCNT]     ; Count the refill fault
+                ADD       R0,R0,#1
+                STR       R0,[R2,#MPU_DATA_FLTCNT]
+                LDR       R0,=0xE000ED9C               ; The MPU RBAR and RASR
+                STR       R4,[R0]
+                STR       R5,[R0,#4]
+                LDR       R0,=0xE000ED28               ; Clear the MMFSR
+                MOV       R1,#0xFF
+                STRB      R1,[R0]
+                POP       {R4-R7}
+                DSB                                    ; Make sure that the MPU update completes
+                ISB
+                BX        LR
+                
+MemManage_Fault
+                POP       {R4-R7}
+                B         __RME_CMX_Fault_Slow
+                LTORG
+;/* End Function:MemManage_Handler *******************************************/
+
 ;/* Begin Function:___RME_CMX_Thd_Cop_Save ************************************
 ;Description : Save the coprocessor context on switch.         
 ;Input       : R0 - The pointer to the coprocessor struct.
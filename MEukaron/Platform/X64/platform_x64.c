@@ -20,6 +20,7 @@ Description : The hardware abstraction layer for Cortex-M microcontrollers.
 #define __HDR_STRUCTS__
 #include "Platform/X64/platform_x64.h"
 #include "Kernel/captbl.h"
+#include "Kernel/kernel.h"
 #include "Kernel/pgtbl.h"
 #include "Kernel/prcthd.h"
 #include "Kernel/siginv.h"
@@ -37,273 +38,220 @@ Description : The hardware abstraction layer for Cortex-M microcontrollers.
 #undef __HDR_PUBLIC_MEMBERS__
 /* End Includes **************************************************************/
 
-/* Begin Function:__RME_Comp_Swap *********************************************
-Description : The compare-and-swap atomic instruction. If the *Old value is equal to
-              *Ptr, then set the *Ptr as New and return 1; else set the *Old as *Ptr,
-              and return 0.
-              On Cortex-M there is only one core. There's basically no need to do
-              anything special, and we just disable interrupt for a very short time.
-Input       : ptr_t* Ptr - The pointer to the data.
-              ptr_t* Old - The old value.
-              ptr_t New - The new value.
-Output      : ptr_t* Ptr - The pointer to the data.
-              ptr_t* Old - The old value.
-Return      : ptr_t - If successful, 1; else 0.
-******************************************************************************/
-ptr_t __RME_Comp_Swap(ptr_t* Ptr, ptr_t* Old, ptr_t New)
+/* Begin Function:__RME_Putchar ***********************************************
+Description : Output a character to console. This never waits for the UART; the
+              kernel console buffer will try again later. This is only called by
+              the kernel console with its lock held.
+Input       : char Char - The character to print.
+Output      : None.
+Return      : ptr_t - If the character is sent, 0; if the UART is busy, 1.
+******************************************************************************/
+ptr_t __RME_Putchar(char Char)
 {
+    /* No serial port, just throw it away */
+    if(RME_X64_UART_Present==0)
+        return 0;
     
+    /* When the FIFO is empty, a whole FIFO of characters can go in without checking again */
+    if(RME_X64_UART_Room==0)
+    {
+        if((__RME_X64_In(RME_X64_COM1+RME_X64_UART_LSR)&RME_X64_UART_LSR_THRE)==0)
+            return 1;
+        RME_X64_UART_Room=RME_X64_UART_FIFO_SIZE;
+    }
+    
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_THR, Char);
+    RME_X64_UART_Room--;
     return 0;
 }
-/* End Function:__RME_Comp_Swap **********************************************/
-
-/* Begin Function:__RME_Fetch_Add *********************************************
-Description : The fetch-and-add atomic instruction. Increase the value that is 
-              pointed to by the pointer, and return the value before addition.
-              On Cortex-M there is only one core. There's basically no need to do
-              anything special, and we just disable interrupt for a very short time.
-Input       : ptr_t* Ptr - The pointer to the data.
-              cnt_t Addend - The number to add.
-Output      : ptr_t* Ptr - The pointer to the data.
-Return      : ptr_t - The value before the addition.
-******************************************************************************/
-ptr_t __RME_Fetch_Add(ptr_t* Ptr, cnt_t Addend)
+/* End Function:__RME_Putchar ************************************************/
+
+/* Begin Function:__RME_X64_UART_Init *****************************************
+Description : Initialize the serial port as the kernel console, with FIFO at 115200
+              baud. The transmit interrupt is enabled, so that the kernel console
+              is drained when the FIFO becomes empty.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_UART_Init(void)
 {
+    /* If status is 0xFF, no serial port */
+    if(__RME_X64_In(RME_X64_COM1+RME_X64_UART_LSR)==0xFF)
+    {
+        RME_X64_UART_Present=0;
+        return;
+    }
+    RME_X64_UART_Present=1;
+    RME_X64_UART_Room=0;
     
-    return 0;
+    /* 115200 baud, 8 data bits, 1 stop bit, parity off */
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_IER, 0);
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_LCR, RME_X64_UART_LCR_DLAB);
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_DLL, RME_X64_UART_DIVISOR&0xFF);
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_DLH, RME_X64_UART_DIVISOR>>8);
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_LCR, RME_X64_UART_LCR_8N1);
+    /* Turn on the FIFO */
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_FCR, RME_X64_UART_FCR_INIT);
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_MCR, RME_X64_UART_MCR_INIT);
+    __RME_X64_Out(RME_X64_COM1+RME_X64_UART_IER, RME_X64_UART_IER_THRE);
 }
-/* End Function:__RME_Fetch_Add **********************************************/
-
-/* Begin Function:__RME_Fetch_And *********************************************
-Description : The fetch-and-logic-and atomic instruction. Logic AND the pointer
-              value with the operand, and return the value before logic AND.
-              On Cortex-M there is only one core. There's basically no need to do
-              anything special.
-Input       : ptr_t* Ptr - The pointer to the data.
-              cnt_t Operand - The number to logic AND with the destination.
-Output      : ptr_t* Ptr - The pointer to the data.
-Return      : ptr_t - The value before the AND operation.
-******************************************************************************/
-ptr_t __RME_Fetch_And(ptr_t* Ptr, ptr_t Operand)
+/* End Function:__RME_X64_UART_Init ******************************************/
+
+/* Begin Function:__RME_X64_ACPI_Checksum *************************************
+Description : Sum up the bytes of an ACPI structure. A valid one sums up to 0.
+Input       : ptr_t Addr - The address of the structure.
+              ptr_t Len - The length of the structure.
+Output      : None.
+Return      : ptr_t - The sum, modulo 256.
+******************************************************************************/
+ptr_t __RME_X64_ACPI_Checksum(ptr_t Addr, ptr_t Len)
 {
+    ptr_t Count;
+    ptr_t Sum;
     
-    return 0;
+    Sum=0;
+    for(Count=0;Count<Len;Count++)
+        Sum+=((u8*)Addr)[Count];
+    
+    return Sum&0xFF;
 }
-/* End Function:__RME_Fetch_And **********************************************/
+/* End Function:__RME_X64_ACPI_Checksum **************************************/
 
-/* Begin Function:__RME_Putchar ***********************************************
-Description : Output a character to console. In Cortex-M, under most circumstances, 
-              we should use the ITM for such outputs.
-Input       : char Char - The character to print.
+/* Begin Function:__RME_X64_RDSP_Scan *****************************************
+Description : Look for the ACPI RDSP in a memory range. It is always aligned to 16.
+Input       : ptr_t Start - The start address of the range.
+              ptr_t Len - The length of the range.
 Output      : None.
-Return      : ptr_t - Always 0.
+Return      : struct __RME_X64_ACPI_RDSP* - The RDSP, or 0 if not found.
 ******************************************************************************/
-ptr_t __RME_Putchar(char Char)
+struct __RME_X64_ACPI_RDSP* __RME_X64_RDSP_Scan(ptr_t Start, ptr_t Len)
 {
-	volatile cnt_t Count;
-
-	if(RME_X64_UART_Present==0)
-		return 0;
-
-	/* Figure out what is this for */
-	for(Count=0;(Count<65535)&&((__RME_X64_In(RME_X64_COM1+5)&0x20)==0);Count++);
-
-	__RME_X64_Out(RME_X64_COM1, Char);
-
+    ptr_t Addr;
+    cnt_t Count;
+    
+    for(Addr=Start;Addr<Start+Len;Addr+=16)
+    {
+        for(Count=0;Count<8;Count++)
+        {
+            if(((u8*)Addr)[Count]!=RME_X64_ACPI_SIG_RDSP[Count])
+                break;
+        }
+        /* The checksum covers the ACPI 1.0 part only */
+        if((Count==8)&&(__RME_X64_ACPI_Checksum(Addr, 20)==0))
+            return (struct __RME_X64_ACPI_RDSP*)Addr;
+    }
+    
     return 0;
 }
-/* End Function:__RME_Putchar ************************************************/
+/* End Function:__RME_X64_RDSP_Scan ******************************************/
 
-void __RME_X64_UART_Init(void)
+/* Begin Function:__RME_X64_RDSP_Find *****************************************
+Description : Find the ACPI RDSP. It is either in the first 1kB of the EBDA, or in
+              the BIOS ROM area.
+Input       : None.
+Output      : None.
+Return      : struct __RME_X64_ACPI_RDSP* - The RDSP, or 0 if not found.
+******************************************************************************/
+struct __RME_X64_ACPI_RDSP* __RME_X64_RDSP_Find(void)
 {
-	// Turn off the FIFO
-	__RME_X64_Out(RME_X64_COM1+2, 0);
-
-	// 9600 baud, 8 data bits, 1 stop bit, parity off.
-	__RME_X64_Out(RME_X64_COM1+3, 0x80);    // Unlock divisor
-	__RME_X64_Out(RME_X64_COM1+0, 115200/9600);
-	__RME_X64_Out(RME_X64_COM1+1, 0);
-	__RME_X64_Out(RME_X64_COM1+3, 0x03);    // Lock divisor, 8 data bits.
-	__RME_X64_Out(RME_X64_COM1+4, 0);
-
-    // If status is 0xFF, no serial port.
-    if(__RME_X64_In(RME_X64_COM1+5)==0xFF)
-    	RME_X64_UART_Present=0;
-    else
-    	RME_X64_UART_Present=1;
+    struct __RME_X64_ACPI_RDSP* RDSP;
+    ptr_t EBDA;
+    
+    EBDA=((ptr_t)(*((u16*)RME_X64_ACPI_EBDA_PTR)))<<4;
+    if(EBDA!=0)
+    {
+        RDSP=__RME_X64_RDSP_Scan(EBDA, RME_X64_ACPI_EBDA_LEN);
+        if(RDSP!=0)
+            return RDSP;
+    }
+    
+    return __RME_X64_RDSP_Scan(RME_X64_ACPI_ROM_ADDR, RME_X64_ACPI_ROM_LEN);
 }
+/* End Function:__RME_X64_RDSP_Find ******************************************/
 
-// 5.2.5.3
-#define SIG_RDSP "RSD PTR "
-struct acpi_rdsp {
-  uchar signature[8];
-  uchar checksum;
-  uchar oem_id[6];
-  uchar revision;
-  uint32 rsdt_addr_phys;
-  uint32 length;
-  uint64 xsdt_addr_phys;
-  uchar xchecksum;
-  uchar reserved[3];
-} __attribute__((__packed__));
-
-// 5.2.6
-struct acpi_desc_header {
-  uchar signature[4];
-  uint32 length;
-  uchar revision;
-  uchar checksum;
-  uchar oem_id[6];
-  uchar oem_tableid[8];
-  uint32 oem_revision;
-  uchar creator_id[4];
-  uint32 creator_revision;
-} __attribute__((__packed__));
-
-// 5.2.7
-struct acpi_rsdt {
-  struct acpi_desc_header header;
-  uint32 entry[0];
-} __attribute__((__packed__));
-
-#define TYPE_LAPIC 0
-#define TYPE_IOAPIC 1
-#define TYPE_INT_SRC_OVERRIDE 2
-#define TYPE_NMI_INT_SRC 3
-#define TYPE_LAPIC_NMI 4
-
-// 5.2.12 Multiple APIC Description Table
-#define SIG_MADT "APIC"
-struct acpi_madt {
-  struct acpi_desc_header header;
-  uint32 lapic_addr_phys;
-  uint32 flags;
-  uchar table[0];
-} __attribute__((__packed__));
-
-// 5.2.12.2
-#define APIC_LAPIC_ENABLED 1
-struct madt_lapic {
-  uchar type;
-  uchar length;
-  uchar acpi_id;
-  uchar apic_id;
-  uint32 flags;
-} __attribute__((__packed__));
-
-// 5.2.12.3
-struct madt_ioapic {
-  uchar type;
-  uchar length;
-  uchar id;
-  uchar reserved;
-  uint32 addr;
-  uint32 interrupt_base;
-} __attribute__((__packed__));
-
-#if X64
-#define PHYSLIMIT 0x80000000
-#else
-#define PHYSLIMIT 0x0E000000
-#endif
-
-int acpiinit(void) {
-  unsigned n, count;
-  struct acpi_rdsp *rdsp;
-  struct acpi_rsdt *rsdt;
-  struct acpi_madt *madt = 0;
-
-  rdsp = find_rdsp();
-  if (rdsp->rsdt_addr_phys > PHYSLIMIT)
-    goto notmapped;
-  rsdt = p2v(rdsp->rsdt_addr_phys);
-  count = (rsdt->header.length - sizeof(*rsdt)) / 4;
-  for (n = 0; n < count; n++) {
-    struct acpi_desc_header *hdr = p2v(rsdt->entry[n]);
-    if (rsdt->entry[n] > PHYSLIMIT)
-      goto notmapped;
-#if DEBUG
-    uchar sig[5], id[7], tableid[9], creator[5];
-    memmove(sig, hdr->signature, 4); sig[4] = 0;
-    memmove(id, hdr->oem_id, 6); id[6] = 0;
-    memmove(tableid, hdr->oem_tableid, 8); tableid[8] = 0;
-    memmove(creator, hdr->creator_id, 4); creator[4] = 0;
-    cprintf("acpi: %s %s %s %x %s %x\n",
-      sig, id, tableid, hdr->oem_revision,
-      creator, hdr->creator_revision);
-#endif
-    if (!memcmp(hdr->signature, SIG_MADT, 4))
-      madt = (void*) hdr;
-  }
-
-  return acpi_config_smp(madt);
-
-notmapped:
-  cprintf("acpi: tables above 0x%x not mapped.\n", PHYSLIMIT);
-  return -1;
+/* Begin Function:__RME_X64_MADT_Parse ****************************************
+Description : Find the processors in the MADT, and record their local APIC IDs.
+Input       : struct __RME_X64_ACPI_MADT* MADT - The MADT.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_MADT_Parse(struct __RME_X64_ACPI_MADT* MADT)
+{
+    struct __RME_X64_MADT_LAPIC* LAPIC;
+    ptr_t Addr;
+    ptr_t End;
+    ptr_t Len;
+    
+    Addr=(ptr_t)(MADT->Table);
+    End=((ptr_t)MADT)+MADT->Header.Length;
+    
+    while(Addr+2<=End)
+    {
+        Len=((u8*)Addr)[1];
+        if((Len<2)||(Addr+Len>End))
+            break;
+        
+        if(((u8*)Addr)[0]==RME_X64_MADT_LAPIC)
+        {
+            LAPIC=(struct __RME_X64_MADT_LAPIC*)Addr;
+            if((Len>=sizeof(struct __RME_X64_MADT_LAPIC))&&((LAPIC->Flags&RME_X64_MADT_LAPIC_EN)!=0))
+            {
+                /* We can only use as many processors as the kernel is built for */
+                if(RME_X64_Num_CPU<RME_CPU_NUM)
+                {
+                    RME_X64_CPU_Local[RME_X64_Num_CPU].APIC_ID=LAPIC->APIC_ID;
+                    RME_X64_Num_CPU++;
+                }
+            }
+        }
+        
+        Addr+=Len;
+    }
 }
+/* End Function:__RME_X64_MADT_Parse *****************************************/
 
-static int acpi_config_smp(struct acpi_madt *madt) {
-  uint32 lapic_addr;
-  uint nioapic = 0;
-  uchar *p, *e;
-
-  if (!madt)
-    return -1;
-  if (madt->header.length < sizeof(struct acpi_madt))
-    return -1;
-
-  lapic_addr = madt->lapic_addr_phys;
-
-  p = madt->table;
-  e = p + madt->header.length - sizeof(struct acpi_madt);
-
-  while (p < e) {
-    uint len;
-    if ((e - p) < 2)
-      break;
-    len = p[1];
-    if ((e - p) < len)
-      break;
-    switch (p[0]) {
-    case TYPE_LAPIC: {
-      struct madt_lapic *lapic = (void*) p;
-      if (len < sizeof(*lapic))
-        break;
-      if (!(lapic->flags & APIC_LAPIC_ENABLED))
-        break;
-      cprintf("acpi: cpu#%d apicid %d\n", ncpu, lapic->apic_id);
-      cpus[ncpu].id = ncpu;
-      cpus[ncpu].apicid = lapic->apic_id;
-      ncpu++;
-      break;
-    }
-    case TYPE_IOAPIC: {
-      struct madt_ioapic *ioapic = (void*) p;
-      if (len < sizeof(*ioapic))
-        break;
-      cprintf("acpi: ioapic#%d @%x id=%d base=%d\n",
-        nioapic, ioapic->addr, ioapic->id, ioapic->interrupt_base);
-      if (nioapic) {
-        cprintf("warning: multiple ioapics are not supported");
-      } else {
-        ioapicid = ioapic->id;
-      }
-      nioapic++;
-      break;
-    }
+/* Begin Function:__RME_X64_ACPI_Init *****************************************
+Description : Find the processors of the system from ACPI. If there is no MADT, we
+              only have the boot processor.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_ACPI_Init(void)
+{
+    struct __RME_X64_ACPI_RDSP* RDSP;
+    struct __RME_X64_ACPI_RSDT* RSDT;
+    struct __RME_X64_ACPI_Desc_Hdr* Header;
+    struct __RME_X64_ACPI_MADT* MADT;
+    ptr_t Count;
+    ptr_t Num;
+    
+    RME_X64_Num_CPU=0;
+    
+    RDSP=__RME_X64_RDSP_Find();
+    RME_ASSERT(RDSP!=0);
+    RME_ASSERT(RME_X64_ACPI_MAPPED(RDSP->RSDT_Addr));
+    RSDT=(struct __RME_X64_ACPI_RSDT*)((ptr_t)(RDSP->RSDT_Addr));
+    
+    MADT=0;
+    Num=(RSDT->Header.Length-sizeof(struct __RME_X64_ACPI_Desc_Hdr))/sizeof(u32);
+    for(Count=0;Count<Num;Count++)
+    {
+        /* Tables that we cannot reach are skipped */
+        if(RME_X64_ACPI_MAPPED(RSDT->Entry[Count])==0)
+            continue;
+        Header=(struct __RME_X64_ACPI_Desc_Hdr*)((ptr_t)(RSDT->Entry[Count]));
+        if(*((u32*)(Header->Signature))==RME_X64_ACPI_SIG_MADT)
+            MADT=(struct __RME_X64_ACPI_MADT*)Header;
     }
-    p += len;
-  }
-
-  if (ncpu) {
-    ismp = 1;
-    lapic = IO2V(((uintp)lapic_addr));
-    return 0;
-  }
-
-  return -1;
+    
+    if(MADT!=0)
+        __RME_X64_MADT_Parse(MADT);
+    if(RME_X64_Num_CPU==0)
+        RME_X64_Num_CPU=1;
 }
+/* End Function:__RME_X64_ACPI_Init ******************************************/
 
 /* Begin Function:__RME_Low_Level_Init ****************************************
 Description : Initialize the low-level hardware. Currently this function works on
@@ -318,20 +266,40 @@ ptr_t __RME_Low_Level_Init(void)
 	__RME_X64_UART_Init();
 	/* Serial init seems to be good */
 	RME_Print_String("nice job here");
+	/* Set up the SYSCALL entry of the boot processor */
+	__RME_X64_SYSCALL_Init(0, RME_KMEM_STACK_ADDR);
+	/* Find out how much extended state we have, and how to save it */
+	__RME_X64_Xstate_Init();
 
 	/* Need some stuff to finish their */
 
-	/* Read APIC tables and see what's there, detect the configurations. Now we are not NUMA-aware. See what's the output? */
+	/* Read APIC tables and see what's there, detect the configurations */
+	__RME_X64_ACPI_Init();
+	/* Now we know how many kernel console buffers we need. They go right after the
+	 * kernel image, which is in the first 1GB that the boot page table maps */
+	RME_X64_Console=(struct RME_Console*)RME_ROUND_UP((ptr_t)end, RME_WORD_ORDER-3);
+	_RME_Console_Init(RME_X64_Console, RME_X64_Num_CPU);
 
 	/* Initialize the memory stuff, as the configuration shows */
 
 	/* Initialize all other non per-CPU data structures */
 
 	/* Initialize all vector tables */
+	__RME_X64_IDT_Init();
+	__RME_X64_TSS_Init(0);
 
 	/* Initialize PIC,LAPIC,IOAPIC - there's no uniprocessor systems anymore */
+	__RME_X64_Out(RME_X64_PIC1_DATA, 0xFF);
+	__RME_X64_Out(RME_X64_PIC2_DATA, 0xFF);
+	__RME_X64_LAPIC_Init(0);
+	__RME_X64_IOAPIC_Init();
+	/* The serial port transmit interrupt drains the kernel console */
+	__RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_HI(RME_X64_UART_PIN), RME_X64_CPU_Local[0].APIC_ID<<24);
+	__RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_LO(RME_X64_UART_PIN), RME_X64_UART_VECT);
 
 	/* Initialize the timer and start its interrupt routing */
+	__RME_X64_Timer_Calibrate();
+	__RME_X64_Timer_Init(0);
 
 	/* Send IPI, and then other processors follow up, by creating their own kernel objects
 	 * simutaneously so we boot up in parallel */
@@ -395,7 +363,8 @@ ptr_t __RME_Boot(void)
 //
 //    /* Create the initial kernel function capability, and kernel memory capability */
 //    RME_ASSERT(_RME_Kern_Boot_Crt(RME_X64_CPT, RME_BOOT_CAPTBL, RME_BOOT_INIT_KERN)==0);
-//    RME_ASSERT(_RME_Kmem_Boot_Crt(RME_X64_CPT, RME_BOOT_CAPTBL, RME_BOOT_INIT_KMEM)==0);
+//    RME_ASSERT(_RME_Kmem_Boot_Crt(RME_X64_CPT, RME_BOOT_CAPTBL, RME_BOOT_INIT_KMEM,
+//                                  RME_KMEM_VA_START, RME_KMEM_SIZE)==0);
 //
 //    /* Create the initial kernel endpoint for timer ticks */
 //    RME_Tick_Sig[0]=(struct RME_Sig_Struct*)Cur_Addr;
@@ -469,8 +438,523 @@ ptr_t __RME_CPUID_Get(void)
 }
 /* End Function:__RME_CPUID_Get **********************************************/
 
+/* Begin Function:__RME_Cycle_Get *********************************************
+Description : Get the processor cycle count, for the thread budget accounting.
+              We assume that the TSC is invariant and synchronized across cores.
+Input       : None.
+Output      : None.
+Return      : ptr_t - The TSC value.
+******************************************************************************/
+ptr_t __RME_Cycle_Get(void)
+{
+    return __RME_X64_RDTSC();
+}
+/* End Function:__RME_Cycle_Get **********************************************/
+
+/* Begin Function:__RME_X64_SYSCALL_Init **************************************
+Description : Set up the SYSCALL instruction entry of a processor. This sets the
+              kernel GS base to the per-CPU data, and programs the STAR, LSTAR and
+              FMASK MSRs. EFER.SCE is already set when we enter the long mode.
+Input       : ptr_t CPUID - The CPUID of the processor.
+              ptr_t Kern_Stack - The kernel stack of the processor.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_SYSCALL_Init(ptr_t CPUID, ptr_t Kern_Stack)
+{
+    RME_X64_CPU_Local[CPUID].Kern_Stack=Kern_Stack;
+    RME_X64_CPU_Local[CPUID].User_Stack=0;
+    RME_X64_CPU_Local[CPUID].CPUID=CPUID;
+    /* This will be swapped in by SWAPGS on the kernel entry */
+    __RME_X64_Write_MSR(RME_X64_MSR_KERNEL_GS_BASE, (ptr_t)(&RME_X64_CPU_Local[CPUID]));
+    /* SYSCALL loads the kernel segments, SYSRET loads the user segments */
+    __RME_X64_Write_MSR(RME_X64_MSR_STAR, (((ptr_t)RME_X64_SEG_USER_BASE)<<48)|
+                                          (((ptr_t)RME_X64_SEG_KERNEL_CODE)<<32));
+    __RME_X64_Write_MSR(RME_X64_MSR_LSTAR, (ptr_t)__RME_X64_SYSCALL_Entry);
+    /* Interrupts are disabled until we are on the kernel stack */
+    __RME_X64_Write_MSR(RME_X64_MSR_FMASK, RME_X64_SYSCALL_FMASK);
+}
+/* End Function:__RME_X64_SYSCALL_Init ***************************************/
+
+/* Begin Function:__RME_X64_IDT_Init ******************************************
+Description : Set up the interrupt descriptor table, and load it on the boot
+              processor. All vectors go to their entry stubs, which pass the vector
+              number and the error code to the handlers.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_IDT_Init(void)
+{
+    ptr_t Count;
+    ptr_t Entry;
+    
+    for(Count=0;Count<RME_X64_INT_NUM;Count++)
+    {
+        Entry=((ptr_t)__RME_X64_Int_Stubs)+(Count<<RME_X64_INT_STUB_ORDER);
+        RME_X64_IDT[Count<<1]=RME_X64_IDT_LO(Entry);
+        RME_X64_IDT[(Count<<1)+1]=RME_X64_IDT_HI(Entry);
+    }
+    
+    __RME_X64_LIDT((ptr_t)RME_X64_IDT, sizeof(RME_X64_IDT)-1);
+}
+/* End Function:__RME_X64_IDT_Init *******************************************/
+
+/* Begin Function:__RME_X64_TSS_Init ******************************************
+Description : Set up the task state segment of a processor, so that the interrupts
+              from the user mode switch to its kernel stack. The GDT have only one
+              TSS slot; we write ours there and load the task register, which keeps
+              its own copy of the descriptor.
+Input       : ptr_t CPUID - The CPUID of the processor.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_TSS_Init(ptr_t CPUID)
+{
+    ptr_t Base;
+    
+    _RME_Clear(&(RME_X64_CPU_Local[CPUID].TSS), sizeof(struct __RME_X64_TSS));
+    RME_X64_CPU_Local[CPUID].TSS.RSP0=RME_X64_CPU_Local[CPUID].Kern_Stack;
+    RME_X64_CPU_Local[CPUID].TSS.IO_Map_Base=sizeof(struct __RME_X64_TSS);
+    
+    Base=(ptr_t)(&(RME_X64_CPU_Local[CPUID].TSS));
+    __RME_X64_GDT_TSS[0]=RME_X64_GDT_TSS_LO(Base, sizeof(struct __RME_X64_TSS)-1);
+    __RME_X64_GDT_TSS[1]=RME_X64_GDT_TSS_HI(Base);
+    __RME_X64_LTR(RME_X64_SEG_TSS);
+}
+/* End Function:__RME_X64_TSS_Init *******************************************/
+
+/* Begin Function:__RME_X64_Xstate_Init ***************************************
+Description : Enable the XSAVE feature set on the boot processor, and decide the
+              state components that we manage, the size of the area needed and the
+              instruction to save them. The state components that the build allows
+              but the processor does not have are dropped here.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_Xstate_Init(void)
+{
+    ptr_t Buf[4];
+    
+    /* We need XSAVE - all 64-bit processors that have AVX have it */
+    __RME_X64_CPUID_Get(1, 0, Buf);
+    RME_ASSERT((Buf[2]&RME_X64_CPUID_1_XSAVE)!=0);
+    __RME_X64_Write_CR4(__RME_X64_Read_CR4()|RME_X64_CR4_OSFXSR|
+                        RME_X64_CR4_OSXMMEXCPT|RME_X64_CR4_OSXSAVE);
+    
+    /* What state components does the processor support? x87 and SSE are always there */
+    __RME_X64_CPUID_Get(0xD, 0, Buf);
+    RME_X64_Xstate_Mask=(((Buf[3]<<32)|Buf[0])&RME_X64_XSTATE_MASK)|
+                        RME_X64_XSTATE_X87|RME_X64_XSTATE_SSE;
+    ___RME_X64_XSETBV(RME_X64_Xstate_Mask);
+    RME_X64_CPU_Local[0].Xstate_Mask=RME_X64_Xstate_Mask;
+    
+    /* Prefer XSAVEOPT, then XSAVEC. Both skip the components that are in their initial
+     * state, and XSAVEOPT also skips the ones that are not modified since the last XRSTOR */
+    __RME_X64_CPUID_Get(0xD, 1, Buf);
+    if((Buf[0]&RME_X64_CPUID_D1_XSAVEOPT)!=0)
+        RME_X64_Xsave_Type=RME_X64_XSAVE_OPT;
+    else if((Buf[0]&RME_X64_CPUID_D1_XSAVEC)!=0)
+        RME_X64_Xsave_Type=RME_X64_XSAVE_CMP;
+    else
+        RME_X64_Xsave_Type=RME_X64_XSAVE_STD;
+    
+    /* The area size for what is enabled in XCR0 now */
+    if(RME_X64_Xsave_Type==RME_X64_XSAVE_CMP)
+        RME_X64_Xstate_Size=Buf[1];
+    else
+    {
+        __RME_X64_CPUID_Get(0xD, 0, Buf);
+        RME_X64_Xstate_Size=Buf[1];
+    }
+    /* The build-time area must be large enough */
+    RME_ASSERT(RME_X64_Xstate_Size<=RME_X64_XSTATE_SIZE);
+}
+/* End Function:__RME_X64_Xstate_Init ****************************************/
+
+/* Begin Function:__RME_X64_LAPIC_Read ****************************************
+Description : Read a local APIC register. In x2APIC mode this is a MSR read, and
+              in xAPIC mode this is a MMIO read.
+Input       : ptr_t Reg - The xAPIC offset of the register.
+Output      : None.
+Return      : ptr_t - The value of the register.
+******************************************************************************/
+ptr_t __RME_X64_LAPIC_Read(ptr_t Reg)
+{
+    if(RME_X64_LAPIC_Mode==RME_X64_LAPIC_X2APIC)
+        return __RME_X64_Read_MSR(RME_X64_MSR_X2APIC(Reg));
+    
+    return *((volatile u32*)(RME_X64_LAPIC_Addr+Reg));
+}
+/* End Function:__RME_X64_LAPIC_Read *****************************************/
+
+/* Begin Function:__RME_X64_LAPIC_Write ***************************************
+Description : Write a local APIC register. In x2APIC mode this is a MSR write, and
+              in xAPIC mode this is a MMIO write.
+Input       : ptr_t Reg - The xAPIC offset of the register.
+              ptr_t Val - The value to write.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_LAPIC_Write(ptr_t Reg, ptr_t Val)
+{
+    if(RME_X64_LAPIC_Mode==RME_X64_LAPIC_X2APIC)
+        __RME_X64_Write_MSR(RME_X64_MSR_X2APIC(Reg), Val);
+    else
+        *((volatile u32*)(RME_X64_LAPIC_Addr+Reg))=(u32)Val;
+}
+/* End Function:__RME_X64_LAPIC_Write ****************************************/
+
+/* Begin Function:__RME_X64_LAPIC_Init ****************************************
+Description : Initialize the local APIC of a processor. We use the x2APIC mode if the
+              processor have it, because then all register accesses are MSRs and
+              IPIs are a single ICR write. If not, we fall back to the xAPIC mode.
+Input       : ptr_t CPUID - The CPUID of the processor.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_LAPIC_Init(ptr_t CPUID)
+{
+    ptr_t Buf[4];
+    ptr_t Base;
+    
+    __RME_X64_CPUID_Get(1, 0, Buf);
+    Base=__RME_X64_Read_MSR(RME_X64_MSR_APIC_BASE);
+    
+    if((Buf[2]&RME_X64_CPUID_1_X2APIC)!=0)
+    {
+        RME_X64_LAPIC_Mode=RME_X64_LAPIC_X2APIC;
+        __RME_X64_Write_MSR(RME_X64_MSR_APIC_BASE, Base|RME_X64_APIC_BASE_EN|RME_X64_APIC_BASE_EXTD);
+        /* The x2APIC ID is the full 32-bit register */
+        RME_X64_CPU_Local[CPUID].APIC_ID=__RME_X64_LAPIC_Read(RME_X64_LAPIC_ID);
+    }
+    else
+    {
+        RME_X64_LAPIC_Mode=RME_X64_LAPIC_XAPIC;
+        __RME_X64_Write_MSR(RME_X64_MSR_APIC_BASE, Base|RME_X64_APIC_BASE_EN);
+        /* The boot page table maps the MMIO hole with VA=PA */
+        RME_X64_LAPIC_Addr=RME_X64_APIC_BASE_ADDR(Base);
+        RME_X64_CPU_Local[CPUID].APIC_ID=__RME_X64_LAPIC_Read(RME_X64_LAPIC_ID)>>24;
+    }
+    
+    /* Enable the APIC and set the spurious interrupt vector */
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_SVR, RME_X64_LAPIC_SVR_ENABLE|RME_X64_SPUR_VECT);
+    /* The timer is off until we set it up */
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_TIMER, RME_X64_LAPIC_LVT_MASKED|RME_X64_TIMER_VECT);
+    /* We do not use the local interrupt pins, all devices go through the IOAPIC or MSI */
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_LINT0, RME_X64_LAPIC_LVT_MASKED);
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_LINT1, RME_X64_LAPIC_LVT_MASKED);
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_ERROR, RME_X64_ERROR_VECT);
+    /* Clear the error status - this needs two writes in xAPIC mode */
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_ESR, 0);
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_ESR, 0);
+    /* Acknowledge anything that is outstanding, and accept all interrupts */
+    __RME_X64_LAPIC_EOI();
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_TPR, 0);
+}
+/* End Function:__RME_X64_LAPIC_Init *****************************************/
+
+/* Begin Function:__RME_X64_LAPIC_EOI *****************************************
+Description : Signal the end of interrupt to the local APIC.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_LAPIC_EOI(void)
+{
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_EOI, 0);
+}
+/* End Function:__RME_X64_LAPIC_EOI ******************************************/
+
+/* Begin Function:__RME_X64_LAPIC_IPI *****************************************
+Description : Send an interprocessor interrupt to a processor. In x2APIC mode this
+              is a single MSR write, and there is no delivery status to wait on.
+Input       : ptr_t CPUID - The CPUID of the processor to send to.
+              ptr_t Vect - The interrupt vector to send.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_LAPIC_IPI(ptr_t CPUID, ptr_t Vect)
+{
+    if(RME_X64_LAPIC_Mode==RME_X64_LAPIC_X2APIC)
+        __RME_X64_Write_MSR(RME_X64_MSR_X2APIC(RME_X64_LAPIC_ICRLO),
+                            (RME_X64_CPU_Local[CPUID].APIC_ID<<32)|Vect);
+    else
+    {
+        /* Wait for the last IPI to leave, then write the destination before the command */
+        while((__RME_X64_LAPIC_Read(RME_X64_LAPIC_ICRLO)&RME_X64_LAPIC_ICR_DELIVS)!=0);
+        __RME_X64_LAPIC_Write(RME_X64_LAPIC_ICRHI, RME_X64_CPU_Local[CPUID].APIC_ID<<24);
+        __RME_X64_LAPIC_Write(RME_X64_LAPIC_ICRLO, Vect);
+    }
+}
+/* End Function:__RME_X64_LAPIC_IPI ******************************************/
+
+/* Begin Function:__RME_X64_Timer_Calibrate ***********************************
+Description : Measure the TSC frequency and the APIC timer frequency against PIT
+              channel 2, and decide the timer mode. This is done once on the boot
+              processor. PIT is used because it is always there, even on emulators.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_Timer_Calibrate(void)
+{
+    ptr_t Buf[4];
+    ptr_t Gate;
+    ptr_t Count;
+    ptr_t TSC;
+    
+    /* Use the TSC-deadline mode if we have it */
+    __RME_X64_CPUID_Get(1, 0, Buf);
+    if((Buf[2]&RME_X64_CPUID_1_TSC_DEADLINE)!=0)
+        RME_X64_Timer_Mode=RME_X64_TIMER_DEADLINE;
+    else
+        RME_X64_Timer_Mode=RME_X64_TIMER_PERIODIC;
+    
+    /* Gate channel 2 on, with the speaker off, and load it in one-shot mode */
+    Count=RME_X64_PIT_FREQ*RME_X64_PIT_CAL_MS/1000;
+    Gate=__RME_X64_In(RME_X64_PIT_GATE);
+    __RME_X64_Out(RME_X64_PIT_GATE, (Gate&(~RME_X64_PIT_SPEAKER))|RME_X64_PIT_GATE_ON);
+    __RME_X64_Out(RME_X64_PIT_CMD, RME_X64_PIT_CH2_MODE0);
+    __RME_X64_Out(RME_X64_PIT_CH2, Count&0xFF);
+    __RME_X64_Out(RME_X64_PIT_CH2, Count>>8);
+    /* Let the APIC timer count down from the top at the same time */
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_TDCR, RME_X64_LAPIC_TDCR_DIV1);
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_TICR, 0xFFFFFFFF);
+    TSC=__RME_X64_RDTSC();
+    
+    /* Wait for the PIT output to go high */
+    while((__RME_X64_In(RME_X64_PIT_GATE)&RME_X64_PIT_OUT)==0);
+    
+    TSC=__RME_X64_RDTSC()-TSC;
+    Count=0xFFFFFFFF-__RME_X64_LAPIC_Read(RME_X64_LAPIC_TCCR);
+    __RME_X64_LAPIC_Write(RME_X64_LAPIC_TICR, 0);
+    __RME_X64_Out(RME_X64_PIT_GATE, Gate);
+    
+    RME_X64_Tick_TSC=TSC*(1000/RME_X64_PIT_CAL_MS)/RME_X64_TIMER_FREQ;
+    RME_X64_Tick_APIC=Count*(1000/RME_X64_PIT_CAL_MS)/RME_X64_TIMER_FREQ;
+}
+/* End Function:__RME_X64_Timer_Calibrate ************************************/
+
+/* Begin Function:__RME_X64_Timer_Init ****************************************
+Description : Start the local APIC timer of a processor. In TSC-deadline mode we
+              program the absolute TSC value of the next tick, so the ticks do not
+              drift and other cores do not need to agree on an APIC timer rate.
+Input       : ptr_t CPUID - The CPUID of the processor.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_Timer_Init(ptr_t CPUID)
+{
+    if(RME_X64_Timer_Mode==RME_X64_TIMER_DEADLINE)
+    {
+        __RME_X64_LAPIC_Write(RME_X64_LAPIC_TIMER, RME_X64_LAPIC_TIMER_DEADLINE|RME_X64_TIMER_VECT);
+        RME_X64_CPU_Local[CPUID].Deadline=__RME_X64_RDTSC()+RME_X64_Tick_TSC;
+        __RME_X64_Write_MSR(RME_X64_MSR_TSC_DEADLINE, RME_X64_CPU_Local[CPUID].Deadline);
+    }
+    else
+    {
+        __RME_X64_LAPIC_Write(RME_X64_LAPIC_TDCR, RME_X64_LAPIC_TDCR_DIV1);
+        __RME_X64_LAPIC_Write(RME_X64_LAPIC_TIMER, RME_X64_LAPIC_TIMER_PERIODIC|RME_X64_TIMER_VECT);
+        __RME_X64_LAPIC_Write(RME_X64_LAPIC_TICR, RME_X64_Tick_APIC);
+    }
+}
+/* End Function:__RME_X64_Timer_Init *****************************************/
+
+/* Begin Function:__RME_X64_Timer_Rearm ***************************************
+Description : Program the next tick on a processor. This is only needed in the
+              TSC-deadline mode, which is one-shot.
+Input       : ptr_t CPUID - The CPUID of the processor.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_Timer_Rearm(ptr_t CPUID)
+{
+    ptr_t Now;
+    
+    if(RME_X64_Timer_Mode!=RME_X64_TIMER_DEADLINE)
+        return;
+    
+    RME_X64_CPU_Local[CPUID].Deadline+=RME_X64_Tick_TSC;
+    /* If we are too late, skip the lost ticks rather than firing them all at once */
+    Now=__RME_X64_RDTSC();
+    if(RME_X64_CPU_Local[CPUID].Deadline<=Now)
+        RME_X64_CPU_Local[CPUID].Deadline=Now+RME_X64_Tick_TSC;
+    __RME_X64_Write_MSR(RME_X64_MSR_TSC_DEADLINE, RME_X64_CPU_Local[CPUID].Deadline);
+}
+/* End Function:__RME_X64_Timer_Rearm ****************************************/
+
+/* Begin Function:__RME_Budget_Set ********************************************
+Description : Set the timer of this processor to go off when the current thread
+              runs out of its budget, or at the next tick, whichever comes first.
+              This is only possible in the TSC-deadline mode; in the periodic mode
+              the budgets are only checked at the ticks.
+Input       : ptr_t Budget - The budget left for the current thread, in cycles.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_Budget_Set(ptr_t Budget)
+{
+    ptr_t Now;
+    ptr_t Deadline;
+    
+    if(RME_X64_Timer_Mode!=RME_X64_TIMER_DEADLINE)
+        return;
+    
+    Deadline=RME_X64_CPU_Local[RME_CPUID()].Deadline;
+    if(Budget<RME_THD_INF_TIME)
+    {
+        Now=__RME_X64_RDTSC();
+        if((Now+Budget)<Deadline)
+            Deadline=Now+Budget;
+    }
+    __RME_X64_Write_MSR(RME_X64_MSR_TSC_DEADLINE, Deadline);
+}
+/* End Function:__RME_Budget_Set *********************************************/
+
+/* Begin Function:__RME_X64_IOAPIC_Read ***************************************
+Description : Read an IOAPIC register.
+Input       : ptr_t Reg - The register number.
+Output      : None.
+Return      : ptr_t - The value of the register.
+******************************************************************************/
+ptr_t __RME_X64_IOAPIC_Read(ptr_t Reg)
+{
+    *((volatile u32*)(((ptr_t)RME_X64_IOAPIC_ADDR)+RME_X64_IOAPIC_REGSEL))=(u32)Reg;
+    return *((volatile u32*)(((ptr_t)RME_X64_IOAPIC_ADDR)+RME_X64_IOAPIC_WIN));
+}
+/* End Function:__RME_X64_IOAPIC_Read ****************************************/
+
+/* Begin Function:__RME_X64_IOAPIC_Write **************************************
+Description : Write an IOAPIC register.
+Input       : ptr_t Reg - The register number.
+              ptr_t Val - The value to write.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_IOAPIC_Write(ptr_t Reg, ptr_t Val)
+{
+    *((volatile u32*)(((ptr_t)RME_X64_IOAPIC_ADDR)+RME_X64_IOAPIC_REGSEL))=(u32)Reg;
+    *((volatile u32*)(((ptr_t)RME_X64_IOAPIC_ADDR)+RME_X64_IOAPIC_WIN))=(u32)Val;
+}
+/* End Function:__RME_X64_IOAPIC_Write ***************************************/
+
+/* Begin Function:__RME_X64_IOAPIC_Init ***************************************
+Description : Mask all IOAPIC pins. They are routed later by the user, one by one.
+Input       : None.
+Output      : None.
+Return      : None.
+******************************************************************************/
+void __RME_X64_IOAPIC_Init(void)
+{
+    cnt_t Count;
+    cnt_t Pins;
+    
+    Pins=((__RME_X64_IOAPIC_Read(RME_X64_IOAPIC_VER)>>16)&0xFF)+1;
+    for(Count=0;Count<Pins;Count++)
+    {
+        __RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_LO(Count), RME_X64_IOAPIC_MASKED);
+        __RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_HI(Count), 0);
+    }
+    
+    for(Count=0;Count<RME_X64_INT_NUM;Count++)
+    {
+        RME_X64_Int_Sig[Count]=0;
+        RME_X64_Int_Pin[Count]=RME_X64_NO_PIN;
+    }
+}
+/* End Function:__RME_X64_IOAPIC_Init ****************************************/
+
+/* Begin Function:__RME_X64_IOAPIC_Route **************************************
+Description : Route an IOAPIC pin to a vector on a processor. A level-triggered pin
+              is masked each time it fires, because we cannot clear the cause in the
+              kernel. The driver unmasks it by routing it again when it is done.
+Input       : ptr_t Pin - The IOAPIC pin.
+              ptr_t Vect - The vector to deliver.
+              ptr_t CPUID - The processor to deliver to.
+              ptr_t Flags - The trigger mode, polarity and mask of the pin.
+Output      : None.
+Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
+******************************************************************************/
+ptr_t __RME_X64_IOAPIC_Route(ptr_t Pin, ptr_t Vect, ptr_t CPUID, ptr_t Flags)
+{
+    if(Pin>((__RME_X64_IOAPIC_Read(RME_X64_IOAPIC_VER)>>16)&0xFF))
+        return RME_ERR_PGT_OPFAIL;
+    if((Vect<RME_X64_DEV_VECT_START)||(Vect>RME_X64_DEV_VECT_END))
+        return RME_ERR_PGT_OPFAIL;
+    if((CPUID>=RME_CPU_NUM)||((Flags&(~RME_X64_IOAPIC_FLAGS))!=0))
+        return RME_ERR_PGT_OPFAIL;
+    
+    if((Flags&RME_X64_IOAPIC_LEVEL)!=0)
+        RME_X64_Int_Pin[Vect]=Pin;
+    else
+        RME_X64_Int_Pin[Vect]=RME_X64_NO_PIN;
+    
+    /* Mask it before changing the destination, so it never goes half-programmed */
+    __RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_LO(Pin), RME_X64_IOAPIC_MASKED);
+    __RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_HI(Pin), RME_X64_CPU_Local[CPUID].APIC_ID<<24);
+    __RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_LO(Pin), Flags|Vect);
+    return 0;
+}
+/* End Function:__RME_X64_IOAPIC_Route ***************************************/
+
+/* Begin Function:__RME_X64_MSI_Route *****************************************
+Description : Program the MSI capability of a PCI function, so that it delivers a
+              vector on a processor, and enable it. Only one message is used.
+Input       : ptr_t BDF - The bus, device and function number of the PCI function.
+              ptr_t Cap - The offset of the MSI capability in its configuration space.
+              ptr_t CPUID - The processor to deliver to.
+              ptr_t Vect - The vector to deliver.
+Output      : None.
+Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
+******************************************************************************/
+ptr_t __RME_X64_MSI_Route(ptr_t BDF, ptr_t Cap, ptr_t CPUID, ptr_t Vect)
+{
+    ptr_t Header;
+    ptr_t Ctrl;
+    
+    if((BDF>0xFFFF)||(Cap>0xFC)||((Cap&0x03)!=0))
+        return RME_ERR_PGT_OPFAIL;
+    if((Vect<RME_X64_DEV_VECT_START)||(Vect>RME_X64_DEV_VECT_END)||(CPUID>=RME_CPU_NUM))
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* See if this is really a MSI capability */
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_ADDR, RME_X64_PCI_CONF(BDF, Cap));
+    Header=__RME_X64_In_Dword(RME_X64_PCI_CONF_DATA);
+    if((Header&0xFF)!=RME_X64_PCI_CAP_MSI)
+        return RME_ERR_PGT_OPFAIL;
+    Ctrl=(Header>>16)&(~(RME_X64_MSI_CTRL_EN|RME_X64_MSI_CTRL_MME));
+    
+    /* Disable it while we change the message */
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_ADDR, RME_X64_PCI_CONF(BDF, Cap));
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_DATA, (Ctrl<<16)|(Header&0xFFFF));
+    
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_ADDR, RME_X64_PCI_CONF(BDF, Cap+4));
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_DATA, RME_X64_MSI_ADDR(RME_X64_CPU_Local[CPUID].APIC_ID));
+    /* The data is the vector, with fixed delivery and edge trigger */
+    if((Ctrl&RME_X64_MSI_CTRL_64)!=0)
+    {
+        __RME_X64_Out_Dword(RME_X64_PCI_CONF_ADDR, RME_X64_PCI_CONF(BDF, Cap+8));
+        __RME_X64_Out_Dword(RME_X64_PCI_CONF_DATA, 0);
+        __RME_X64_Out_Dword(RME_X64_PCI_CONF_ADDR, RME_X64_PCI_CONF(BDF, Cap+12));
+    }
+    else
+        __RME_X64_Out_Dword(RME_X64_PCI_CONF_ADDR, RME_X64_PCI_CONF(BDF, Cap+8));
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_DATA, Vect);
+    
+    /* MSI is edge-triggered, there is no pin to mask */
+    RME_X64_Int_Pin[Vect]=RME_X64_NO_PIN;
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_ADDR, RME_X64_PCI_CONF(BDF, Cap));
+    __RME_X64_Out_Dword(RME_X64_PCI_CONF_DATA, ((Ctrl|RME_X64_MSI_CTRL_EN)<<16)|(Header&0xFFFF));
+    return 0;
+}
+/* End Function:__RME_X64_MSI_Route ******************************************/
+
 /* Begin Function:__RME_Get_Syscall_Param *************************************
-Description : Get the system call parameters from the stack frame.
+Description : Get the system call parameters from the stack frame. The SYSCALL
+              instruction uses RCX and R11 to hold RIP and RFLAGS, so the last
+              parameter is passed in R10 instead of RCX.
 Input       : struct RME_Reg_Struct* Reg - The register set.
 Output      : ptr_t* Svc - The system service number.
               ptr_t* Capid - The capability ID number.
@@ -483,11 +967,29 @@ ptr_t __RME_Get_Syscall_Param(struct RME_Reg_Struct* Reg, ptr_t* Svc, ptr_t* Cap
     *Capid=(Reg->RDI)&0xFFFFFFFF;
     Param[0]=Reg->RSI;
     Param[1]=Reg->RDX;
-    Param[2]=Reg->RCX;
+    Param[2]=Reg->R10;
     return 0;
 }
 /* End Function:__RME_Get_Syscall_Param **************************************/
 
+/* Begin Function:__RME_Get_Syscall_Ext_Param *********************************
+Description : Get the extra system call parameters from the stack frame. These
+              are only used by the compound system calls. R8 and R9 come first,
+              then R12 and R13 because R10 and R11 are already taken.
+Input       : struct RME_Reg_Struct* Reg - The register set.
+Output      : ptr_t* Ext_Param - The extra parameters.
+Return      : ptr_t - Always 0.
+******************************************************************************/
+ptr_t __RME_Get_Syscall_Ext_Param(struct RME_Reg_Struct* Reg, ptr_t* Ext_Param)
+{
+    Ext_Param[0]=Reg->R8;
+    Ext_Param[1]=Reg->R9;
+    Ext_Param[2]=Reg->R12;
+    Ext_Param[3]=Reg->R13;
+    return 0;
+}
+/* End Function:__RME_Get_Syscall_Ext_Param **********************************/
+
 /* Begin Function:__RME_Set_Syscall_Retval ************************************
 Description : Set the system call return value to the stack frame. This function 
               may carry up to 4 return values. If the last 3 is not needed, just set
@@ -537,7 +1039,12 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Thd_Reg_Init(ptr_t Entry, ptr_t Stack, struct RME_Reg_Struct* Reg)
 {
-
+    /* The thread will start in 64-bit user mode with interrupts enabled */
+    Reg->RIP=Entry;
+    Reg->CS=RME_X64_SEG_USER_CODE;
+    Reg->RFLAGS=0x200;
+    Reg->RSP=Stack;
+    Reg->SS=RME_X64_SEG_USER_DATA;
     return 0;
 }
 /* End Function:__RME_Thd_Reg_Init *******************************************/
@@ -576,7 +1083,6 @@ ptr_t __RME_Thd_Reg_Copy(struct RME_Reg_Struct* Dst, struct RME_Reg_Struct* Src)
     Dst->RSI=Src->RSI;
     Dst->RDI=Src->RDI;
     Dst->RBP=Src->RBP;
-    Dst->RSP=Src->RSP;
     Dst->R8=Src->R8;
     Dst->R9=Src->R9;
     Dst->R10=Src->R10;
@@ -585,11 +1091,30 @@ ptr_t __RME_Thd_Reg_Copy(struct RME_Reg_Struct* Dst, struct RME_Reg_Struct* Src)
     Dst->R13=Src->R13;
     Dst->R14=Src->R14;
     Dst->R15=Src->R15;
+    Dst->INT_NUM=Src->INT_NUM;
+    Dst->ERROR_CODE=Src->ERROR_CODE;
+    Dst->RIP=Src->RIP;
+    Dst->CS=Src->CS;
     Dst->RFLAGS=Src->RFLAGS;
+    Dst->RSP=Src->RSP;
+    Dst->SS=Src->SS;
     return 0;
 }
 /* End Function:__RME_Thd_Reg_Copy *******************************************/
 
+/* Begin Function:__RME_Thd_Reg_Swt *******************************************
+Description : Resume a saved register set. The entry paths build the register set
+              on the kernel stack, so we copy the saved one there.
+Input       : struct RME_Reg_Struct* Next_Reg - The register set to resume.
+Output      : struct RME_Reg_Struct* Reg - The live register set.
+Return      : ptr_t - Always 0.
+******************************************************************************/
+ptr_t __RME_Thd_Reg_Swt(struct RME_Reg_Struct* Reg, struct RME_Reg_Struct* Next_Reg)
+{
+    return __RME_Thd_Reg_Copy(Reg, Next_Reg);
+}
+/* End Function:__RME_Thd_Reg_Swt ********************************************/
+
 /* Begin Function:__RME_Thd_Cop_Init ******************************************
 Description : Initialize the coprocessor register set for the thread.
 Input       : ptr_t Entry - The thread entry address.
@@ -599,7 +1124,15 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Thd_Cop_Init(ptr_t Entry, ptr_t Stack, struct RME_Cop_Struct* Cop_Reg)
 {
-    /* Empty function, return immediately. The FPU contents is not predictable */
+    ptr_t Area;
+    
+    /* The thread can use all the state components by default. A zero XSAVE header
+     * means that all of them are in the initial state, so XRSTOR will initialize them */
+    Cop_Reg->Mask=RME_X64_Xstate_Mask;
+    Area=RME_X64_XSTATE_AREA(Cop_Reg);
+    _RME_Clear((void*)Area, RME_X64_XSTATE_LEGACY_SIZE);
+    /* MXCSR is always restored from the legacy region, give it the default value */
+    *((u32*)(Area+RME_X64_XSTATE_MXCSR))=RME_X64_MXCSR_DEFAULT;
     return 0;
 }
 /* End Function:__RME_Thd_Cop_Reg_Init ***************************************/
@@ -614,7 +1147,14 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Thd_Cop_Save(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg)
 {
-    /* If we do not have a FPU, return 0 directly */
+    /* Only the components that this thread uses are saved. XSAVEOPT and XSAVEC
+     * skip the ones that are still in their initial state */
+    if(RME_X64_Xsave_Type==RME_X64_XSAVE_OPT)
+        ___RME_X64_XSAVEOPT(RME_X64_XSTATE_AREA(Cop_Reg), Cop_Reg->Mask);
+    else if(RME_X64_Xsave_Type==RME_X64_XSAVE_CMP)
+        ___RME_X64_XSAVEC(RME_X64_XSTATE_AREA(Cop_Reg), Cop_Reg->Mask);
+    else
+        ___RME_X64_XSAVE(RME_X64_XSTATE_AREA(Cop_Reg), Cop_Reg->Mask);
 
     return 0;
 }
@@ -629,8 +1169,19 @@ Output      : s struct RME_Cop_Struct* Cop_Reg - The pointer to the coprocessor
 Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Thd_Cop_Restore(struct RME_Reg_Struct* Reg, struct RME_Cop_Struct* Cop_Reg)
-{    
-/* If we do not have a FPU, return 0 directly */
+{
+    ptr_t CPUID;
+    
+    /* Threads that do not use the wide vector units run with them disabled in XCR0,
+     * so they fault instead of silently corrupting the state. Only write XCR0 when
+     * it really changes, because that is slow */
+    CPUID=RME_CPUID();
+    if(RME_X64_CPU_Local[CPUID].Xstate_Mask!=Cop_Reg->Mask)
+    {
+        ___RME_X64_XSETBV(Cop_Reg->Mask);
+        RME_X64_CPU_Local[CPUID].Xstate_Mask=Cop_Reg->Mask;
+    }
+    ___RME_X64_XRSTOR(RME_X64_XSTATE_AREA(Cop_Reg), Cop_Reg->Mask);
 
     return 0;
 }
@@ -657,23 +1208,103 @@ Return      : ptr_t - Always 0.
 ******************************************************************************/
 ptr_t __RME_Inv_Cop_Init(ptr_t Param, struct RME_Cop_Struct* Cop_Reg)
 {
-    /* Empty function */
-    return 0;
+    /* The invocation starts with a clean extended state, just like a new thread */
+    return __RME_Thd_Cop_Init(0, 0, Cop_Reg);
 }
 /* End Function:__RME_Inv_Cop_Init *******************************************/
 
 /* Begin Function:__RME_Kern_Func_Handler *************************************
-Description : Initialize the coprocessor register set for the invocation.
-Input       : struct RME_Reg_Struct* Reg - The current register set.
+Description : Handle kernel function calls.
+Input       : struct RME_Cap_Captbl* Captbl - The master capability table.
+              struct RME_Reg_Struct* Reg - The current register set.
               ptr_t Func_ID - The function ID.
               ptr_t Param1 - The first parameter.
               ptr_t Param2 - The second parameter.
 Output      : None.
 Return      : ptr_t - The value that the function returned.
 ******************************************************************************/
-ptr_t __RME_Kern_Func_Handler(struct RME_Reg_Struct* Reg, ptr_t Func_ID,
-                              ptr_t Param1, ptr_t Param2)
+ptr_t __RME_Kern_Func_Handler(struct RME_Cap_Captbl* Captbl, struct RME_Reg_Struct* Reg,
+                              ptr_t Func_ID, ptr_t Param1, ptr_t Param2)
 {
+    struct RME_Cap_Thd* Thd_Op;
+    struct RME_Thd_Struct* Thd_Struct;
+    struct RME_Cap_Sig* Sig_Op;
+    struct RME_Sig_Struct* Sig_Struct;
+    
+    if(Func_ID==RME_X64_KERN_XSTATE)
+    {
+        /* Set the state components that a thread is allowed to use. Param1 is the
+         * thread capability, and Param2 is the mask of the components. x87 state is
+         * always there because XRSTOR needs at least something to restore */
+        RME_CAPTBL_GETCAP(Captbl,(cid_t)Param1,RME_CAP_THD,struct RME_Cap_Thd*,Thd_Op);
+        RME_CAP_CHECK(Thd_Op,RME_THD_FLAG_EXEC_SET);
+        Thd_Struct=RME_CAP_GETOBJ(Thd_Op,struct RME_Thd_Struct*);
+        Param2=(Param2&RME_X64_Xstate_Mask)|RME_X64_XSTATE_X87;
+        /* XCR0 only allows AVX together with SSE, and the AVX-512 components all together with AVX */
+        if(((Param2&RME_X64_XSTATE_AVX)!=0)&&((Param2&RME_X64_XSTATE_SSE)==0))
+            return RME_ERR_PGT_OPFAIL;
+        if((Param2&(RME_X64_XSTATE_OPMASK|RME_X64_XSTATE_ZMM_HI256|RME_X64_XSTATE_HI16_ZMM))!=0)
+        {
+            if((Param2&(RME_X64_XSTATE_AVX|RME_X64_XSTATE_OPMASK|RME_X64_XSTATE_ZMM_HI256|
+                        RME_X64_XSTATE_HI16_ZMM))!=(RME_X64_XSTATE_AVX|RME_X64_XSTATE_OPMASK|
+                                                    RME_X64_XSTATE_ZMM_HI256|RME_X64_XSTATE_HI16_ZMM))
+                return RME_ERR_PGT_OPFAIL;
+        }
+        /* The new mask takes effect when the thread is switched to next time. If it
+         * is the current thread, its state is already saved with the new mask when
+         * it is switched out, so the components dropped are lost right away - that
+         * is what the user asked for */
+        Thd_Struct->Cur_Reg->Cop_Reg.Mask=Param2;
+        __RME_Set_Syscall_Retval(Reg,0);
+        return 0;
+    }
+    else if(Func_ID==RME_X64_KERN_INT_BIND)
+    {
+        if((Param1<RME_X64_DEV_VECT_START)||(Param1>RME_X64_DEV_VECT_END))
+            return RME_ERR_PGT_OPFAIL;
+        /* Bind this vector to its own endpoint. The endpoint becomes a kernel endpoint
+         * and cannot be deleted until unbound */
+        RME_CAPTBL_GETCAP(Captbl,(cid_t)Param2,RME_CAP_SIG,struct RME_Cap_Sig*,Sig_Op);
+        RME_CAP_CHECK(Sig_Op,RME_SIG_FLAG_SND);
+        Sig_Struct=RME_CAP_GETOBJ(Sig_Op,struct RME_Sig_Struct*);
+        __RME_Fetch_Add(&(Sig_Struct->Kernel_Flag),1);
+        if(RME_X64_Int_Sig[Param1]!=0)
+            __RME_Fetch_Add(&(RME_X64_Int_Sig[Param1]->Kernel_Flag),-1);
+        RME_X64_Int_Sig[Param1]=Sig_Struct;
+        __RME_Set_Syscall_Retval(Reg,0);
+        return 0;
+    }
+    else if(Func_ID==RME_X64_KERN_INT_UNBIND)
+    {
+        /* Send this vector back to the default interrupt endpoint of the processor */
+        if((Param1<RME_X64_DEV_VECT_START)||(Param1>RME_X64_DEV_VECT_END))
+            return RME_ERR_PGT_OPFAIL;
+        if(RME_X64_Int_Sig[Param1]==0)
+            return RME_ERR_PGT_OPFAIL;
+        Sig_Struct=RME_X64_Int_Sig[Param1];
+        RME_X64_Int_Sig[Param1]=0;
+        __RME_Fetch_Add(&(Sig_Struct->Kernel_Flag),-1);
+        __RME_Set_Syscall_Retval(Reg,0);
+        return 0;
+    }
+    else if(Func_ID==RME_X64_KERN_IOAPIC)
+    {
+        if(__RME_X64_IOAPIC_Route(RME_PARAM_D1(Param1),RME_PARAM_D0(Param1),
+                                  RME_PARAM_D1(Param2),RME_PARAM_D0(Param2))!=0)
+            return RME_ERR_PGT_OPFAIL;
+        __RME_Set_Syscall_Retval(Reg,0);
+        return 0;
+    }
+    else if(Func_ID==RME_X64_KERN_MSI)
+    {
+        if(__RME_X64_MSI_Route(RME_PARAM_D1(Param1),RME_PARAM_D0(Param1),
+                               RME_PARAM_D1(Param2),RME_PARAM_D0(Param2))!=0)
+            return RME_ERR_PGT_OPFAIL;
+        __RME_Set_Syscall_Retval(Reg,0);
+        return 0;
+    }
+    
+    /* If it gets here, we must have failed */
     return RME_ERR_PGT_OPFAIL;
 }
 /* End Function:__RME_Kern_Func_Handler **************************************/
@@ -686,20 +1317,46 @@ Return      : None.
 ******************************************************************************/
 void __RME_Pgtbl_Set(ptr_t Pgtbl)
 {
-
+    __RME_X64_Write_CR3(RME_X64_VA2PA(Pgtbl));
 }
 /* End Function:__RME_Pgtbl_Set **********************************************/
 
 /* Begin Function:__RME_X64_Fault_Handler *************************************
 Description : The fault handler of RME. In x64, this is used to handle multiple
-              faults.
+              faults. Page faults on not-present pages in the demand paging range
+              are tagged as pager faults, so that the fault handler of the process
+              can map the page and resume the thread, which will then retry the
+              access. All other faults are delivered to the fault handler as they
+              are.
 Input       : struct RME_Reg_Struct* Reg - The register set when entering the handler.
+              ptr_t Int_Num - The exception vector number.
+              ptr_t Err_Code - The error code pushed by the processor, or 0 if the
+                               exception does not have one.
 Output      : struct RME_Reg_Struct* Reg - The register set when exiting the handler.
 Return      : None.
 ******************************************************************************/
-void __RME_X64_Fault_Handler(struct RME_Reg_Struct* Reg)
+void __RME_X64_Fault_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num, ptr_t Err_Code)
 {
-
+    ptr_t Addr;
+    ptr_t Reason;
+    
+    /* Faults in the kernel are not recoverable */
+    RME_ASSERT(Reg->CS==RME_X64_SEG_USER_CODE);
+    
+    Reason=RME_X64_FAULT_REASON(Int_Num,Err_Code);
+    if(Int_Num==RME_X64_FAULT_PF)
+    {
+        /* CR2 must be read before anything else can fault */
+        Addr=__RME_X64_Read_CR2();
+        /* The page is not there, and it is in the range that the pager maintains */
+        if(((Err_Code&(RME_X64_PF_P|RME_X64_PF_RSVD))==0)&&
+           (Addr>=RME_X64_PAGER_VA_START)&&(Addr<(RME_X64_PAGER_VA_START+RME_X64_PAGER_SIZE)))
+            Reason|=RME_X64_FAULT_PAGER;
+    }
+    else
+        Addr=Reg->RIP;
+    
+    __RME_Thd_Fault(Reg, Reason, Addr);
 }
 /* End Function:__RME_X64_Fault_Handler **************************************/
 
@@ -712,6 +1369,58 @@ Return      : None.
 ******************************************************************************/
 void __RME_X64_Generic_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num)
 {
+    /* The spurious interrupt needs no EOI */
+    if(Int_Num==RME_X64_SPUR_VECT)
+        return;
+    
+    /* The local sources can be acknowledged right away */
+    if(Int_Num==RME_X64_TIMER_VECT)
+    {
+        __RME_X64_LAPIC_EOI();
+        /* In the TSC-deadline mode, the timer may have stopped at the budget of the
+         * current thread rather than at the tick */
+        if((RME_X64_Timer_Mode==RME_X64_TIMER_DEADLINE)&&
+           (__RME_X64_RDTSC()<RME_X64_CPU_Local[RME_CPUID()].Deadline))
+        {
+            _RME_Budget_Handler(Reg);
+            return;
+        }
+        __RME_X64_Timer_Rearm(RME_CPUID());
+        _RME_Tick_Handler(Reg);
+        return;
+    }
+    /* The IPI only wakes up this processor. Whatever the sender wanted is already in memory */
+    if(Int_Num==RME_X64_IPI_VECT)
+    {
+        __RME_X64_LAPIC_EOI();
+        return;
+    }
+    /* The UART FIFO is empty - reading IIR acknowledges this, then send out more */
+    if(Int_Num==RME_X64_UART_VECT)
+    {
+        __RME_X64_LAPIC_EOI();
+        __RME_X64_In(RME_X64_COM1+RME_X64_UART_IIR);
+        _RME_Console_Flush();
+        return;
+    }
+    
+    /* A level-triggered pin will fire again after the EOI, until the driver clears the
+     * cause. Mask it before the EOI, or the IOAPIC delivers it once more right away */
+    if(RME_X64_Int_Pin[Int_Num]!=RME_X64_NO_PIN)
+    {
+        __RME_X64_IOAPIC_Write(RME_X64_IOAPIC_REDIR_LO(RME_X64_Int_Pin[Int_Num]),
+                               __RME_X64_IOAPIC_Read(RME_X64_IOAPIC_REDIR_LO(RME_X64_Int_Pin[Int_Num]))|
+                               RME_X64_IOAPIC_MASKED);
+    }
+    __RME_X64_LAPIC_EOI();
+    
+    /* Signal the endpoint bound to this vector, or the default one of this processor */
+    if(RME_X64_Int_Sig[Int_Num]!=0)
+    {
+        _RME_Kern_Snd(Reg, RME_X64_Int_Sig[Int_Num]);
+        return;
+    }
+    
 //    struct __RME_CMX_Flag_Set* Flags;
 //
 //#ifdef RME_CMX_VECT_HOOK
@@ -729,26 +1438,103 @@ void __RME_X64_Generic_Handler(struct RME_Reg_Struct* Reg, ptr_t Int_Num)
 //    Flags->Group|=(((ptr_t)1)<<(Int_Num>>RME_WORD_ORDER));
 //    Flags->Flags[Int_Num>>RME_WORD_ORDER]|=(((ptr_t)1)<<(Int_Num&RME_MASK_END(RME_WORD_ORDER-1)));
 //    _RME_Kern_Snd(Reg, RME_Int_Sig[RME_CPUID()]);
+    _RME_Kern_Snd(Reg, RME_Int_Sig[RME_CPUID()]);
 }
 /* End Function:__RME_X64_Generic_Handler ************************************/
 
+/* Begin Function:___RME_X64_Pgtbl_Entry **************************************
+Description : Translate the RME standard page attributes into the x64 page entry
+              bits. The pages are always user accessible; bufferable and static
+              have no meaning here.
+Input       : ptr_t Flags - The RME standard page attributes.
+Output      : None.
+Return      : ptr_t - The x64 page entry bits.
+******************************************************************************/
+static ptr_t ___RME_X64_Pgtbl_Entry(ptr_t Flags)
+{
+    ptr_t Entry;
+    
+    Entry=RME_X64_MMU_P|RME_X64_MMU_US;
+    if((Flags&RME_PGTBL_WRITE)!=0)
+        Entry|=RME_X64_MMU_RW;
+    if((Flags&RME_PGTBL_EXECUTE)==0)
+        Entry|=RME_X64_MMU_NX;
+    if((Flags&RME_PGTBL_CACHEABLE)==0)
+        Entry|=RME_X64_MMU_PCD;
+    
+    return Entry;
+}
+/* End Function:___RME_X64_Pgtbl_Entry ***************************************/
+
+/* Begin Function:___RME_X64_Pgtbl_Flags **************************************
+Description : Translate the x64 page entry bits back into the RME standard page
+              attributes. Bufferable and static have no meaning here, so they are
+              always there, and do not stop the delegation of this page.
+Input       : ptr_t Entry - The x64 page entry.
+Output      : None.
+Return      : ptr_t - The RME standard page attributes.
+******************************************************************************/
+static ptr_t ___RME_X64_Pgtbl_Flags(ptr_t Entry)
+{
+    ptr_t Flags;
+    
+    Flags=RME_PGTBL_READ|RME_PGTBL_BUFFERABLE|RME_PGTBL_STATIC;
+    if((Entry&RME_X64_MMU_RW)!=0)
+        Flags|=RME_PGTBL_WRITE;
+    if((Entry&RME_X64_MMU_NX)==0)
+        Flags|=RME_PGTBL_EXECUTE;
+    if((Entry&RME_X64_MMU_PCD)==0)
+        Flags|=RME_PGTBL_CACHEABLE;
+    
+    return Flags;
+}
+/* End Function:___RME_X64_Pgtbl_Flags ***************************************/
+
+/* Begin Function:___RME_X64_Pgtbl_Terminal ***********************************
+Description : See if a present entry maps a page, or points to the next level.
+Input       : ptr_t Entry - The x64 page entry.
+              ptr_t Size_Order - The size order of the table that the entry is in.
+Output      : None.
+Return      : ptr_t - If this is a page, 1; else 0.
+******************************************************************************/
+static ptr_t ___RME_X64_Pgtbl_Terminal(ptr_t Entry, ptr_t Size_Order)
+{
+    if(Size_Order==RME_PGTBL_SIZE_4K)
+        return 1;
+    if((Entry&RME_X64_MMU_PDE_SUP)!=0)
+        return 1;
+    
+    return 0;
+}
+/* End Function:___RME_X64_Pgtbl_Terminal ************************************/
+
 /* Begin Function:__RME_Pgtbl_Kmem_Init ***************************************
 Description : Initialize the kernel mapping tables, so it can be added to all the
-              top-level page tables. In STM32, we do not need to add such pages.
+              top-level page tables. The boot page table already have them, so we
+              only see if the 1GB pages can be used.
 Input       : None.
 Output      : None.
 Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ******************************************************************************/
 ptr_t __RME_Pgtbl_Kmem_Init(void)
 {
-    /* Empty function, always immediately successful */
+    ptr_t Buf[4];
+    
+    __RME_X64_CPUID_Get(0x80000001, 0, Buf);
+    if((Buf[3]&RME_X64_CPUID_E1_PAGE1GB)!=0)
+        RME_X64_Page_1G=1;
+    else
+        RME_X64_Page_1G=0;
+    
     return 0;
 }
 /* End Function:__RME_Pgtbl_Kmem_Init ****************************************/
 
 /* Begin Function:__RME_Pgtbl_Check *******************************************
 Description : Check if the page table parameters are feasible, according to the
-              parameters. This is only used in page table creation.
+              parameters. This is only used in page table creation. All tables
+              have 512 entries. The top-level one covers the whole address space,
+              and the others must be aligned to their range, in the user half.
 Input       : ptr_t Start_Addr - The start mapping address.
               ptr_t Top_Flag - The top-level flag,
               ptr_t Size_Order - The size order of the page directory.
@@ -758,7 +1544,23 @@ Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ******************************************************************************/
 ptr_t __RME_Pgtbl_Check(ptr_t Start_Addr, ptr_t Top_Flag, ptr_t Size_Order, ptr_t Num_Order)
 {
-
+    if(Num_Order!=RME_PGTBL_NUM_512)
+        return RME_ERR_PGT_OPFAIL;
+    
+    if(Top_Flag!=0)
+    {
+        if((Size_Order!=RME_X64_PGTBL_SIZE_512G)||(Start_Addr!=0))
+            return RME_ERR_PGT_OPFAIL;
+        return 0;
+    }
+    
+    if((Size_Order!=RME_PGTBL_SIZE_4K)&&(Size_Order!=RME_PGTBL_SIZE_2M)&&
+       (Size_Order!=RME_PGTBL_SIZE_1G))
+        return RME_ERR_PGT_OPFAIL;
+    if((Start_Addr&RME_MASK_END(Size_Order+Num_Order-1))!=0)
+        return RME_ERR_PGT_OPFAIL;
+    if(Start_Addr>=RME_POW2(RME_X64_PGTBL_SIZE_512G+RME_PGTBL_NUM_512-1))
+        return RME_ERR_PGT_OPFAIL;
     
     return 0;
 }
@@ -766,6 +1568,8 @@ ptr_t __RME_Pgtbl_Check(ptr_t Start_Addr, ptr_t Top_Flag, ptr_t Size_Order, ptr_
 
 /* Begin Function:__RME_Pgtbl_Init ********************************************
 Description : Initialize the page table data structure, according to the capability.
+              The hardware needs the table to be aligned to 4kB. A top-level table
+              gets the kernel entries of the boot page table.
 Input       : struct RME_Cap_Pgtbl* - The capability to the page table to operate on.
 Output      : None.
 Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
@@ -774,10 +1578,33 @@ ptr_t __RME_Pgtbl_Init(struct RME_Cap_Pgtbl* Pgtbl_Op)
 {
     cnt_t Count;
     ptr_t* Ptr;
+    struct __RME_X64_Pgtbl_Meta* Meta;
     
     /* Get the actual table */
     Ptr=RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*);
-
+    if((((ptr_t)Ptr)&RME_MASK_END(RME_PGTBL_SIZE_4K-1))!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Initialize the causal metadata */
+    Meta=RME_X64_PGTBL_META(Ptr);
+    Meta->Start_Addr=Pgtbl_Op->Start_Addr;
+    Meta->Toplevel=0;
+    Meta->Size_Num_Order=Pgtbl_Op->Size_Num_Order;
+    Meta->Dir_Page_Count=0;
+    
+    /* Clean up the table itself */
+    for(Count=0;Count<RME_POW2(RME_PGTBL_NUM_512);Count++)
+        Ptr[Count]=0;
+    
+    /* Is this a top-level? If it is, we need to add the kernel entries */
+    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
+    {
+        for(Count=0;Count<RME_X64_PGTBL_USER_START;Count++)
+            Ptr[Count]=RME_X64_PA2VA(RME_X64_PGTBL_BOOT)[Count];
+        for(Count=RME_X64_PGTBL_USER_END;Count<RME_POW2(RME_PGTBL_NUM_512);Count++)
+            Ptr[Count]=RME_X64_PA2VA(RME_X64_PGTBL_BOOT)[Count];
+    }
+    
     return 0;
 }
 /* End Function:__RME_Pgtbl_Init *********************************************/
@@ -790,17 +1617,23 @@ Return      : ptr_t - If can be deleted, 0; else RME_ERR_PGT_OPFAIL.
 ******************************************************************************/
 ptr_t __RME_Pgtbl_Del_Check(struct RME_Cap_Pgtbl* Pgtbl_Op)
 {
+    struct __RME_X64_Pgtbl_Meta* Meta;
+    
     /* Check if we are standalone */
+    Meta=RME_X64_PGTBL_META(RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*));
+    if(RME_X64_PGTBL_DIRNUM(Meta->Dir_Page_Count)!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    if(Meta->Toplevel!=0)
+        return RME_ERR_PGT_OPFAIL;
     
     return 0;
 }
 /* End Function:__RME_Pgtbl_Del_Check ****************************************/
 
 /* Begin Function:__RME_Pgtbl_Page_Map ****************************************
-Description : Map a page into the page table. If a page is mapped into the slot, the
-              flags is actually placed on the metadata place because all pages are
-              required to have the same flags. We take advantage of this to increase
-              the page granularity.
+Description : Map a page into the page table. The top-level table cannot map pages,
+              and the 1GB pages need the processor's support.
 Input       : struct RME_Cap_Pgtbl* - The cap ability to the page table to operate on.
               ptr_t Paddr - The physical address to map to. If we are unmapping, this have no effect.
               ptr_t Pos - The position in the page table.
@@ -811,64 +1644,42 @@ Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ******************************************************************************/
 ptr_t __RME_Pgtbl_Page_Map(struct RME_Cap_Pgtbl* Pgtbl_Op, ptr_t Paddr, ptr_t Pos, ptr_t Flags)
 {
-//    ptr_t* Table;
-//    struct __RME_CMX_Pgtbl_Meta* Meta;
-//
-//    /* We are doing page-based operations on this, so the page directory should
-//     * be MPU-representable. Only page sizes of 8 are representable for Cortex-M */
-//    if(RME_PGTBL_NUMORD(Pgtbl_Op->Size_Num_Order)!=3)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Get the metadata */
-//    Meta=RME_CAP_GETOBJ(Pgtbl_Op,struct __RME_CMX_Pgtbl_Meta*);
-//
-//    /* Where is the entry slot */
-//    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
-//        Table=RME_CMX_PGTBL_TBL_TOP((ptr_t*)Meta);
-//    else
-//        Table=RME_CMX_PGTBL_TBL_NOM((ptr_t*)Meta);
-//
-//    /* Check if we are trying to make duplicate mappings into the same location */
-//    if((Table[Pos]&RME_CMX_PGTBL_PRESENT)!=0)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Trying to map something. Check if the pages flags are consistent. MPU
-//     * subregions shall share the same flags in Cortex-M */
-//    if(RME_CMX_PGTBL_PAGENUM(Meta->Dir_Page_Count)==0)
-//        Meta->Page_Flags=Flags;
-//    else
-//    {
-//        if(Meta->Page_Flags!=Flags)
-//            return RME_ERR_PGT_OPFAIL;
-//    }
-//
-//    /* Register into the page table */
-//    Table[Pos]=RME_CMX_PGTBL_PRESENT|RME_CMX_PGTBL_TERMINAL|
-//               RME_ROUND_DOWN(Paddr,RME_PGTBL_SIZEORD(Pgtbl_Op->Size_Num_Order));
-//
-//    /* If we are the top level or we have a top level, and we have static pages mapped in, do MPU updates */
-//    if((Meta->Toplevel!=0)||(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0))
-//    {
-//        if((Flags&RME_PGTBL_STATIC)!=0)
-//        {
-//            /* Mapping static pages, update the MPU representation */
-//            if(___RME_Pgtbl_MPU_Update(Meta, RME_CMX_MPU_UPD)==RME_ERR_PGT_OPFAIL)
-//            {
-//                /* MPU update failed. Revert operations */
-//                Table[Pos]=0;
-//                return RME_ERR_PGT_OPFAIL;
-//            }
-//        }
-//    }
-//    /* Modify count */
-//    RME_CMX_PGTBL_INC_PAGENUM(Meta->Dir_Page_Count);
+    ptr_t* Table;
+    ptr_t Size_Order;
+    struct __RME_X64_Pgtbl_Meta* Meta;
+    
+    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
+        return RME_ERR_PGT_OPFAIL;
+    /* A page that cannot be read cannot be present */
+    if((Flags&RME_PGTBL_READ)==0)
+        return RME_ERR_PGT_OPFAIL;
+    Size_Order=RME_PGTBL_SIZEORD(Pgtbl_Op->Size_Num_Order);
+    if((Size_Order==RME_PGTBL_SIZE_1G)&&(RME_X64_Page_1G==0))
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Get the table and the metadata */
+    Table=RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*);
+    Meta=RME_X64_PGTBL_META(Table);
+    
+    /* Check if we are trying to make duplicate mappings into the same location */
+    if((Table[Pos]&RME_X64_MMU_P)!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Register into the page table. The 2MB and 1GB pages have the PS bit set */
+    if(Size_Order==RME_PGTBL_SIZE_4K)
+        Table[Pos]=RME_X64_MMU_ADDR(Paddr)|___RME_X64_Pgtbl_Entry(Flags);
+    else
+        Table[Pos]=RME_X64_MMU_ADDR(Paddr)|___RME_X64_Pgtbl_Entry(Flags)|RME_X64_MMU_PDE_SUP;
+    
+    /* Modify count */
+    RME_X64_PGTBL_INC_PAGENUM(Meta->Dir_Page_Count);
     
     return 0;
 }
 /* End Function:__RME_Pgtbl_Page_Map *****************************************/
 
 /* Begin Function:__RME_Pgtbl_Page_Unmap **************************************
-Description : Unmap a page from the page table.
+Description : Unmap a page from the page table. The TLB is flushed afterwards.
 Input       : struct RME_Cap_Pgtbl* - The capability to the page table to operate on.
               ptr_t Pos - The position in the page table.
 Output      : None.
@@ -876,51 +1687,37 @@ Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ******************************************************************************/
 ptr_t __RME_Pgtbl_Page_Unmap(struct RME_Cap_Pgtbl* Pgtbl_Op, ptr_t Pos)
 {
-//    ptr_t* Table;
-//    ptr_t Temp;
-//    struct __RME_CMX_Pgtbl_Meta* Meta;
-//
-//    /* We are doing page-based operations on this, so the page directory should
-//     * be MPU-representable. Only page sizes of 8 are representable for Cortex-M */
-//    if(RME_PGTBL_NUMORD(Pgtbl_Op->Size_Num_Order)!=3)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Get the metadata */
-//    Meta=RME_CAP_GETOBJ(Pgtbl_Op,struct __RME_CMX_Pgtbl_Meta*);
-//
-//    /* Where is the entry slot */
-//    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
-//        Table=RME_CMX_PGTBL_TBL_TOP((ptr_t*)Meta);
-//    else
-//        Table=RME_CMX_PGTBL_TBL_NOM((ptr_t*)Meta);
-//
-//    /* Check if we are trying to remove something that does not exist, or trying to
-//     * remove a page directory */
-//    if(((Table[Pos]&RME_CMX_PGTBL_PRESENT)==0)||((Table[Pos]&RME_CMX_PGTBL_TERMINAL)==0))
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    Temp=Table[Pos];
-//    Table[Pos]=0;
-//    /* If we are top-level or we have a top-level, do MPU updates */
-//    if((Meta->Toplevel!=0)||(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0))
-//    {
-//        /* Now we are unmapping the pages - Immediately update MPU representations */
-//        if(___RME_Pgtbl_MPU_Update(Meta, RME_CMX_MPU_UPD)==RME_ERR_PGT_OPFAIL)
-//        {
-//            /* Revert operations */
-//            Table[Pos]=Temp;
-//            return RME_ERR_PGT_OPFAIL;
-//        }
-//    }
-//    /* Modify count */
-//    RME_CMX_PGTBL_DEC_PAGENUM(Meta->Dir_Page_Count);
+    ptr_t* Table;
+    struct __RME_X64_Pgtbl_Meta* Meta;
+    
+    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Get the table and the metadata */
+    Table=RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*);
+    Meta=RME_X64_PGTBL_META(Table);
+    
+    /* Check if we are trying to remove something that does not exist, or trying to
+     * remove a page directory */
+    if((Table[Pos]&RME_X64_MMU_P)==0)
+        return RME_ERR_PGT_OPFAIL;
+    if(___RME_X64_Pgtbl_Terminal(Table[Pos],RME_PGTBL_SIZEORD(Pgtbl_Op->Size_Num_Order))==0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    Table[Pos]=0;
+    __RME_X64_Write_CR3(__RME_X64_Read_CR3());
+    
+    /* Modify count */
+    RME_X64_PGTBL_DEC_PAGENUM(Meta->Dir_Page_Count);
     
     return 0;
 }
 /* End Function:__RME_Pgtbl_Page_Unmap ***************************************/
 
 /* Begin Function:__RME_Pgtbl_Pgdir_Map ***************************************
-Description : Map a page directory into the page table.
+Description : Map a page directory into the page table. The hardware needs the
+              child to cover the whole range of the parent entry, and the top-level
+              table can only have directories in the user entries.
 Input       : struct RME_Cap_Pgtbl* Pgtbl_Parent - The parent page table.
               struct RME_Cap_Pgtbl* Pgtbl_Child - The child page table.
               ptr_t Pos - The position in the destination page table.
@@ -930,66 +1727,48 @@ Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ptr_t __RME_Pgtbl_Pgdir_Map(struct RME_Cap_Pgtbl* Pgtbl_Parent, ptr_t Pos, 
                             struct RME_Cap_Pgtbl* Pgtbl_Child)
 {
-//    ptr_t* Parent_Table;
-//    struct __RME_CMX_Pgtbl_Meta* Parent_Meta;
-//    struct __RME_CMX_Pgtbl_Meta* Child_Meta;
-//
-//    /* Is the child a designated top level directory? If it is, we do not allow
-//     * constructions. In Cortex-M, we only allow the designated top-level to be
-//     * the actual top-level. */
-//    if(((Pgtbl_Child->Start_Addr)&RME_PGTBL_TOP)!=0)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Get the metadata */
-//    Parent_Meta=RME_CAP_GETOBJ(Pgtbl_Parent,struct __RME_CMX_Pgtbl_Meta*);
-//    Child_Meta=RME_CAP_GETOBJ(Pgtbl_Child,struct __RME_CMX_Pgtbl_Meta*);
-//
-//    /* The parent table must have or be a top-directory */
-//    if((Parent_Meta->Toplevel==0)&&(((Parent_Meta->Start_Addr)&RME_PGTBL_TOP)==0))
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Check if the child already mapped somewhere, or have grandchild directories */
-//    if(((Child_Meta->Toplevel)!=0)||(RME_CMX_PGTBL_DIRNUM(Child_Meta->Dir_Page_Count)!=0))
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Where is the entry slot? */
-//    if(((Parent_Meta->Start_Addr)&RME_PGTBL_TOP)!=0)
-//        Parent_Table=RME_CMX_PGTBL_TBL_TOP((ptr_t*)Parent_Meta);
-//    else
-//        Parent_Table=RME_CMX_PGTBL_TBL_NOM((ptr_t*)Parent_Meta);
-//
-//    /* Check if anything already mapped in */
-//    if((Parent_Table[Pos]&RME_CMX_PGTBL_PRESENT)!=0)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* The address must be aligned to a word */
-//    Parent_Table[Pos]=RME_CMX_PGTBL_PRESENT|RME_CMX_PGTBL_PGD_ADDR((ptr_t)Child_Meta);
-//
-//    /* Log the entry into the destination */
-//    Child_Meta->Toplevel=(ptr_t)Parent_Meta;
-//    RME_CMX_PGTBL_INC_DIRNUM(Parent_Meta->Dir_Page_Count);
-//
-//    /* Update MPU settings if there are static pages mapped into the source. If there
-//     * are any, update the MPU settings */
-//    if((RME_CMX_PGTBL_PAGENUM(Child_Meta->Dir_Page_Count)!=0)&&
-//       (((Child_Meta->Page_Flags)&RME_CMX_PGTBL_STATIC)!=0))
-//    {
-//        if(___RME_Pgtbl_MPU_Update(Child_Meta, RME_CMX_MPU_UPD)==RME_ERR_PGT_OPFAIL)
-//        {
-//            /* Mapping failed. Revert operations */
-//            Parent_Table[Pos]=0;
-//            Child_Meta->Toplevel=0;
-//            RME_CMX_PGTBL_DEC_DIRNUM(Parent_Meta->Dir_Page_Count);
-//            return RME_ERR_PGT_OPFAIL;
-//        }
-//    }
-
+    ptr_t* Parent_Table;
+    ptr_t* Child_Table;
+    struct __RME_X64_Pgtbl_Meta* Parent_Meta;
+    struct __RME_X64_Pgtbl_Meta* Child_Meta;
+    
+    /* The top-level table cannot be a child */
+    if(((Pgtbl_Child->Start_Addr)&RME_PGTBL_TOP)!=0)
+        return RME_ERR_PGT_OPFAIL;
+    if(((Pgtbl_Parent->Start_Addr)&RME_PGTBL_TOP)!=0)
+    {
+        if((Pos<RME_X64_PGTBL_USER_START)||(Pos>=RME_X64_PGTBL_USER_END))
+            return RME_ERR_PGT_OPFAIL;
+    }
+    if((RME_PGTBL_SIZEORD(Pgtbl_Child->Size_Num_Order)+RME_PGTBL_NUMORD(Pgtbl_Child->Size_Num_Order))!=
+       RME_PGTBL_SIZEORD(Pgtbl_Parent->Size_Num_Order))
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Get the tables and the metadata */
+    Parent_Table=RME_CAP_GETOBJ(Pgtbl_Parent,ptr_t*);
+    Child_Table=RME_CAP_GETOBJ(Pgtbl_Child,ptr_t*);
+    Parent_Meta=RME_X64_PGTBL_META(Parent_Table);
+    Child_Meta=RME_X64_PGTBL_META(Child_Table);
+    
+    /* Check if the child already mapped somewhere, or anything already mapped in */
+    if(Child_Meta->Toplevel!=0)
+        return RME_ERR_PGT_OPFAIL;
+    if((Parent_Table[Pos]&RME_X64_MMU_P)!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    Parent_Table[Pos]=RME_X64_VA2PA(Child_Table)|RME_X64_MMU_PDE;
+    
+    /* Log the entry into the destination */
+    Child_Meta->Toplevel=(ptr_t)Parent_Table;
+    RME_X64_PGTBL_INC_DIRNUM(Parent_Meta->Dir_Page_Count);
+    
     return 0;
 }
 /* End Function:__RME_Pgtbl_Pgdir_Map ****************************************/
 
 /* Begin Function:__RME_Pgtbl_Pgdir_Unmap *************************************
-Description : Unmap a page directory from the page table.
+Description : Unmap a page directory from the page table. The TLB is flushed
+              afterwards.
 Input       : struct RME_Cap_Pgtbl* Pgtbl_Op - The page table to operate on.
               ptr_t Pos - The position in the page table.
 Output      : None.
@@ -997,45 +1776,39 @@ Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ******************************************************************************/
 ptr_t __RME_Pgtbl_Pgdir_Unmap(struct RME_Cap_Pgtbl* Pgtbl_Op, ptr_t Pos)
 {
-//    ptr_t* Table;
-//    struct __RME_CMX_Pgtbl_Meta* Dst_Meta;
-//    struct __RME_CMX_Pgtbl_Meta* Src_Meta;
-//
-//    /* Get the metadata */
-//    Dst_Meta=RME_CAP_GETOBJ(Pgtbl_Op,struct __RME_CMX_Pgtbl_Meta*);
-//
-//    /* Where is the entry slot */
-//    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
-//        Table=RME_CMX_PGTBL_TBL_TOP((ptr_t*)Dst_Meta);
-//    else
-//        Table=RME_CMX_PGTBL_TBL_NOM((ptr_t*)Dst_Meta);
-//
-//    /* Check if we try to remove something nonexistent, or a page */
-//    if(((Table[Pos]&RME_CMX_PGTBL_PRESENT)==0)||((Table[Pos]&RME_CMX_PGTBL_TERMINAL)!=0))
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    Src_Meta=(struct __RME_CMX_Pgtbl_Meta*)RME_CMX_PGTBL_PGD_ADDR(Table[Pos]);
-//
-//    /* Check if the directory still have child directories */
-//    if(RME_CMX_PGTBL_DIRNUM(Src_Meta->Dir_Page_Count)!=0)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* We are removing a page directory. Do MPU updates if any page mapped in */
-//    if(RME_CMX_PGTBL_PAGENUM(Src_Meta->Dir_Page_Count)!=0)
-//    {
-//        if(___RME_Pgtbl_MPU_Update(Src_Meta, RME_CMX_MPU_CLR)==RME_ERR_PGT_OPFAIL)
-//            return RME_ERR_PGT_OPFAIL;
-//    }
-//
-//    Table[Pos]=0;
-//    Src_Meta->Toplevel=0;
-//    RME_CMX_PGTBL_DEC_DIRNUM(Dst_Meta->Dir_Page_Count);
-
+    ptr_t* Table;
+    struct __RME_X64_Pgtbl_Meta* Dst_Meta;
+    struct __RME_X64_Pgtbl_Meta* Src_Meta;
+    
+    /* The kernel entries of the top-level table cannot be removed */
+    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
+    {
+        if((Pos<RME_X64_PGTBL_USER_START)||(Pos>=RME_X64_PGTBL_USER_END))
+            return RME_ERR_PGT_OPFAIL;
+    }
+    
+    /* Get the table and the metadata */
+    Table=RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*);
+    Dst_Meta=RME_X64_PGTBL_META(Table);
+    
+    /* Check if we try to remove something nonexistent, or a page */
+    if((Table[Pos]&RME_X64_MMU_P)==0)
+        return RME_ERR_PGT_OPFAIL;
+    if(___RME_X64_Pgtbl_Terminal(Table[Pos],RME_PGTBL_SIZEORD(Pgtbl_Op->Size_Num_Order))!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    Src_Meta=RME_X64_PGTBL_META(RME_X64_PA2VA(RME_X64_MMU_ADDR(Table[Pos])));
+    
+    Table[Pos]=0;
+    __RME_X64_Write_CR3(__RME_X64_Read_CR3());
+    Src_Meta->Toplevel=0;
+    RME_X64_PGTBL_DEC_DIRNUM(Dst_Meta->Dir_Page_Count);
+    
     return 0;
 }
 /* End Function:__RME_Pgtbl_Pgdir_Unmap **************************************/
 
-/* Begin Function:__RME_Pgtbl_Lookup ********************************************
+/* Begin Function:__RME_Pgtbl_Lookup ******************************************
 Description : Lookup a page entry in a page directory.
 Input       : struct RME_Cap_Pgtbl* Pgtbl_Op - The page directory to lookup.
               ptr_t Pos - The position to look up.
@@ -1045,30 +1818,29 @@ Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ******************************************************************************/
 ptr_t __RME_Pgtbl_Lookup(struct RME_Cap_Pgtbl* Pgtbl_Op, ptr_t Pos, ptr_t* Paddr, ptr_t* Flags)
 {
-//    ptr_t* Table;
-//
-//    /* Check if the position is within the range of this page table */
-//    if((Pos>>RME_PGTBL_NUMORD(Pgtbl_Op->Size_Num_Order))!=0)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Check if this is the top-level page table. Get the table */
-//    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
-//        Table=RME_CMX_PGTBL_TBL_TOP(RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*));
-//    else
-//        Table=RME_CMX_PGTBL_TBL_NOM(RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*));
-//
-//    /* Start lookup */
-//    if(((Table[Pos]&RME_CMX_PGTBL_PRESENT)==0)||
-//       ((Table[Pos]&RME_CMX_PGTBL_TERMINAL)==0))
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* This is a page. Return the physical address and flags */
-//    if(Paddr!=0)
-//        *Paddr=RME_CMX_PGTBL_PTE_ADDR(Table[Pos]);
-//
-//    if(Flags!=0)
-//        *Flags=RME_CAP_GETOBJ(Pgtbl_Op,struct __RME_CMX_Pgtbl_Meta*)->Page_Flags;
-
+    ptr_t* Table;
+    
+    /* Check if the position is within the range of this page table */
+    if((Pos>>RME_PGTBL_NUMORD(Pgtbl_Op->Size_Num_Order))!=0)
+        return RME_ERR_PGT_OPFAIL;
+    /* The top-level table have no pages */
+    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)!=0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Start lookup */
+    Table=RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*);
+    if((Table[Pos]&RME_X64_MMU_P)==0)
+        return RME_ERR_PGT_OPFAIL;
+    if(___RME_X64_Pgtbl_Terminal(Table[Pos],RME_PGTBL_SIZEORD(Pgtbl_Op->Size_Num_Order))==0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* This is a page. Return the physical address and flags */
+    if(Paddr!=0)
+        *Paddr=RME_X64_MMU_ADDR(Table[Pos]);
+    
+    if(Flags!=0)
+        *Flags=___RME_X64_Pgtbl_Flags(Table[Pos]);
+    
     return 0;
 }
 /* End Function:__RME_Pgtbl_Lookup *******************************************/
@@ -1077,7 +1849,7 @@ ptr_t __RME_Pgtbl_Lookup(struct RME_Cap_Pgtbl* Pgtbl_Op, ptr_t Pos, ptr_t* Paddr
 Description : Walking function for the page table. This function just does page
               table lookups. The page table that is being walked must be the top-
               level page table. The output values are optional; only pass in pointers
-              when you need that value.
+              when you need that value. Only the user entries are walked.
 Input       : struct RME_Cap_Pgtbl* Pgtbl_Op - The page table to walk.
               ptr_t Vaddr - The virtual address to look up.
 Output      : ptr_t* Pgtbl - The pointer to the page table level.
@@ -1091,57 +1863,59 @@ Return      : ptr_t - If successful, 0; else RME_ERR_PGT_OPFAIL.
 ptr_t __RME_Pgtbl_Walk(struct RME_Cap_Pgtbl* Pgtbl_Op, ptr_t Vaddr, ptr_t* Pgtbl,
                        ptr_t* Map_Vaddr, ptr_t* Paddr, ptr_t* Size_Order, ptr_t* Num_Order, ptr_t* Flags)
 {
-//    struct __RME_CMX_Pgtbl_Meta* Meta;
-//    ptr_t* Table;
-//    ptr_t Pos;
-//
-//    /* Check if this is the top-level page table */
-//    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)==0)
-//        return RME_ERR_PGT_OPFAIL;
-//
-//    /* Get the table and start lookup */
-//    Meta=RME_CAP_GETOBJ(Pgtbl_Op, struct __RME_CMX_Pgtbl_Meta*);
-//    Table=RME_CMX_PGTBL_TBL_TOP((ptr_t*)Meta);
-//
-//    /* Do lookup recursively */
-//    while(1)
-//    {
-//        /* Check if the virtual address is in our range */
-//        if(Vaddr<RME_CMX_PGTBL_START(Meta->Start_Addr))
-//            return RME_ERR_PGT_OPFAIL;
-//        /* Calculate where is the entry */
-//        Pos=(Vaddr-RME_CMX_PGTBL_START(Meta->Start_Addr))>>RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order);
-//        /* See if the entry is overrange */
-//        if((Pos>>RME_CMX_PGTBL_NUMORD(Meta->Size_Num_Order))!=0)
-//            return RME_ERR_PGT_OPFAIL;
-//        /* Find the position of the entry - Is there a page, a directory, or nothing? */
-//        if((Table[Pos]&RME_CMX_PGTBL_PRESENT)==0)
-//            return RME_ERR_PGT_OPFAIL;
-//        if((Table[Pos]&RME_CMX_PGTBL_TERMINAL)!=0)
-//        {
-//            /* This is a page - we found it */
-//            if(Pgtbl!=0)
-//                *Pgtbl=(ptr_t)Meta;
-//            if(Map_Vaddr!=0)
-//                *Map_Vaddr=RME_CMX_PGTBL_START(Meta->Start_Addr)+(Pos<<RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order));
-//            if(Paddr!=0)
-//                *Paddr=RME_CMX_PGTBL_START(Meta->Start_Addr)+(Pos<<RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order));
-//            if(Size_Order!=0)
-//                *Size_Order=RME_CMX_PGTBL_SIZEORD(Meta->Size_Num_Order);
-//            if(Num_Order!=0)
-//                *Num_Order=RME_CMX_PGTBL_NUMORD(Meta->Size_Num_Order);
-//            if(Flags!=0)
-//                *Flags=Meta->Page_Flags;
-//
-//            break;
-//        }
-//        else
-//        {
-//            /* This is a directory, we goto that directory to continue walking */
-//            Meta=(struct __RME_CMX_Pgtbl_Meta*)RME_CMX_PGTBL_PGD_ADDR(Table[Pos]);
-//            Table=RME_CMX_PGTBL_TBL_NOM((ptr_t*)Meta);
-//        }
-//    }
+    struct __RME_X64_Pgtbl_Meta* Meta;
+    ptr_t* Table;
+    ptr_t Pos;
+    ptr_t Cur_Size;
+    
+    /* Check if this is the top-level page table */
+    if(((Pgtbl_Op->Start_Addr)&RME_PGTBL_TOP)==0)
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Check if the virtual address is in the user entries */
+    Pos=Vaddr>>RME_X64_PGTBL_SIZE_512G;
+    if((Pos<RME_X64_PGTBL_USER_START)||(Pos>=RME_X64_PGTBL_USER_END))
+        return RME_ERR_PGT_OPFAIL;
+    
+    /* Get the table and start lookup */
+    Table=RME_CAP_GETOBJ(Pgtbl_Op,ptr_t*);
+    Meta=RME_X64_PGTBL_META(Table);
+    
+    /* Do lookup level by level */
+    while(1)
+    {
+        /* Calculate where is the entry */
+        Cur_Size=RME_PGTBL_SIZEORD(Meta->Size_Num_Order);
+        Pos=(Vaddr>>Cur_Size)&RME_MASK_END(RME_PGTBL_NUM_512-1);
+        /* Find the position of the entry - Is there a page, a directory, or nothing? */
+        if((Table[Pos]&RME_X64_MMU_P)==0)
+            return RME_ERR_PGT_OPFAIL;
+        if(___RME_X64_Pgtbl_Terminal(Table[Pos],Cur_Size)!=0)
+        {
+            /* This is a page - we found it */
+            if(Pgtbl!=0)
+                *Pgtbl=(ptr_t)Table;
+            if(Map_Vaddr!=0)
+                *Map_Vaddr=RME_ROUND_DOWN(Vaddr,Cur_Size);
+            if(Paddr!=0)
+                *Paddr=RME_X64_MMU_ADDR(Table[Pos]);
+            if(Size_Order!=0)
+                *Size_Order=Cur_Size;
+            if(Num_Order!=0)
+                *Num_Order=RME_PGTBL_NUMORD(Meta->Size_Num_Order);
+            if(Flags!=0)
+                *Flags=___RME_X64_Pgtbl_Flags(Table[Pos]);
+            
+            break;
+        }
+        else
+        {
+            /* This is a directory, we goto that directory to continue walking */
+            Table=RME_X64_PA2VA(RME_X64_MMU_ADDR(Table[Pos]));
+            Meta=RME_X64_PGTBL_META(Table);
+        }
+    }
+    
     return 0;
 }
 /* End Function:__RME_Pgtbl_Walk *********************************************/
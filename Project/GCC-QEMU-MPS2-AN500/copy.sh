@@ -0,0 +1,2 @@
+cp -f RME_platform.h ../../MEukaron/Include/Platform/RME_platform.h
+cp -f platform_cmx_conf.h ../../MEukaron/Include/Platform/CortexM/platform_cmx_conf.h
@@ -0,0 +1,15 @@
+/******************************************************************************
+Filename    : RME_platform.h
+Author      : pry 
+Date        : 11/10/2017
+Licence     : LGPL v3+; see COPYING for details.
+Description : The platform specific types for RME.
+******************************************************************************/
+
+/* Platform Includes *********************************************************/
+#include "Platform/CortexM/platform_cmx.h"
+/* End Platform Includes *****************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) Evo-Devo Instrum. All rights reserved ***********************/
@@ -0,0 +1,15 @@
+/******************************************************************************
+Filename   : platform_cmx_conf.h
+Author     : pry
+Date       : 24/06/2017
+Licence    : LGPL v3+; see COPYING for details.
+Description: The configuration file for Cortex-M HAL.
+******************************************************************************/
+
+/* Config Includes ***********************************************************/
+#include "Platform/CortexM/Chips/MPS2_AN505/platform_MPS2_AN505.h"
+/* End Config Includes *******************************************************/
+
+/* End Of File ***************************************************************/
+
+/* Copyright (C) Evo-Devo Instrum. All rights reserved ***********************/
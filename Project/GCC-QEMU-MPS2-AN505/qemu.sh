@@ -0,0 +1 @@
+qemu-system-arm -machine mps2-an505 -cpu cortex-m33 -display none -serial mon:stdio -icount shift=3 -kernel Debug/RME.elf